@@ -84,6 +84,28 @@ main(void)
             BENCHMARK_ITERATIONS, elapsed);
     free(elapsed);
 
+    /* Lookups of existing atoms, as done when compiling keymaps. */
+    table = atom_table_new();
+    assert(table);
+    darray_foreach(worditer, words)
+        atom_intern(table, *worditer, strlen(*worditer), true);
+
+    bench_start(&bench);
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        darray_foreach(worditer, words) {
+            atom = atom_intern(table, *worditer, strlen(*worditer), false);
+            assert(atom != XKB_ATOM_NONE);
+        }
+    }
+    bench_stop(&bench);
+
+    atom_table_free(table);
+
+    elapsed = bench_elapsed_str(&bench);
+    fprintf(stderr, "%d lookup iterations in %ss\n",
+            BENCHMARK_ITERATIONS, elapsed);
+    free(elapsed);
+
     darray_foreach(worditer, words) {
         free(*worditer);
     }
@@ -0,0 +1,93 @@
+/*
+ * Copyright © 2023 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <time.h>
+
+#include "../test/test.h"
+#include "bench.h"
+
+#define BENCHMARK_ITERATIONS 200
+
+/* Time what a client does with the string it receives from the server. */
+static void
+bench_compile(struct xkb_context *ctx, const char *string, const char *what)
+{
+    struct xkb_keymap *keymap;
+    struct bench bench;
+    char *elapsed;
+    int i;
+
+    bench_start(&bench);
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        keymap = xkb_keymap_new_from_string(ctx, string,
+                                            XKB_KEYMAP_FORMAT_TEXT_V1,
+                                            XKB_KEYMAP_COMPILE_NO_FLAGS);
+        assert(keymap);
+        xkb_keymap_unref(keymap);
+    }
+    bench_stop(&bench);
+
+    elapsed = bench_elapsed_str(&bench);
+    fprintf(stderr, "compiled %d %s dumps in %ss\n",
+            BENCHMARK_ITERATIONS, what, elapsed);
+    free(elapsed);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap;
+    char *dump, *compact;
+
+    ctx = test_get_context(0);
+    assert(ctx);
+
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    xkb_context_set_log_verbosity(ctx, 0);
+
+    keymap = test_compile_rules(ctx, "evdev", "pc105", "us,de", "",
+                                "grp:alt_shift_toggle");
+    assert(keymap);
+
+    dump = xkb_keymap_get_as_string2(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                                     XKB_KEYMAP_SERIALIZE_NO_FLAGS);
+    compact = xkb_keymap_get_as_string2(keymap,
+                                        XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                                        XKB_KEYMAP_SERIALIZE_COMPACT);
+    assert(dump && compact);
+    xkb_keymap_unref(keymap);
+
+    fprintf(stderr, "dump size: default %zu bytes, compact %zu bytes\n",
+            strlen(dump), strlen(compact));
+
+    bench_compile(ctx, dump, "default");
+    bench_compile(ctx, compact, "compact");
+
+    free(dump);
+    free(compact);
+    xkb_context_unref(ctx);
+    return 0;
+}
@@ -31,6 +31,11 @@
 #include "bench.h"
 
 #define BENCHMARK_ITERATIONS 20000
+#define BENCHMARK_BATCH_SIZE 200
+
+static const char *batch_layouts[] = {
+    "us", "de", "fr", "ru", "il", "ca", "ch", "cz", "in", "gb",
+};
 
 int
 main(int argc, char *argv[])
@@ -66,6 +71,49 @@ main(int argc, char *argv[])
             BENCHMARK_ITERATIONS, elapsed);
     free(elapsed);
 
+    {
+        struct xkb_rule_names batch[BENCHMARK_BATCH_SIZE];
+        struct xkb_component_names kccgst[BENCHMARK_BATCH_SIZE];
+
+        for (i = 0; i < BENCHMARK_BATCH_SIZE; i++) {
+            batch[i] = rmlvo;
+            batch[i].layout = batch_layouts[i % ARRAY_SIZE(batch_layouts)];
+            batch[i].variant = NULL;
+        }
+
+        bench_start(&bench);
+        for (i = 0; i < BENCHMARK_BATCH_SIZE; i++)
+            assert(xkb_components_from_rules(ctx, &batch[i], &kccgst[i]));
+        bench_stop(&bench);
+        for (i = 0; i < BENCHMARK_BATCH_SIZE; i++) {
+            free(kccgst[i].keycodes);
+            free(kccgst[i].types);
+            free(kccgst[i].compat);
+            free(kccgst[i].symbols);
+        }
+
+        elapsed = bench_elapsed_str(&bench);
+        fprintf(stderr, "resolved %d RMLVO one by one in %ss\n",
+                BENCHMARK_BATCH_SIZE, elapsed);
+        free(elapsed);
+
+        bench_start(&bench);
+        assert(xkb_components_from_rules_batch(ctx, batch,
+                                               BENCHMARK_BATCH_SIZE, kccgst));
+        bench_stop(&bench);
+        for (i = 0; i < BENCHMARK_BATCH_SIZE; i++) {
+            free(kccgst[i].keycodes);
+            free(kccgst[i].types);
+            free(kccgst[i].compat);
+            free(kccgst[i].symbols);
+        }
+
+        elapsed = bench_elapsed_str(&bench);
+        fprintf(stderr, "resolved %d RMLVO in a batch in %ss\n",
+                BENCHMARK_BATCH_SIZE, elapsed);
+        free(elapsed);
+    }
+
     xkb_context_unref(ctx);
     return 0;
 }
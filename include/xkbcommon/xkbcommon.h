@@ -583,7 +583,7 @@ xkb_keysym_to_lower(xkb_keysym_t ks);
  *
  * The user may set some environment variables which affect the library:
  *
- * - `XKB_CONFIG_ROOT`, `XKB_CONFIG_EXTRA_PATH`, `XDG_CONFIG_DIR`, `HOME` - see @ref include-path.
+ * - `XKB_CONFIG_ROOT`, `XKB_CONFIG_EXTRA_PATH`, `XKB_CONFIG_BUNDLE`, `XDG_CONFIG_DIR`, `HOME` - see @ref include-path.
  * - `XKB_LOG_LEVEL` - see xkb_context_set_log_level().
  * - `XKB_LOG_VERBOSITY` - see xkb_context_set_log_verbosity().
  * - `XKB_DEFAULT_RULES`, `XKB_DEFAULT_MODEL`, `XKB_DEFAULT_LAYOUT`,
@@ -608,7 +608,21 @@ enum xkb_context_flags {
      *
      * @since 1.5.0
      */
-    XKB_CONTEXT_NO_SECURE_GETENV = (1 << 2)
+    XKB_CONTEXT_NO_SECURE_GETENV = (1 << 2),
+    /**
+     * Share identical keymaps created in this context.
+     *
+     * When a keymap is created from the same RMLVO names, or the same
+     * keymap string or buffer, as a keymap of this context which is still
+     * alive, a new reference to that keymap is returned instead of
+     * compiling it again.  No messages are logged in that case.
+     *
+     * Changing the include path of the context stops sharing the keymaps
+     * created until then.
+     *
+     * @since 1.6.0
+     */
+    XKB_CONTEXT_SHARE_KEYMAPS = (1 << 3)
 };
 
 /**
@@ -685,6 +699,8 @@ xkb_context_get_user_data(struct xkb_context *context);
  * - The `XKB_CONFIG_EXTRA_PATH` environment variable, if defined, otherwise the
  *   system configuration directory, defined at library configuration time
  *   (usually `/etc/xkb`).
+ * - The include bundle in the `XKB_CONFIG_BUNDLE` environment variable, if
+ *   defined; see xkb_context_include_path_append_bundle().
  * - The `XKB_CONFIG_ROOT` environment variable, if defined, otherwise
  *   the system XKB root, defined at library configuration time.
  *
@@ -702,6 +718,30 @@ xkb_context_get_user_data(struct xkb_context *context);
 int
 xkb_context_include_path_append(struct xkb_context *context, const char *path);
 
+/**
+ * Append an include bundle to the context's include path.
+ *
+ * An include bundle is a single file holding all the files of an include
+ * root, as written by `xkbcli compile-database`. Includes are then looked
+ * up in the bundle like in a directory, without opening and reading the
+ * files one by one. The bundle must be written by a machine with the same
+ * byte order, and is not updated when the files it was written from
+ * change.
+ *
+ * The bundle appears in the include path under its path.  Rules files
+ * included with `! include %S/...` are looked up in the bundles of the
+ * include path before the system include path.
+ *
+ * @returns 1 on success, or 0 if the bundle could not be read or is not a
+ * valid bundle.
+ *
+ * @since 1.6.0
+ * @memberof xkb_context
+ */
+int
+xkb_context_include_path_append_bundle(struct xkb_context *context,
+                                       const char *path);
+
 /**
  * Append the default include paths to the context's include path.
  *
@@ -752,6 +792,31 @@ xkb_context_num_include_paths(struct xkb_context *context);
 const char *
 xkb_context_include_path_get(struct xkb_context *context, unsigned int index);
 
+/**
+ * Set the size of the context's file cache.
+ *
+ * The context keeps the contents of the keymap, rules and Compose files it
+ * reads, so that a file used again, e.g. symbols/pc, is not read again as
+ * long as it did not change. This sets how many bytes of file contents the
+ * cache may keep; the least recently used files are dropped first.
+ *
+ * The default is 2 MiB.  A limit of 0 disables the cache.
+ *
+ * @since 1.6.0
+ * @memberof xkb_context
+ */
+void
+xkb_context_set_file_cache_limit(struct xkb_context *context, size_t limit);
+
+/**
+ * Get the size of the context's file cache.
+ *
+ * @since 1.6.0
+ * @memberof xkb_context
+ */
+size_t
+xkb_context_get_file_cache_limit(struct xkb_context *context);
+
 /** @} */
 
 /**
@@ -887,6 +952,40 @@ xkb_keymap_new_from_names(struct xkb_context *context,
                           const struct xkb_rule_names *names,
                           enum xkb_keymap_compile_flags flags);
 
+/**
+ * Create a keymap from RMLVO names, reusing the work done for another
+ * keymap.
+ *
+ * The result is the same as that of xkb_keymap_new_from_names() with the
+ * context of @p keymap.  However, if @p keymap was itself created from
+ * RMLVO names, the parts of it which the new names do not change are
+ * reused: when only the symbols differ, as is usually the case when
+ * changing layouts, variants or most options, the keycodes, types and
+ * compatibility sections are compiled once, on the first such call, and
+ * then shared by @p keymap and all keymaps derived from it.  If the new
+ * names lead to the very same keymap, a new reference to @p keymap is
+ * returned.
+ *
+ * This assumes the files in the include paths did not change since
+ * @p keymap was created.
+ *
+ * @param keymap The keymap to derive the new keymap from.
+ * @param names  The RMLVO names to use.  See xkb_rule_names.
+ * @param flags  Optional flags for the keymap, or 0.
+ *
+ * @returns A keymap compiled according to the RMLVO names, or NULL if
+ * the compilation failed.  It must be released with xkb_keymap_unref()
+ * like any other keymap.
+ *
+ * @sa xkb_keymap_new_from_names()
+ * @memberof xkb_keymap
+ * @since 1.6.0
+ */
+struct xkb_keymap *
+xkb_keymap_derive_from_names(struct xkb_keymap *keymap,
+                             const struct xkb_rule_names *names,
+                             enum xkb_keymap_compile_flags flags);
+
 /** The possible keymap formats. */
 enum xkb_keymap_format {
     /** The current/classic XKB text format, as generated by xkbcomp -xkb. */
@@ -993,6 +1092,151 @@ char *
 xkb_keymap_get_as_string(struct xkb_keymap *keymap,
                          enum xkb_keymap_format format);
 
+/** Flags for serializing a keymap. */
+enum xkb_keymap_serialize_flags {
+    /** Do not apply any flags. */
+    XKB_KEYMAP_SERIALIZE_NO_FLAGS = 0,
+    /**
+     * Make the string as small as possible, e.g. for sending it to many
+     * clients: leave out the indentation and the spacing, the key types and
+     * interpretations no key uses, the virtual modifiers nothing refers to,
+     * and the statements which only repeat the defaults.
+     *
+     * Compiling the resulting string gives a keymap which behaves the same
+     * as the original one, but which may not have all of its key types and
+     * virtual modifiers.
+     *
+     * @since 1.6.0
+     */
+    XKB_KEYMAP_SERIALIZE_COMPACT = (1 << 0)
+};
+
+/**
+ * Get the compiled keymap as a string, with serialization flags.
+ *
+ * This is just like xkb_keymap_get_as_string(), which is the same as passing
+ * XKB_KEYMAP_SERIALIZE_NO_FLAGS.
+ *
+ * @param keymap The keymap to get as a string.
+ * @param format The keymap format to use for the string, or
+ * XKB_KEYMAP_USE_ORIGINAL_FORMAT.
+ * @param flags  Optional flags for the serialization, or 0.
+ *
+ * @returns The keymap as a NUL-terminated string, or NULL if unsuccessful.
+ *
+ * @see xkb_keymap_get_as_string()
+ * @memberof xkb_keymap
+ * @since 1.6.0
+ */
+char *
+xkb_keymap_get_as_string2(struct xkb_keymap *keymap,
+                          enum xkb_keymap_format format,
+                          enum xkb_keymap_serialize_flags flags);
+
+/**
+ * Get the compiled keymap as a string owned by the keymap.
+ *
+ * The string is the same as the one returned by xkb_keymap_get_as_string().
+ * It is built on the first call and kept with the keymap, so later calls
+ * return it at no cost, e.g. when sending the keymap to each new client
+ * of a display server.  Once it is built, xkb_keymap_get_as_string() and
+ * xkb_keymap_get_as_fd() copy it rather than serializing the keymap again.
+ *
+ * @param keymap   The keymap to get as a string.
+ * @param format   The keymap format to use for the string.  Only the format
+ * from which the keymap was created, or XKB_KEYMAP_USE_ORIGINAL_FORMAT, is
+ * supported.
+ * @param size_out If not NULL, set to the length of the string, not
+ * counting the terminating NUL.
+ *
+ * @returns The keymap as a NUL-terminated string, or NULL if unsuccessful.
+ * The string must not be modified nor freed; it is valid as long as the
+ * keymap is.
+ *
+ * @sa xkb_keymap_get_as_string()
+ * @memberof xkb_keymap
+ * @since 1.6.0
+ */
+const char *
+xkb_keymap_get_as_cached_string(struct xkb_keymap *keymap,
+                                enum xkb_keymap_format format,
+                                size_t *size_out);
+
+/**
+ * A function receiving a keymap string in chunks.
+ *
+ * @param user_data The user data passed to xkb_keymap_write().
+ * @param data      The next chunk of the string.  It is not NUL-terminated
+ * and only valid during the call.
+ * @param size      The size of the chunk, in bytes.
+ *
+ * @returns 1 on success, or 0 to stop writing the keymap.
+ *
+ * @sa xkb_keymap_write()
+ * @since 1.6.0
+ */
+typedef int (*xkb_keymap_write_fn)(void *user_data, const char *data,
+                                   size_t size);
+
+/**
+ * Write the compiled keymap as a string, in chunks.
+ *
+ * This produces the same string as xkb_keymap_get_as_string(), without
+ * the terminating NUL, but passes it to @p write_fn in chunks of a few
+ * kilobytes instead of allocating it whole.
+ *
+ * If @p write_fn is NULL, nothing is written: only the size of the string
+ * is computed, e.g. to allocate its destination up front.
+ *
+ * @param keymap    The keymap to write.
+ * @param format    The keymap format to use, or
+ * XKB_KEYMAP_USE_ORIGINAL_FORMAT.
+ * @param flags     Optional flags for the serialization, or 0.
+ * @param write_fn  The function receiving the chunks of the string, or
+ * NULL.
+ * @param user_data Passed to @p write_fn.
+ *
+ * @returns The size of the string in bytes, not counting a terminating
+ * NUL, or 0 if unsuccessful or if @p write_fn stopped the writing.
+ *
+ * @sa xkb_keymap_get_as_string()
+ * @memberof xkb_keymap
+ * @since 1.6.0
+ */
+size_t
+xkb_keymap_write(struct xkb_keymap *keymap, enum xkb_keymap_format format,
+                 enum xkb_keymap_serialize_flags flags,
+                 xkb_keymap_write_fn write_fn, void *user_data);
+
+/**
+ * Write the compiled keymap as a string into a new anonymous file.
+ *
+ * This is meant for sending the keymap to other processes, e.g. to Wayland
+ * clients with the wl_keyboard.keymap event: the string is written into
+ * the file, followed by a terminating NUL, without going through an
+ * intermediate string.  Where the system supports it, the file is sealed
+ * against any further modification, so that it may be shared by all the
+ * clients.
+ *
+ * @param keymap   The keymap to write.
+ * @param format   The keymap format to use, or
+ * XKB_KEYMAP_USE_ORIGINAL_FORMAT.
+ * @param flags    Optional flags for the serialization, or 0.
+ * @param size_out Set to the size of the file contents in bytes, including
+ * the terminating NUL.
+ *
+ * @returns A file descriptor with the close-on-exec flag set, positioned at
+ * the start of the file, or -1 if unsuccessful.  It should be closed by
+ * the caller.
+ *
+ * @sa xkb_keymap_get_as_string()
+ * @memberof xkb_keymap
+ * @since 1.6.0
+ */
+int
+xkb_keymap_get_as_fd(struct xkb_keymap *keymap, enum xkb_keymap_format format,
+                     enum xkb_keymap_serialize_flags flags, size_t *size_out);
+
 /** @} */
 
 /**
@@ -1286,6 +1530,80 @@ xkb_keymap_key_get_syms_by_level(struct xkb_keymap *keymap,
                                  xkb_level_index_t level,
                                  const xkb_keysym_t **syms_out);
 
+/**
+ * A way to produce a keysym with a keymap: a key, the layout and shift
+ * level in which the keysym appears, and a modifier mask which selects
+ * that shift level.
+ *
+ * @sa xkb_keymap_keysym_get_positions()
+ * @since 1.6.0
+ */
+struct xkb_key_position {
+    /** The keycode of the key. */
+    xkb_keycode_t keycode;
+    /** The layout in which the key produces the keysym. */
+    xkb_layout_index_t layout;
+    /** The shift level in which the key produces the keysym. */
+    xkb_level_index_t level;
+    /** A modifier mask which selects the shift level. */
+    xkb_mod_mask_t mods;
+};
+
+/**
+ * Find all the ways to produce a keysym with a keymap.
+ *
+ * This is the reverse of xkb_keymap_key_get_syms_by_level() and
+ * xkb_keymap_key_get_mods_for_level(): it returns every combination of
+ * key, layout, shift level and modifier mask for which the key produces
+ * exactly this keysym (levels with multiple keysyms are not considered).
+ *
+ * The positions are sorted from the most to the least preferred: first by
+ * layout, then by shift level, then by keycode; the modifier masks of a
+ * level are in the order returned by xkb_keymap_key_get_mods_for_level().
+ *
+ * The lookup is backed by an index which is built on the first call and
+ * then kept with the keymap, so subsequent calls are cheap.
+ *
+ * @param[in] keymap         The keymap.
+ * @param[in] keysym         The keysym to look for.
+ * @param[out] positions_out A buffer in which the positions should be
+ * stored. May be NULL if positions_size is 0.
+ * @param[in] positions_size The number of elements in the buffer pointed
+ * to by positions_out.
+ *
+ * @returns The total number of positions producing the keysym. If this is
+ * larger than positions_size, only the first positions_size positions have
+ * been stored in the buffer. Returns 0 if the keysym cannot be produced.
+ *
+ * @sa xkb_keymap_utf32_get_positions()
+ * @memberof xkb_keymap
+ * @since 1.6.0
+ */
+size_t
+xkb_keymap_keysym_get_positions(struct xkb_keymap *keymap,
+                                xkb_keysym_t keysym,
+                                struct xkb_key_position *positions_out,
+                                size_t positions_size);
+
+/**
+ * Find all the ways to produce a Unicode character with a keymap.
+ *
+ * This is like xkb_keymap_keysym_get_positions(), but considers all the
+ * keysyms whose xkb_keysym_to_utf32() is the given code point, e.g. both
+ * the @c a and @c U0061 keysyms for U+0061.
+ *
+ * @returns The total number of positions producing the character; see
+ * xkb_keymap_keysym_get_positions(). Returns 0 for the code point 0.
+ *
+ * @memberof xkb_keymap
+ * @since 1.6.0
+ */
+size_t
+xkb_keymap_utf32_get_positions(struct xkb_keymap *keymap,
+                               uint32_t ucs,
+                               struct xkb_key_position *positions_out,
+                               size_t positions_size);
+
 /**
  * Determine whether a key should repeat or not.
  *
@@ -27,6 +27,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
  * @file
@@ -391,6 +392,29 @@ rxkb_context_include_path_append(struct rxkb_context *ctx, const char *path);
 bool
 rxkb_context_include_path_append_default(struct rxkb_context *ctx);
 
+/**
+ * Use a directory to cache the parsed rules files.
+ *
+ * When a cache directory is set, the content of each rules file is stored
+ * in a binary cache file in this directory after it has been parsed, and
+ * later contexts load it from there instead of parsing the XML file again.
+ * A cache file is only used as long as its rules file is unchanged; it is
+ * rebuilt otherwise.
+ *
+ * The cache files are not validated beyond their structure, so the
+ * directory must not be writable by untrusted users.
+ *
+ * This function must be called before rxkb_context_parse() or
+ * rxkb_context_parse_default_ruleset().
+ *
+ * @returns true on success, or false if the directory does not exist or
+ * is not writable.
+ *
+ * @since 1.6.0
+ */
+bool
+rxkb_context_set_cache_dir(struct rxkb_context *ctx, const char *path);
+
 /**
  * Return the first model for this context. Use this to start iterating over
  * the models, followed by calls to rxkb_model_next(). Models are not sorted.
@@ -415,6 +439,17 @@ rxkb_model_first(struct rxkb_context *ctx);
 struct rxkb_model *
 rxkb_model_next(struct rxkb_model *m);
 
+/**
+ * Return the model with the given name, or NULL if there is none.
+ *
+ * The refcount of the returned model is not increased. Use rxkb_model_ref() if
+ * you need to keep this struct outside the immediate scope.
+ *
+ * @since 1.6.0
+ */
+struct rxkb_model *
+rxkb_model_find(struct rxkb_context *ctx, const char *name);
+
 /**
  * Increase the refcount of the argument by one.
  *
@@ -482,6 +517,55 @@ rxkb_layout_first(struct rxkb_context *ctx);
 struct rxkb_layout *
 rxkb_layout_next(struct rxkb_layout *l);
 
+/**
+ * Return the layout with the given name and variant, or NULL if there is
+ * none. Pass a NULL variant for the base layout.
+ *
+ * The refcount of the returned layout is not increased. Use rxkb_layout_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @since 1.6.0
+ */
+struct rxkb_layout *
+rxkb_layout_find(struct rxkb_context *ctx, const char *name,
+                 const char *variant);
+
+/**
+ * Get the layouts, including variants, for the given ISO 639-3 code (e.g.
+ * "eng"), in the order of the layout list. Variants without a language
+ * list of their own have the codes of their base layout.
+ *
+ * The refcount of the returned layouts is not increased. Use
+ * rxkb_layout_ref() if you need to keep them outside the immediate scope.
+ *
+ * @param ctx The context.
+ * @param code The ISO 639-3 code.
+ * @param layouts_out An array of at least @p layouts_size elements, filled
+ * with the first layouts. May be NULL if @p layouts_size is 0.
+ * @param layouts_size The size of @p layouts_out.
+ *
+ * @returns The number of layouts with this code. This may be larger than
+ * @p layouts_size, in which case only @p layouts_size layouts were written.
+ *
+ * @since 1.6.0
+ */
+size_t
+rxkb_context_find_layouts_by_iso639(struct rxkb_context *ctx, const char *code,
+                                    struct rxkb_layout **layouts_out,
+                                    size_t layouts_size);
+
+/**
+ * Get the layouts, including variants, for the given ISO 3166 code (e.g.
+ * "US"). This works like rxkb_context_find_layouts_by_iso639().
+ *
+ * @since 1.6.0
+ */
+size_t
+rxkb_context_find_layouts_by_iso3166(struct rxkb_context *ctx,
+                                     const char *code,
+                                     struct rxkb_layout **layouts_out,
+                                     size_t layouts_size);
+
 /**
  * Increase the refcount of the argument by one.
  *
@@ -566,6 +650,18 @@ rxkb_option_group_first(struct rxkb_context *ctx);
 struct rxkb_option_group *
 rxkb_option_group_next(struct rxkb_option_group *g);
 
+/**
+ * Return the option group with the given name, or NULL if there is none.
+ *
+ * The refcount of the returned option group is not increased. Use
+ * rxkb_option_group_ref() if you need to keep this struct outside the
+ * immediate scope.
+ *
+ * @since 1.6.0
+ */
+struct rxkb_option_group *
+rxkb_option_group_find(struct rxkb_context *ctx, const char *name);
+
 /**
  * Increase the refcount of the argument by one.
  *
@@ -637,6 +733,18 @@ rxkb_option_first(struct rxkb_option_group *group);
 struct rxkb_option *
 rxkb_option_next(struct rxkb_option *o);
 
+/**
+ * Return the option with the given name, or NULL if there is none. If
+ * several groups have an option with this name, this is the first one.
+ *
+ * The refcount of the returned option is not increased. Use rxkb_option_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @since 1.6.0
+ */
+struct rxkb_option *
+rxkb_option_find(struct rxkb_context *ctx, const char *name);
+
 /**
  * Increase the refcount of the argument by one.
  *
@@ -81,29 +81,32 @@
 #include "darray.h"
 #include "utils.h"
 
-/* FNV-1a (http://www.isthe.com/chongo/tech/comp/fnv/). */
-static inline uint32_t
-hash_buf(const char *string, size_t len)
-{
-    uint32_t hash = 2166136261u;
-    for (size_t i = 0; i < (len + 1) / 2; i++) {
-        hash ^= (uint8_t) string[i];
-        hash *= 0x01000193;
-        hash ^= (uint8_t) string[len - 1 - i];
-        hash *= 0x01000193;
-    }
-    return hash;
-}
-
 /*
  * The atom table is an insert-only linear probing hash table
  * mapping strings to atoms. Another array maps the atoms to
  * strings. The atom value is the position in the strings array.
+ *
+ * The strings themselves are stored back-to-back in large chunks,
+ * which are only freed with the table. Each entry keeps the length and
+ * hash of its string, so probing can skip most mismatches without
+ * touching the string, and growing the index needs no rehashing.
  */
+struct atom_string {
+    const char *string;
+    uint32_t len;
+    uint32_t hash;
+};
+
+#define ATOM_CHUNK_SIZE 4096
+
 struct atom_table {
     xkb_atom_t *index;
     size_t index_size;
-    darray(char *) strings;
+    darray(struct atom_string) strings;
+    darray(char *) chunks;
+    /* Free space left in the last chunk. */
+    char *chunk_pos;
+    size_t chunk_left;
 };
 
 struct atom_table *
@@ -114,7 +117,8 @@ atom_table_new(void)
         return NULL;
 
     darray_init(table->strings);
-    darray_append(table->strings, NULL);
+    darray_append(table->strings, (struct atom_string) { NULL, 0, 0 });
+    darray_init(table->chunks);
     table->index_size = 4;
     table->index = calloc(table->index_size, sizeof(*table->index));
 
@@ -127,9 +131,10 @@ atom_table_free(struct atom_table *table)
     if (!table)
         return;
 
-    char **string;
-    darray_foreach(string, table->strings)
-        free(*string);
+    char **chunk;
+    darray_foreach(chunk, table->chunks)
+        free(*chunk);
+    darray_free(table->chunks);
     darray_free(table->strings);
     free(table->index);
     free(table);
@@ -139,7 +144,32 @@ const char *
 atom_text(struct atom_table *table, xkb_atom_t atom)
 {
     assert(atom < darray_size(table->strings));
-    return darray_item(table->strings, atom);
+    return darray_item(table->strings, atom).string;
+}
+
+/* Copy a string into the chunk storage, NUL-terminated. */
+static const char *
+atom_store_string(struct atom_table *table, const char *string, size_t len)
+{
+    char *copy;
+
+    if (len + 1 > table->chunk_left) {
+        /* Oversized strings get a chunk of their own. */
+        size_t size = MAX(ATOM_CHUNK_SIZE, len + 1);
+        char *chunk = malloc(size);
+        if (!chunk)
+            return NULL;
+        darray_append(table->chunks, chunk);
+        table->chunk_pos = chunk;
+        table->chunk_left = size;
+    }
+
+    copy = table->chunk_pos;
+    memcpy(copy, string, len);
+    copy[len] = '\0';
+    table->chunk_pos += len + 1;
+    table->chunk_left -= len + 1;
+    return copy;
 }
 
 xkb_atom_t
@@ -150,8 +180,7 @@ atom_intern(struct atom_table *table, const char *string, size_t len, bool add)
         table->index = realloc(table->index, table->index_size * sizeof(*table->index));
         memset(table->index, 0, table->index_size * sizeof(*table->index));
         for (size_t j = 1; j < darray_size(table->strings); j++) {
-            const char *s = darray_item(table->strings, j);
-            uint32_t hash = hash_buf(s, strlen(s));
+            uint32_t hash = darray_item(table->strings, j).hash;
             for (size_t i = 0; i < table->index_size; i++) {
                 size_t index_pos = (hash + i) & (table->index_size - 1);
                 if (index_pos == 0)
@@ -176,7 +205,12 @@ atom_intern(struct atom_table *table, const char *string, size_t len, bool add)
         if (existing_atom == XKB_ATOM_NONE) {
             if (add) {
                 xkb_atom_t new_atom = darray_size(table->strings);
-                darray_append(table->strings, strndup(string, len));
+                const char *copy = atom_store_string(table, string, len);
+                if (!copy)
+                    return XKB_ATOM_NONE;
+                darray_append(table->strings, (struct atom_string) {
+                    copy, (uint32_t) len, hash
+                });
                 table->index[index_pos] = new_atom;
                 return new_atom;
             } else {
@@ -184,8 +218,10 @@ atom_intern(struct atom_table *table, const char *string, size_t len, bool add)
             }
         }
 
-        const char *existing_value = darray_item(table->strings, existing_atom);
-        if (strncmp(existing_value, string, len) == 0 && existing_value[len] == '\0')
+        const struct atom_string *existing =
+            &darray_item(table->strings, existing_atom);
+        if (existing->hash == hash && existing->len == len &&
+            memcmp(existing->string, string, len) == 0)
             return existing_atom;
     }
 
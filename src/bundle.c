@@ -0,0 +1,411 @@
+/*
+ * Copyright © 2023 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
+
+#include "xkbcommon/xkbcommon.h"
+#include "utils.h"
+#include "context.h"
+#include "bundle.h"
+
+/* Enough for the subdirectories of symbols/, without following loops. */
+#define BUNDLE_MAX_DEPTH 8
+
+static const char *bundle_dirs[] = {
+    "keycodes", "types", "compat", "symbols", "geometry", "keymap", "rules",
+};
+
+static const char *
+entry_path(const struct xkb_bundle *bundle, const struct bundle_entry *entry)
+{
+    return bundle->data + entry->path_offset;
+}
+
+/* Check everything the lookups rely on, so that they need no checks. */
+static bool
+bundle_check(struct xkb_bundle *bundle)
+{
+    struct bundle_header header;
+    const struct bundle_entry *entry, *prev = NULL;
+    const char *data = bundle->data;
+    size_t size = bundle->size;
+
+    if (size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, BUNDLE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != BUNDLE_VERSION ||
+        header.num_entries > (size - sizeof(header)) / sizeof(*entry))
+        return false;
+
+    bundle->entries = (const struct bundle_entry *) (data + sizeof(header));
+    bundle->num_entries = header.num_entries;
+
+    for (uint32_t i = 0; i < bundle->num_entries; i++) {
+        entry = &bundle->entries[i];
+
+        if (entry->path_offset >= size ||
+            entry->path_len >= size - entry->path_offset ||
+            memchr(data + entry->path_offset, '\0', entry->path_len) ||
+            data[entry->path_offset + entry->path_len] != '\0' ||
+            entry->data_offset > size ||
+            entry->data_len > size - entry->data_offset)
+            return false;
+
+        /* Sorted by path; the contents in the same order, one per entry. */
+        if (prev &&
+            (strcmp(entry_path(bundle, prev), entry_path(bundle, entry)) >= 0 ||
+             entry->data_offset <= prev->data_offset ||
+             entry->data_offset - prev->data_offset < prev->data_len))
+            return false;
+
+        prev = entry;
+    }
+
+    return true;
+}
+
+struct xkb_bundle *
+xkb_bundle_open(const char *path, int *err_out)
+{
+    struct xkb_bundle *bundle;
+    FILE *file;
+    bool ok;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        *err_out = errno;
+        return NULL;
+    }
+
+    bundle = calloc(1, sizeof(*bundle));
+    if (!bundle) {
+        *err_out = ENOMEM;
+        fclose(file);
+        return NULL;
+    }
+
+    ok = map_file(file, &bundle->data, &bundle->size);
+    if (!ok)
+        *err_out = errno;
+    fclose(file);
+    if (!ok) {
+        free(bundle);
+        return NULL;
+    }
+
+    if (!bundle_check(bundle)) {
+        *err_out = EINVAL;
+        xkb_bundle_free(bundle);
+        return NULL;
+    }
+
+    bundle->entry_data = calloc(bundle->num_entries + 1,
+                                sizeof(*bundle->entry_data));
+    if (!bundle->entry_data) {
+        *err_out = ENOMEM;
+        xkb_bundle_free(bundle);
+        return NULL;
+    }
+
+    return bundle;
+}
+
+void
+xkb_bundle_free(struct xkb_bundle *bundle)
+{
+    if (!bundle)
+        return;
+
+    if (bundle->entry_data) {
+        for (uint32_t i = 0; i < bundle->num_entries; i++)
+            if (bundle->entry_data[i].free_data)
+                bundle->entry_data[i].free_data(bundle->entry_data[i].data);
+        free(bundle->entry_data);
+    }
+    unmap_file(bundle->data, bundle->size);
+    free(bundle);
+}
+
+/* Compares @path to "<dir>/<name>", like strcmp(). */
+static int
+compare_path(const char *path, const char *dir, const char *name)
+{
+    size_t dir_len = strlen(dir);
+    int cmp = strncmp(path, dir, dir_len);
+
+    if (cmp != 0)
+        return cmp;
+    if (path[dir_len] != '/')
+        return (unsigned char) path[dir_len] - '/';
+    return strcmp(path + dir_len + 1, name);
+}
+
+/**
+ * Find the file <dir>/<name> in the bundle. The contents are valid for as
+ * long as the bundle is.
+ */
+bool
+xkb_bundle_find(const struct xkb_bundle *bundle, const char *dir,
+                const char *name, const char **string_out, size_t *size_out)
+{
+    uint32_t lo = 0, hi = bundle->num_entries;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const struct bundle_entry *entry = &bundle->entries[mid];
+        int cmp = compare_path(entry_path(bundle, entry), dir, name);
+
+        if (cmp == 0) {
+            *string_out = bundle->data + entry->data_offset;
+            *size_out = entry->data_len;
+            return true;
+        }
+        if (cmp > 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return false;
+}
+
+/**
+ * Get the data attached to the entry with the contents @string, as
+ * returned by xkb_bundle_find(), or NULL if the contents are not in this
+ * bundle.
+ */
+struct bundle_entry_data *
+xkb_bundle_entry_data(const struct xkb_bundle *bundle, const char *string)
+{
+    uint32_t lo = 0, hi = bundle->num_entries;
+    size_t offset;
+
+    if (string < bundle->data || string >= bundle->data + bundle->size)
+        return NULL;
+
+    offset = string - bundle->data;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t data_offset = bundle->entries[mid].data_offset;
+
+        if (data_offset == offset)
+            return &bundle->entry_data[mid];
+        if (data_offset > offset)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+struct bundle_file {
+    char *path;
+    char *string;
+    size_t size;
+};
+
+typedef darray(struct bundle_file) darray_bundle_file;
+
+static int
+cmp_bundle_files(const void *a, const void *b)
+{
+    return strcmp(((const struct bundle_file *) a)->path,
+                  ((const struct bundle_file *) b)->path);
+}
+
+static bool
+read_bundle_file(struct xkb_context *ctx, const char *path,
+                 const struct stat *stat_buf, struct bundle_file *out)
+{
+    FILE *file;
+    bool ok;
+
+    if ((uint64_t) stat_buf->st_size >= UINT32_MAX) {
+        log_err(ctx, "File too large for a bundle: %s\n", path);
+        return false;
+    }
+
+    /* Empty files cannot be mapped. */
+    if (stat_buf->st_size == 0)
+        return true;
+
+    file = fopen(path, "rb");
+    ok = file && map_file(file, &out->string, &out->size);
+    if (!ok)
+        log_err(ctx, "Couldn't read %s: %s\n", path, strerror(errno));
+    if (file)
+        fclose(file);
+    return ok;
+}
+
+/* Collect the files below <root>/<rel>, with their paths relative to root. */
+static bool
+collect_bundle_files(struct xkb_context *ctx, const char *root,
+                     const char *rel, unsigned int depth,
+                     darray_bundle_file *files)
+{
+#ifdef HAVE_DIRENT_H
+    struct dirent *ent;
+    struct stat stat_buf;
+    char *dir_path, *path;
+    bool ok = true;
+    DIR *dir;
+
+    dir_path = asprintf_safe("%s/%s", root, rel);
+    if (!dir_path)
+        return false;
+
+    dir = opendir(dir_path);
+    if (!dir) {
+        /* Not every root has all the directories. */
+        ok = depth == 0 && errno == ENOENT;
+        if (!ok)
+            log_err(ctx, "Couldn't open directory %s: %s\n",
+                    dir_path, strerror(errno));
+        free(dir_path);
+        return ok;
+    }
+
+    while (ok && (ent = readdir(dir))) {
+        struct bundle_file file = { NULL, NULL, 0 };
+
+        if (ent->d_name[0] == '.')
+            continue;
+
+        file.path = asprintf_safe("%s/%s", rel, ent->d_name);
+        path = asprintf_safe("%s/%s", dir_path, ent->d_name);
+        if (!file.path || !path) {
+            ok = false;
+        }
+        else if (stat(path, &stat_buf) != 0) {
+            log_err(ctx, "Couldn't stat %s: %s\n", path, strerror(errno));
+            ok = false;
+        }
+        else if (S_ISDIR(stat_buf.st_mode)) {
+            if (depth < BUNDLE_MAX_DEPTH)
+                ok = collect_bundle_files(ctx, root, file.path, depth + 1,
+                                          files);
+            else
+                log_err(ctx, "Directory nested too deep, ignored: %s\n",
+                        path);
+        }
+        else if (S_ISREG(stat_buf.st_mode)) {
+            ok = read_bundle_file(ctx, path, &stat_buf, &file);
+            if (ok) {
+                darray_append(*files, file);
+                file.path = NULL;
+            }
+        }
+
+        free(file.path);
+        free(path);
+    }
+
+    closedir(dir);
+    free(dir_path);
+    return ok;
+#else
+    log_err(ctx, "Reading directories is not supported on this platform\n");
+    return false;
+#endif
+}
+
+/**
+ * Write a bundle of the files in the include root @root, see
+ * xkb_context_include_path_append_bundle().
+ */
+bool
+xkb_bundle_write(struct xkb_context *ctx, const char *root, FILE *file)
+{
+    darray_bundle_file files = darray_new();
+    darray(struct bundle_entry) entries = darray_new();
+    struct bundle_file *f;
+    struct bundle_header header = {
+        .magic = BUNDLE_MAGIC,
+        .version = BUNDLE_VERSION,
+    };
+    uint64_t offset;
+    bool ok = true;
+
+    for (size_t i = 0; i < ARRAY_SIZE(bundle_dirs) && ok; i++)
+        ok = collect_bundle_files(ctx, root, bundle_dirs[i], 0, &files);
+    if (!ok)
+        goto out;
+
+    qsort(files.item, darray_size(files), sizeof(*files.item),
+          cmp_bundle_files);
+
+    /* The entries are followed by the paths, then by the contents. */
+    darray_resize0(entries, darray_size(files));
+    offset = sizeof(header) +
+             (uint64_t) darray_size(entries) * sizeof(struct bundle_entry);
+    for (unsigned i = 0; i < darray_size(files); i++) {
+        darray_item(entries, i).path_offset = offset;
+        darray_item(entries, i).path_len = strlen(darray_item(files, i).path);
+        offset += darray_item(entries, i).path_len + 1;
+    }
+    for (unsigned i = 0; i < darray_size(files); i++) {
+        darray_item(entries, i).data_offset = offset;
+        darray_item(entries, i).data_len = darray_item(files, i).size;
+        offset += darray_item(files, i).size + 1;
+    }
+    if (offset > UINT32_MAX) {
+        log_err(ctx, "The files in %s are too large for a bundle\n", root);
+        ok = false;
+        goto out;
+    }
+
+    header.num_entries = darray_size(entries);
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(entries.item, sizeof(*entries.item), darray_size(entries),
+                file) == darray_size(entries);
+    darray_foreach(f, files)
+        ok = ok && fwrite(f->path, 1, strlen(f->path) + 1, file) ==
+                   strlen(f->path) + 1;
+    /* The contents are NUL-terminated as well, which also keeps the
+     * contents of empty files apart. */
+    darray_foreach(f, files)
+        ok = ok && fwrite(f->string ? f->string : "", 1, f->size, file) ==
+                   f->size && fputc('\0', file) != EOF;
+
+out:
+    darray_foreach(f, files) {
+        free(f->path);
+        if (f->string)
+            unmap_file(f->string, f->size);
+    }
+    darray_free(files);
+    darray_free(entries);
+    return ok;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2023 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct xkb_context;
+
+/*
+ * An include bundle holds the files of an include root (the keycodes,
+ * types, compat, symbols, geometry, keymap and rules directories) in a
+ * single file, indexed by their path relative to the root. It can be put
+ * in the include path instead of the root, see
+ * xkb_context_include_path_append_bundle(), so that includes are resolved
+ * without looking up and reading files one by one.
+ *
+ * The file starts with a header, followed by the entries sorted by path,
+ * followed by the NUL-terminated paths and the contents of the files. All
+ * the numbers are in the byte order of the machine which wrote the bundle;
+ * a bundle from a machine with another byte order is rejected.
+ */
+#define BUNDLE_MAGIC "XKBBNDL\0"
+#define BUNDLE_VERSION 1
+
+struct bundle_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+};
+
+struct bundle_entry {
+    uint32_t path_offset;
+    uint32_t path_len;
+    uint32_t data_offset;
+    uint32_t data_len;
+};
+
+/* Data attached to an entry, see xkb_context_set_file_data(). */
+struct bundle_entry_data {
+    void *data;
+    void (*free_data)(void *data);
+};
+
+struct xkb_bundle {
+    char *data;
+    size_t size;
+    const struct bundle_entry *entries;
+    uint32_t num_entries;
+    struct bundle_entry_data *entry_data;
+};
+
+struct xkb_bundle *
+xkb_bundle_open(const char *path, int *err_out);
+
+void
+xkb_bundle_free(struct xkb_bundle *bundle);
+
+bool
+xkb_bundle_find(const struct xkb_bundle *bundle, const char *dir,
+                const char *name, const char **string_out, size_t *size_out);
+
+struct bundle_entry_data *
+xkb_bundle_entry_data(const struct xkb_bundle *bundle, const char *string);
+
+bool
+xkb_bundle_write(struct xkb_context *ctx, const char *root, FILE *file);
+
+#endif
@@ -140,8 +140,7 @@ skip_more_whitespace_and_comments:
     if (scanner_eof(s)) return TOK_END_OF_FILE;
 
     /* New token. */
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
     s->buf_pos = 0;
 
     /* LHS Keysym. */
@@ -247,8 +246,7 @@ lex_include_string(struct scanner *s, struct xkb_compose_table *table,
         if (scanner_next(s) == '\n')
             return TOK_END_OF_LINE;
 
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
     s->buf_pos = 0;
 
     if (!scanner_chr(s, '\"')) {
@@ -484,7 +482,7 @@ do_include(struct xkb_compose_table *table, struct scanner *s,
         return false;
     }
 
-    ok = map_file(file, &string, &size);
+    ok = xkb_context_map_file(table->ctx, file, &string, &size);
     if (!ok) {
         scanner_err(s, "failed to read included Compose file \"%s\": %s",
                     path, strerror(errno));
@@ -498,7 +496,7 @@ do_include(struct xkb_compose_table *table, struct scanner *s,
         goto err_unmap;
 
 err_unmap:
-    unmap_file(string, size);
+    xkb_context_unmap_file(table->ctx, string, size);
 err_file:
     fclose(file);
     return ok;
@@ -725,7 +723,7 @@ parse_file(struct xkb_compose_table *table, FILE *file, const char *file_name)
     char *string;
     size_t size;
 
-    ok = map_file(file, &string, &size);
+    ok = xkb_context_map_file(table->ctx, file, &string, &size);
     if (!ok) {
         log_err(table->ctx, "Couldn't read Compose file %s: %s\n",
                 file_name, strerror(errno));
@@ -733,6 +731,6 @@ parse_file(struct xkb_compose_table *table, FILE *file, const char *file_name)
     }
 
     ok = parse_string(table, string, size, file_name);
-    unmap_file(string, size);
+    xkb_context_unmap_file(table->ctx, string, size);
     return ok;
 }
@@ -73,7 +73,7 @@ resolve_name(struct xkb_context *ctx, const char *filename,
     if (!file)
         return false;
 
-    ok = map_file(file, &string, &string_size);
+    ok = xkb_context_map_file(ctx, file, &string, &string_size);
     fclose(file);
     if (!ok)
         return false;
@@ -133,7 +133,7 @@ resolve_name(struct xkb_context *ctx, const char *filename,
         }
     }
 
-    unmap_file(string, string_size);
+    xkb_context_unmap_file(ctx, string, string_size);
     return match;
 }
 
@@ -29,10 +29,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef HAVE_DIRENT_H
+#include <dirent.h>
+#endif
 
 #include "xkbcommon/xkbcommon.h"
 #include "utils.h"
 #include "context.h"
+#include "bundle.h"
 
 char *
 xkb_context_getenv(struct xkb_context *ctx, const char *name)
@@ -60,6 +66,530 @@ xkb_context_failed_include_path_get(struct xkb_context *ctx,
     return darray_item(ctx->failed_includes, idx);
 }
 
+/**
+ * Returns the bundle of the given entry in the context's include path, or
+ * NULL if it is a directory.
+ */
+struct xkb_bundle *
+xkb_context_include_path_get_bundle(struct xkb_context *ctx, unsigned int idx)
+{
+    if (idx >= darray_size(ctx->include_bundles))
+        return NULL;
+
+    return darray_item(ctx->include_bundles, idx);
+}
+
+static uint32_t *
+shared_keymap_slot(struct xkb_context *ctx, uint32_t hash,
+                   const char *key, size_t key_size)
+{
+    const uint32_t mask = darray_size(ctx->shared_keymap_slots) - 1;
+    uint32_t i = hash & mask;
+
+    while (darray_item(ctx->shared_keymap_slots, i) != 0) {
+        const struct xkb_shared_keymap *shared =
+            &darray_item(ctx->shared_keymaps,
+                         darray_item(ctx->shared_keymap_slots, i) - 1);
+
+        if (shared->hash == hash && shared->key_size == key_size &&
+            memcmp(shared->key, key, key_size) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+
+    return &darray_item(ctx->shared_keymap_slots, i);
+}
+
+/* Rebuild the hash table of the shared keymaps, keeping it half empty. */
+static void
+shared_keymaps_reindex(struct xkb_context *ctx)
+{
+    const unsigned int count = darray_size(ctx->shared_keymaps);
+    unsigned int size = 16;
+    uint32_t *slot;
+
+    while (2 * count > size)
+        size *= 2;
+
+    darray_resize0(ctx->shared_keymap_slots, 0);
+    darray_resize0(ctx->shared_keymap_slots, size);
+    for (unsigned int i = 0; i < count; i++) {
+        const struct xkb_shared_keymap *shared =
+            &darray_item(ctx->shared_keymaps, i);
+
+        slot = shared_keymap_slot(ctx, shared->hash,
+                                  shared->key, shared->key_size);
+        if (*slot == 0)
+            *slot = i + 1;
+    }
+}
+
+/**
+ * Find a keymap compiled from the input identified by the key, if sharing
+ * keymaps is enabled. No reference is taken.
+ */
+struct xkb_keymap *
+xkb_context_find_shared_keymap(struct xkb_context *ctx,
+                               const char *key, size_t key_size)
+{
+    uint32_t *slot;
+
+    if (!ctx->share_keymaps || darray_empty(ctx->shared_keymaps))
+        return NULL;
+
+    slot = shared_keymap_slot(ctx, hash_buf(key, key_size), key, key_size);
+    if (*slot == 0)
+        return NULL;
+
+    return darray_item(ctx->shared_keymaps, *slot - 1).keymap;
+}
+
+/**
+ * Share the keymap under the key, which the context takes ownership of.
+ */
+void
+xkb_context_add_shared_keymap(struct xkb_context *ctx, char *key,
+                              size_t key_size, struct xkb_keymap *keymap)
+{
+    struct xkb_shared_keymap shared = {
+        .hash = hash_buf(key, key_size),
+        .key_size = key_size,
+        .key = key,
+        .keymap = keymap,
+    };
+    uint32_t *slot;
+
+    if (!ctx->share_keymaps) {
+        free(key);
+        return;
+    }
+
+    darray_append(ctx->shared_keymaps, shared);
+    if (2 * darray_size(ctx->shared_keymaps) >
+        darray_size(ctx->shared_keymap_slots)) {
+        shared_keymaps_reindex(ctx);
+        return;
+    }
+
+    slot = shared_keymap_slot(ctx, shared.hash, key, key_size);
+    if (*slot == 0)
+        *slot = darray_size(ctx->shared_keymaps);
+}
+
+void
+xkb_context_remove_shared_keymap(struct xkb_context *ctx,
+                                 struct xkb_keymap *keymap)
+{
+    unsigned i = 0;
+    bool removed = false;
+
+    /* A keymap may be shared under several keys. */
+    while (i < darray_size(ctx->shared_keymaps)) {
+        struct xkb_shared_keymap *shared = &darray_item(ctx->shared_keymaps, i);
+
+        if (shared->keymap != keymap) {
+            i++;
+            continue;
+        }
+
+        free(shared->key);
+        *shared = darray_item(ctx->shared_keymaps,
+                              darray_size(ctx->shared_keymaps) - 1);
+        darray_resize(ctx->shared_keymaps,
+                      darray_size(ctx->shared_keymaps) - 1);
+        removed = true;
+    }
+
+    /* Removing from open addressing needs the moved entries rehashed. */
+    if (removed)
+        shared_keymaps_reindex(ctx);
+}
+
+/**
+ * Stop sharing the keymaps compiled so far, e.g. because the include path
+ * changed and compiling the same input may now give another keymap.
+ */
+void
+xkb_context_clear_shared_keymaps(struct xkb_context *ctx)
+{
+    struct xkb_shared_keymap *shared;
+
+    darray_foreach(shared, ctx->shared_keymaps)
+        free(shared->key);
+    darray_free(ctx->shared_keymaps);
+    darray_free(ctx->shared_keymap_slots);
+}
+
+static int
+cmp_include_dir_entries(const void *a, const void *b)
+{
+    return istrcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void
+include_dir_free_entries(struct xkb_include_dir *dir)
+{
+    char **entry;
+
+    darray_foreach(entry, dir->entries)
+        free(*entry);
+    darray_free(dir->entries);
+}
+
+/*
+ * (Re)read the snapshot of the directory. A directory modified in the
+ * second it is read may change again without its mtime changing, so its
+ * snapshot is only complete if it is older than that.
+ */
+static void
+include_dir_read(struct xkb_context *ctx, struct xkb_include_dir *dir)
+{
+    struct stat stat_buf;
+    time_t now = time(NULL);
+    char *path;
+
+    include_dir_free_entries(dir);
+    dir->exists = false;
+    dir->complete = false;
+    dir->mtime = 0;
+
+    path = asprintf_safe("%s/%s",
+                         xkb_context_include_path_get(ctx, dir->path_idx),
+                         dir->type_dir);
+    if (!path)
+        return;
+
+    /* Nothing can be opened below a missing directory. */
+    if (stat(path, &stat_buf) != 0) {
+        dir->complete = (errno == ENOENT || errno == ENOTDIR);
+        goto out;
+    }
+    if (!S_ISDIR(stat_buf.st_mode)) {
+        dir->complete = true;
+        goto out;
+    }
+
+    dir->exists = true;
+    dir->mtime = stat_buf.st_mtime;
+
+#ifdef HAVE_DIRENT_H
+    {
+        DIR *d = opendir(path);
+        struct dirent *ent;
+        bool ok = true;
+
+        if (!d)
+            goto out;
+
+        while (ok && (ent = readdir(d))) {
+            char *entry = strdup(ent->d_name);
+            if (entry)
+                darray_append(dir->entries, entry);
+            else
+                ok = false;
+        }
+        closedir(d);
+
+        qsort(dir->entries.item, darray_size(dir->entries),
+              sizeof(*dir->entries.item), cmp_include_dir_entries);
+        dir->complete = ok && stat_buf.st_mtime < now;
+    }
+#else
+    (void) now;
+#endif
+
+out:
+    free(path);
+}
+
+/*
+ * Whether the snapshot is still valid, i.e. the directory has not changed
+ * since it was read.
+ */
+static bool
+include_dir_is_current(struct xkb_context *ctx, struct xkb_include_dir *dir)
+{
+    struct stat stat_buf;
+    bool exists;
+    char *path;
+
+    if (!dir->complete)
+        return false;
+
+    path = asprintf_safe("%s/%s",
+                         xkb_context_include_path_get(ctx, dir->path_idx),
+                         dir->type_dir);
+    if (!path)
+        return false;
+
+    exists = stat(path, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode);
+    free(path);
+
+    if (exists != dir->exists)
+        return false;
+    return !exists || stat_buf.st_mtime == dir->mtime;
+}
+
+static bool
+include_dir_has_entry(struct xkb_include_dir *dir, const char *name,
+                      size_t len)
+{
+    size_t lo = 0, hi = darray_size(dir->entries);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *entry = darray_item(dir->entries, mid);
+        int cmp = istrncmp(name, entry, len);
+
+        if (cmp == 0 && entry[len] != '\0')
+            cmp = -1;
+        if (cmp == 0)
+            return true;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return false;
+}
+
+/**
+ * Whether the file @name may be found in the directory @type_dir of the
+ * include path entry @path_idx, i.e. whether it is worth trying to open it.
+ * @type_dir must outlive the context, e.g. be a string literal.
+ * This only says no if the snapshot of the directory says so, to avoid
+ * failing syscalls for each include path an include is looked up in.
+ *
+ * The snapshots are checked against the directory mtime once per include
+ * generation, see xkb_context_revalidate_include_dirs(). Names are
+ * compared ignoring case, in case the file system does.
+ */
+bool
+xkb_context_include_dir_may_contain(struct xkb_context *ctx,
+                                    unsigned int path_idx,
+                                    const char *type_dir, const char *name)
+{
+    struct xkb_include_dir *dir;
+    size_t len = strcspn(name, "/");
+
+    if (len == 0)
+        return true;
+
+    darray_foreach(dir, ctx->include_dirs)
+        if (dir->path_idx == path_idx && streq(dir->type_dir, type_dir))
+            break;
+
+    if (dir == ctx->include_dirs.item + darray_size(ctx->include_dirs)) {
+        struct xkb_include_dir new = {
+            .path_idx = path_idx,
+            .type_dir = type_dir,
+            .generation = ctx->include_generation,
+        };
+
+        darray_append(ctx->include_dirs, new);
+        dir = &darray_item(ctx->include_dirs,
+                           darray_size(ctx->include_dirs) - 1);
+        include_dir_read(ctx, dir);
+    }
+    else if (dir->generation != ctx->include_generation) {
+        dir->generation = ctx->include_generation;
+        if (!include_dir_is_current(ctx, dir))
+            include_dir_read(ctx, dir);
+    }
+
+    if (!dir->complete)
+        return true;
+
+    return dir->exists && include_dir_has_entry(dir, name, len);
+}
+
+/**
+ * Start a new include generation: the snapshots of the include directories
+ * are checked again the next time they are used. This is done once per
+ * compilation rather than on every lookup.
+ */
+void
+xkb_context_revalidate_include_dirs(struct xkb_context *ctx)
+{
+    ctx->include_generation++;
+}
+
+void
+xkb_context_clear_include_dirs(struct xkb_context *ctx)
+{
+    struct xkb_include_dir *dir;
+
+    darray_foreach(dir, ctx->include_dirs)
+        include_dir_free_entries(dir);
+    darray_free(ctx->include_dirs);
+}
+
+/* Drop the least recently used files not in use until the cache fits. */
+void
+xkb_context_trim_file_cache(struct xkb_context *ctx)
+{
+    while (ctx->file_cache_size > ctx->file_cache_limit) {
+        struct xkb_cached_file *cached, *lru = NULL;
+
+        darray_foreach(cached, ctx->file_cache)
+            if (cached->refcnt == 0 &&
+                (!lru || cached->last_used < lru->last_used))
+                lru = cached;
+        if (!lru)
+            break;
+
+        if (lru->free_data)
+            lru->free_data(lru->data);
+        unmap_file(lru->string, lru->size);
+        ctx->file_cache_size -= lru->size;
+        *lru = darray_item(ctx->file_cache,
+                           darray_size(ctx->file_cache) - 1);
+        darray_resize(ctx->file_cache, darray_size(ctx->file_cache) - 1);
+    }
+}
+
+/**
+ * Like map_file(), but the contents are kept in the context's file cache,
+ * so that opening the same file again does not need to read it again. The
+ * cached contents are used if the file has the same inode, mtime, ctime
+ * and size; the ctime cannot be set back, so a file replaced while keeping
+ * the rest is not mistaken for the cached one. A file modified in the
+ * second it is read is not cached, as it could change again without its
+ * mtime changing.
+ *
+ * The string must be released with xkb_context_unmap_file().
+ */
+bool
+xkb_context_map_file(struct xkb_context *ctx, FILE *file,
+                     char **string_out, size_t *size_out)
+{
+    struct xkb_cached_file *cached, new;
+    struct stat stat_buf;
+    int fd = fileno(file);
+
+    if (ctx->file_cache_limit == 0 || fd < 0 ||
+        fstat(fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode))
+        return map_file(file, string_out, size_out);
+
+    darray_foreach(cached, ctx->file_cache) {
+        if (cached->dev == stat_buf.st_dev &&
+            cached->ino == stat_buf.st_ino &&
+            cached->mtime == stat_buf.st_mtime &&
+            cached->ctime == stat_buf.st_ctime &&
+            cached->size == (size_t) stat_buf.st_size) {
+            cached->refcnt++;
+            cached->last_used = ++ctx->file_cache_clock;
+            *string_out = cached->string;
+            *size_out = cached->size;
+            return true;
+        }
+    }
+
+    if (!map_file(file, string_out, size_out))
+        return false;
+
+    if (*size_out != (size_t) stat_buf.st_size ||
+        *size_out > ctx->file_cache_limit ||
+        stat_buf.st_mtime >= time(NULL))
+        return true;
+
+    new = (struct xkb_cached_file) {
+        .dev = stat_buf.st_dev,
+        .ino = stat_buf.st_ino,
+        .mtime = stat_buf.st_mtime,
+        .ctime = stat_buf.st_ctime,
+        .size = *size_out,
+        .string = *string_out,
+        .refcnt = 1,
+        .last_used = ++ctx->file_cache_clock,
+    };
+    darray_append(ctx->file_cache, new);
+    ctx->file_cache_size += new.size;
+    xkb_context_trim_file_cache(ctx);
+    return true;
+}
+
+void
+xkb_context_unmap_file(struct xkb_context *ctx, char *string, size_t size)
+{
+    struct xkb_cached_file *cached;
+
+    darray_foreach(cached, ctx->file_cache) {
+        if (cached->string == string) {
+            cached->refcnt--;
+            xkb_context_trim_file_cache(ctx);
+            return;
+        }
+    }
+
+    unmap_file(string, size);
+}
+
+static struct bundle_entry_data *
+bundle_entry_data(struct xkb_context *ctx, const char *string)
+{
+    struct xkb_bundle **bundle;
+    struct bundle_entry_data *entry_data;
+
+    darray_foreach(bundle, ctx->include_bundles)
+        if (*bundle && (entry_data = xkb_bundle_entry_data(*bundle, string)))
+            return entry_data;
+
+    return NULL;
+}
+
+/**
+ * Get the data attached to the contents of a file with
+ * xkb_context_set_file_data(), or NULL.
+ */
+void *
+xkb_context_get_file_data(struct xkb_context *ctx, const char *string)
+{
+    struct xkb_cached_file *cached;
+    struct bundle_entry_data *entry_data;
+
+    darray_foreach(cached, ctx->file_cache)
+        if (cached->string == string)
+            return cached->data;
+
+    entry_data = bundle_entry_data(ctx, string);
+    return entry_data ? entry_data->data : NULL;
+}
+
+/**
+ * Attach data derived from the contents of a file, as returned by
+ * xkb_context_map_file() or found in an include bundle, to the cached file
+ * or bundle entry, so that it can be reused for as long as the file is. The
+ * context takes ownership of the data on success; it fails if the file is
+ * not cached or already has data.
+ */
+bool
+xkb_context_set_file_data(struct xkb_context *ctx, const char *string,
+                          void *data, void (*free_data)(void *data))
+{
+    struct xkb_cached_file *cached;
+    struct bundle_entry_data *entry_data;
+
+    darray_foreach(cached, ctx->file_cache) {
+        if (cached->string == string) {
+            if (cached->data)
+                return false;
+            cached->data = data;
+            cached->free_data = free_data;
+            return true;
+        }
+    }
+
+    entry_data = bundle_entry_data(ctx, string);
+    if (!entry_data || entry_data->data)
+        return false;
+
+    entry_data->data = data;
+    entry_data->free_data = free_data;
+    return true;
+}
+
 xkb_atom_t
 xkb_atom_lookup(struct xkb_context *ctx, const char *string)
 {
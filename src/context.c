@@ -33,6 +33,9 @@
 #include "xkbcommon/xkbcommon.h"
 #include "utils.h"
 #include "context.h"
+#include "bundle.h"
+
+#define DEFAULT_FILE_CACHE_LIMIT (2 * 1024 * 1024)
 
 
 /**
@@ -65,6 +68,8 @@ xkb_context_include_path_append(struct xkb_context *ctx, const char *path)
     }
 
     darray_append(ctx->includes, tmp);
+    darray_append(ctx->include_bundles, NULL);
+    xkb_context_clear_shared_keymaps(ctx);
     log_dbg(ctx, "Include path added: %s\n", tmp);
 
     return 1;
@@ -75,6 +80,38 @@ err:
     return 0;
 }
 
+/**
+ * Append an include bundle to the context's include path.
+ */
+XKB_EXPORT int
+xkb_context_include_path_append_bundle(struct xkb_context *ctx,
+                                       const char *path)
+{
+    struct xkb_bundle *bundle;
+    int err = ENOMEM;
+    char *tmp;
+
+    tmp = strdup(path);
+    if (!tmp)
+        goto err;
+
+    bundle = xkb_bundle_open(path, &err);
+    if (!bundle)
+        goto err;
+
+    darray_append(ctx->includes, tmp);
+    darray_append(ctx->include_bundles, bundle);
+    xkb_context_clear_shared_keymaps(ctx);
+    log_dbg(ctx, "Include bundle added: %s\n", tmp);
+
+    return 1;
+
+err:
+    darray_append(ctx->failed_includes, tmp);
+    log_dbg(ctx, "Include bundle failed: %s (%s)\n", tmp, strerror(err));
+    return 0;
+}
+
 const char *
 xkb_context_include_path_get_extra_path(struct xkb_context *ctx)
 {
@@ -95,7 +132,7 @@ xkb_context_include_path_get_system_path(struct xkb_context *ctx)
 XKB_EXPORT int
 xkb_context_include_path_append_default(struct xkb_context *ctx)
 {
-    const char *home, *xdg, *root, *extra;
+    const char *home, *xdg, *root, *extra, *bundle;
     char *user_path;
     int ret = 0;
 
@@ -127,6 +164,9 @@ xkb_context_include_path_append_default(struct xkb_context *ctx)
 
     extra = xkb_context_include_path_get_extra_path(ctx);
     ret |= xkb_context_include_path_append(ctx, extra);
+    bundle = xkb_context_getenv(ctx, "XKB_CONFIG_BUNDLE");
+    if (bundle)
+        ret |= xkb_context_include_path_append_bundle(ctx, bundle);
     root = xkb_context_include_path_get_system_path(ctx);
     ret |= xkb_context_include_path_append(ctx, root);
 
@@ -140,14 +180,22 @@ XKB_EXPORT void
 xkb_context_include_path_clear(struct xkb_context *ctx)
 {
     char **path;
+    struct xkb_bundle **bundle;
 
     darray_foreach(path, ctx->includes)
         free(*path);
     darray_free(ctx->includes);
 
+    darray_foreach(bundle, ctx->include_bundles)
+        xkb_bundle_free(*bundle);
+    darray_free(ctx->include_bundles);
+
     darray_foreach(path, ctx->failed_includes)
         free(*path);
     darray_free(ctx->failed_includes);
+
+    xkb_context_clear_include_dirs(ctx);
+    xkb_context_clear_shared_keymaps(ctx);
 }
 
 /**
@@ -204,6 +252,8 @@ xkb_context_unref(struct xkb_context *ctx)
 
     free(ctx->x11_atom_cache);
     xkb_context_include_path_clear(ctx);
+    xkb_context_set_file_cache_limit(ctx, 0);
+    darray_free(ctx->file_cache);
     atom_table_free(ctx->atom_table);
     free(ctx);
 }
@@ -292,6 +342,8 @@ xkb_context_new(enum xkb_context_flags flags)
     ctx->log_verbosity = 0;
     ctx->use_environment_names = !(flags & XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
     ctx->use_secure_getenv = !(flags & XKB_CONTEXT_NO_SECURE_GETENV);
+    ctx->share_keymaps = !!(flags & XKB_CONTEXT_SHARE_KEYMAPS);
+    ctx->file_cache_limit = DEFAULT_FILE_CACHE_LIMIT;
 
     /* Environment overwrites defaults. */
     env = xkb_context_getenv(ctx, "XKB_LOG_LEVEL");
@@ -354,6 +406,19 @@ xkb_context_set_log_verbosity(struct xkb_context *ctx, int verbosity)
     ctx->log_verbosity = verbosity;
 }
 
+XKB_EXPORT size_t
+xkb_context_get_file_cache_limit(struct xkb_context *ctx)
+{
+    return ctx->file_cache_limit;
+}
+
+XKB_EXPORT void
+xkb_context_set_file_cache_limit(struct xkb_context *ctx, size_t limit)
+{
+    ctx->file_cache_limit = limit;
+    xkb_context_trim_file_cache(ctx);
+}
+
 XKB_EXPORT void *
 xkb_context_get_user_data(struct xkb_context *ctx)
 {
@@ -26,8 +26,59 @@
 #ifndef CONTEXT_H
 #define CONTEXT_H
 
+#include <sys/types.h>
+#include <time.h>
+
 #include "atom.h"
 
+struct xkb_bundle;
+
+/*
+ * A keymap shared through the context, see XKB_CONTEXT_SHARE_KEYMAPS. The
+ * key identifies the input the keymap was compiled from.
+ */
+struct xkb_shared_keymap {
+    uint32_t hash;
+    size_t key_size;
+    char *key;
+    struct xkb_keymap *keymap;
+};
+
+/*
+ * A snapshot of the entries of one directory of the include path, e.g.
+ * <include path>/symbols, see xkb_context_include_dir_may_contain().
+ */
+struct xkb_include_dir {
+    unsigned int path_idx;
+    const char *type_dir;
+    /* The include generation the snapshot was last checked in. */
+    unsigned int generation;
+    time_t mtime;
+    bool exists;
+    /* False if the snapshot may miss entries, e.g. it could not be read. */
+    bool complete;
+    /* Sorted. */
+    darray(char *) entries;
+};
+
+/*
+ * The contents of a file read through the context, see
+ * xkb_context_map_file().
+ */
+struct xkb_cached_file {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    time_t ctime;
+    size_t size;
+    char *string;
+    unsigned int refcnt;
+    unsigned int last_used;
+    /* Derived from the contents, see xkb_context_set_file_data(). */
+    void *data;
+    void (*free_data)(void *data);
+};
+
 struct xkb_context {
     int refcnt;
 
@@ -42,18 +93,42 @@ struct xkb_context {
 
     darray(char *) includes;
     darray(char *) failed_includes;
+    /* For each include path entry, its bundle or NULL for a directory. */
+    darray(struct xkb_bundle *) include_bundles;
 
     struct atom_table *atom_table;
 
     /* Used and allocated by xkbcommon-x11, free()d with the context. */
     void *x11_atom_cache;
 
+    /*
+     * The keymaps alive which were compiled in this context, if sharing
+     * them is enabled. They do not hold a reference: xkb_keymap_unref()
+     * removes them.
+     */
+    darray(struct xkb_shared_keymap) shared_keymaps;
+    /*
+     * Open addressing hash table of the shared keymaps by key hash: the
+     * slots hold an index in shared_keymaps plus one, or 0 if empty.
+     */
+    darray(uint32_t) shared_keymap_slots;
+
+    darray(struct xkb_include_dir) include_dirs;
+    unsigned int include_generation;
+
+    /* Bounded by file_cache_limit, except for the files in use. */
+    darray(struct xkb_cached_file) file_cache;
+    size_t file_cache_size;
+    size_t file_cache_limit;
+    unsigned int file_cache_clock;
+
     /* Buffer for the *Text() functions. */
     char text_buffer[2048];
     size_t text_next;
 
     unsigned int use_environment_names : 1;
     unsigned int use_secure_getenv : 1;
+    unsigned int share_keymaps : 1;
 };
 
 char *
@@ -69,9 +144,55 @@ xkb_context_failed_include_path_get(struct xkb_context *ctx,
 const char *
 xkb_context_include_path_get_extra_path(struct xkb_context *ctx);
 
+struct xkb_keymap *
+xkb_context_find_shared_keymap(struct xkb_context *ctx,
+                               const char *key, size_t key_size);
+
+void
+xkb_context_add_shared_keymap(struct xkb_context *ctx, char *key,
+                              size_t key_size, struct xkb_keymap *keymap);
+
+void
+xkb_context_remove_shared_keymap(struct xkb_context *ctx,
+                                 struct xkb_keymap *keymap);
+
+void
+xkb_context_clear_shared_keymaps(struct xkb_context *ctx);
+
 const char *
 xkb_context_include_path_get_system_path(struct xkb_context *ctx);
 
+struct xkb_bundle *
+xkb_context_include_path_get_bundle(struct xkb_context *ctx, unsigned int idx);
+
+bool
+xkb_context_include_dir_may_contain(struct xkb_context *ctx,
+                                    unsigned int path_idx,
+                                    const char *type_dir, const char *name);
+
+void
+xkb_context_revalidate_include_dirs(struct xkb_context *ctx);
+
+void
+xkb_context_clear_include_dirs(struct xkb_context *ctx);
+
+bool
+xkb_context_map_file(struct xkb_context *ctx, FILE *file,
+                     char **string_out, size_t *size_out);
+
+void
+xkb_context_unmap_file(struct xkb_context *ctx, char *string, size_t size);
+
+void
+xkb_context_trim_file_cache(struct xkb_context *ctx);
+
+void *
+xkb_context_get_file_data(struct xkb_context *ctx, const char *string);
+
+bool
+xkb_context_set_file_data(struct xkb_context *ctx, const char *string,
+                          void *data, void (*free_data)(void *data));
+
 /*
  * Returns XKB_ATOM_NONE if @string was not previously interned,
  * otherwise returns the atom.
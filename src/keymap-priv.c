@@ -74,32 +74,301 @@ xkb_keymap_new(struct xkb_context *ctx,
     return keymap;
 }
 
-struct xkb_key *
-XkbKeyByName(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases)
+static inline unsigned int
+key_name_hash(xkb_atom_t name)
+{
+    /* Atoms are small consecutive integers; spread them a bit. */
+    return name * 2654435761u;
+}
+
+static struct xkb_key_name_entry *
+key_name_index_slot(const struct xkb_keymap *keymap, xkb_atom_t name)
+{
+    const unsigned int mask = keymap->key_names_size - 1;
+    unsigned int i = key_name_hash(name) & mask;
+
+    while (keymap->key_names[i].name != XKB_ATOM_NONE &&
+           keymap->key_names[i].name != name)
+        i = (i + 1) & mask;
+
+    return &keymap->key_names[i];
+}
+
+static const struct xkb_key_name_entry *
+key_name_index_find(const struct xkb_keymap *keymap, xkb_atom_t name)
+{
+    const struct xkb_key_name_entry *entry;
+
+    if (keymap->key_names_size == 0 || name == XKB_ATOM_NONE)
+        return NULL;
+
+    entry = key_name_index_slot(keymap, name);
+    return entry->name == XKB_ATOM_NONE ? NULL : entry;
+}
+
+/**
+ * (Re)build the index of the key names and aliases of the keymap, which
+ * backs XkbKeyByName(), XkbResolveKeyAlias() and xkb_keymap_key_by_name().
+ * It must be called again whenever the keys or the aliases change.
+ *
+ * As with a linear search, the first key or alias with a given name wins.
+ */
+bool
+XkbBuildKeyNameIndex(struct xkb_keymap *keymap)
+{
+    const struct xkb_key *key;
+    unsigned int count = keymap->num_key_aliases, size = 8;
+    struct xkb_key_name_entry *entry;
+
+    if (keymap->keys)
+        count += keymap->max_key_code + 1 - keymap->min_key_code;
+    /* Keep the load factor under 1/2. */
+    while (size < 2 * count)
+        size *= 2;
+
+    free(keymap->key_names);
+    keymap->key_names = calloc(size, sizeof(*keymap->key_names));
+    if (!keymap->key_names) {
+        keymap->key_names_size = 0;
+        return false;
+    }
+    keymap->key_names_size = size;
+
+    if (keymap->keys) {
+        xkb_keys_foreach(key, keymap) {
+            if (key->name == XKB_ATOM_NONE)
+                continue;
+
+            entry = key_name_index_slot(keymap, key->name);
+            if (entry->name == XKB_ATOM_NONE) {
+                entry->name = key->name;
+                entry->keycode = key->keycode;
+                entry->real = XKB_ATOM_NONE;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < keymap->num_key_aliases; i++) {
+        const struct xkb_key_alias *alias = &keymap->key_aliases[i];
+
+        if (alias->alias == XKB_ATOM_NONE)
+            continue;
+
+        entry = key_name_index_slot(keymap, alias->alias);
+        if (entry->name == XKB_ATOM_NONE) {
+            entry->name = alias->alias;
+            entry->keycode = XKB_KEYCODE_INVALID;
+            entry->real = alias->real;
+        }
+        else if (entry->real == XKB_ATOM_NONE) {
+            entry->real = alias->real;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Move the groups, levels and multi-keysym arrays of all the keys, which
+ * were allocated separately while compiling, into three contiguous arrays
+ * owned by the keymap. The keys are laid out in keycode order, so the data
+ * of a key is adjacent in memory; runtime lookups then touch fewer cache
+ * lines and destroying the keymap takes a handful of frees.
+ *
+ * This must be called once the keys are final. If an allocation fails,
+ * the keymap is left as it was, which is still valid.
+ */
+void
+XkbPackKeyLevels(struct xkb_keymap *keymap)
 {
     struct xkb_key *key;
+    size_t num_groups = 0, num_levels = 0, num_syms = 0;
+    struct xkb_group *groups = NULL;
+    struct xkb_level *levels = NULL;
+    xkb_keysym_t *syms = NULL;
+
+    if (!keymap->keys || keymap->packed_groups)
+        return;
+
+    xkb_keys_foreach(key, keymap) {
+        if (!key->groups)
+            continue;
+
+        num_groups += key->num_groups;
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+            const struct xkb_group *group = &key->groups[i];
 
-    xkb_keys_foreach(key, keymap)
-        if (key->name == name)
-            return key;
+            if (!group->levels)
+                continue;
 
-    if (use_aliases) {
-        xkb_atom_t new_name = XkbResolveKeyAlias(keymap, name);
-        if (new_name != XKB_ATOM_NONE)
-            return XkbKeyByName(keymap, new_name, false);
+            num_levels += XkbKeyNumLevels(key, i);
+            for (xkb_level_index_t j = 0; j < XkbKeyNumLevels(key, i); j++)
+                if (group->levels[j].num_syms > 1)
+                    num_syms += group->levels[j].num_syms;
+        }
     }
 
+    if (num_groups == 0)
+        return;
+
+    groups = calloc(num_groups, sizeof(*groups));
+    if (num_levels > 0)
+        levels = calloc(num_levels, sizeof(*levels));
+    if (num_syms > 0)
+        syms = calloc(num_syms, sizeof(*syms));
+    if (!groups || (num_levels > 0 && !levels) || (num_syms > 0 && !syms)) {
+        free(groups);
+        free(levels);
+        free(syms);
+        return;
+    }
+
+    keymap->packed_groups = groups;
+    keymap->packed_levels = levels;
+    keymap->packed_syms = syms;
+
+    xkb_keys_foreach(key, keymap) {
+        if (!key->groups)
+            continue;
+
+        memcpy(groups, key->groups, key->num_groups * sizeof(*groups));
+        free(key->groups);
+        key->groups = groups;
+        groups += key->num_groups;
+
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+            struct xkb_group *group = &key->groups[i];
+            const xkb_level_index_t count = XkbKeyNumLevels(key, i);
+
+            if (!group->levels)
+                continue;
+
+            memcpy(levels, group->levels, count * sizeof(*levels));
+            free(group->levels);
+            group->levels = levels;
+            levels += count;
+
+            for (xkb_level_index_t j = 0; j < count; j++) {
+                struct xkb_level *level = &group->levels[j];
+
+                if (level->num_syms <= 1)
+                    continue;
+
+                memcpy(syms, level->u.syms, level->num_syms * sizeof(*syms));
+                free(level->u.syms);
+                level->u.syms = syms;
+                syms += level->num_syms;
+            }
+        }
+    }
+}
+
+/**
+ * Copy into an empty keymap everything a keymap holds after compiling its
+ * keycodes, types and compat sections, so that a symbols section can then
+ * be compiled on top of it. The keys of @base must not have groups yet.
+ */
+bool
+XkbCopyKeymapBase(struct xkb_keymap *keymap, const struct xkb_keymap *base)
+{
+    keymap->enabled_ctrls = base->enabled_ctrls;
+    keymap->mods = base->mods;
+    memcpy(keymap->leds, base->leds, sizeof(keymap->leds));
+    keymap->num_leds = base->num_leds;
+
+    if (base->keys) {
+        keymap->keys = memdup(base->keys, base->max_key_code + 1,
+                              sizeof(*base->keys));
+        if (!keymap->keys)
+            return false;
+        keymap->min_key_code = base->min_key_code;
+        keymap->max_key_code = base->max_key_code;
+    }
+
+    if (base->num_key_aliases > 0) {
+        keymap->key_aliases = memdup(base->key_aliases,
+                                     base->num_key_aliases,
+                                     sizeof(*base->key_aliases));
+        if (!keymap->key_aliases)
+            return false;
+        keymap->num_key_aliases = base->num_key_aliases;
+    }
+
+    if (base->key_names_size > 0) {
+        keymap->key_names = memdup(base->key_names, base->key_names_size,
+                                   sizeof(*base->key_names));
+        if (!keymap->key_names)
+            return false;
+        keymap->key_names_size = base->key_names_size;
+    }
+
+    if (base->num_types > 0) {
+        keymap->types = calloc(base->num_types, sizeof(*keymap->types));
+        if (!keymap->types)
+            return false;
+        keymap->num_types = base->num_types;
+
+        for (unsigned i = 0; i < base->num_types; i++) {
+            const struct xkb_key_type *from = &base->types[i];
+            struct xkb_key_type *type = &keymap->types[i];
+
+            *type = *from;
+            type->entries = NULL;
+            type->level_names = NULL;
+            if (from->num_entries > 0) {
+                type->entries = memdup(from->entries, from->num_entries,
+                                       sizeof(*from->entries));
+                if (!type->entries)
+                    return false;
+            }
+            if (from->num_level_names > 0) {
+                type->level_names = memdup(from->level_names,
+                                           from->num_level_names,
+                                           sizeof(*from->level_names));
+                if (!type->level_names)
+                    return false;
+            }
+        }
+    }
+
+    if (base->num_sym_interprets > 0) {
+        keymap->sym_interprets = memdup(base->sym_interprets,
+                                        base->num_sym_interprets,
+                                        sizeof(*base->sym_interprets));
+        if (!keymap->sym_interprets)
+            return false;
+        keymap->num_sym_interprets = base->num_sym_interprets;
+    }
+
+    keymap->keycodes_section_name = strdup_safe(base->keycodes_section_name);
+    keymap->types_section_name = strdup_safe(base->types_section_name);
+    keymap->compat_section_name = strdup_safe(base->compat_section_name);
+    return true;
+}
+
+struct xkb_key *
+XkbKeyByName(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases)
+{
+    const struct xkb_key_name_entry *entry = key_name_index_find(keymap, name);
+
+    if (!entry)
+        return NULL;
+
+    if (entry->keycode != XKB_KEYCODE_INVALID)
+        return &keymap->keys[entry->keycode];
+
+    if (use_aliases && entry->real != XKB_ATOM_NONE)
+        return XkbKeyByName(keymap, entry->real, false);
+
     return NULL;
 }
 
 xkb_atom_t
 XkbResolveKeyAlias(const struct xkb_keymap *keymap, xkb_atom_t name)
 {
-    for (unsigned i = 0; i < keymap->num_key_aliases; i++)
-        if (keymap->key_aliases[i].alias == name)
-            return keymap->key_aliases[i].real;
+    const struct xkb_key_name_entry *entry = key_name_index_find(keymap, name);
 
-    return XKB_ATOM_NONE;
+    return entry ? entry->real : XKB_ATOM_NONE;
 }
 
 void
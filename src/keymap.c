@@ -52,6 +52,12 @@
 
 #include "config.h"
 
+#ifdef HAVE_MEMFD_CREATE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 #include "keymap.h"
 #include "text.h"
 
@@ -68,7 +74,16 @@ xkb_keymap_unref(struct xkb_keymap *keymap)
     if (!keymap || --keymap->refcnt > 0)
         return;
 
-    if (keymap->keys) {
+    if (keymap->ctx->share_keymaps)
+        xkb_context_remove_shared_keymap(keymap->ctx, keymap);
+
+    if (keymap->packed_groups) {
+        free(keymap->packed_groups);
+        free(keymap->packed_levels);
+        free(keymap->packed_syms);
+        free(keymap->keys);
+    }
+    else if (keymap->keys) {
         struct xkb_key *key;
         xkb_keys_foreach(key, keymap) {
             if (key->groups) {
@@ -94,11 +109,20 @@ xkb_keymap_unref(struct xkb_keymap *keymap)
     }
     free(keymap->sym_interprets);
     free(keymap->key_aliases);
+    free(keymap->key_names);
+    free(keymap->keysym_positions);
+    free(keymap->codepoint_positions);
     free(keymap->group_names);
     free(keymap->keycodes_section_name);
     free(keymap->symbols_section_name);
     free(keymap->types_section_name);
     free(keymap->compat_section_name);
+    free(keymap->cached_string);
+    free(keymap->components.keycodes);
+    free(keymap->components.types);
+    free(keymap->components.compat);
+    free(keymap->components.symbols);
+    xkb_keymap_unref(keymap->base);
     xkb_context_unref(keymap->ctx);
     free(keymap);
 }
@@ -116,6 +140,60 @@ get_keymap_format_ops(enum xkb_keymap_format format)
     return keymap_format_ops[(int) format];
 }
 
+/*
+ * The keys under which keymaps are shared in a context, see
+ * XKB_CONTEXT_SHARE_KEYMAPS. They hold the whole input, so that only
+ * identical inputs share a keymap.
+ */
+static char *
+shared_keymap_key(char kind, enum xkb_keymap_format format,
+                  enum xkb_keymap_compile_flags flags,
+                  const char *const *parts, const size_t *part_sizes,
+                  size_t num_parts, size_t *key_size_out)
+{
+    const char header[] = { kind, (char) format, (char) flags };
+    size_t key_size = sizeof(header);
+    char *key, *p;
+
+    for (size_t i = 0; i < num_parts; i++)
+        key_size += part_sizes[i] + 1;
+
+    key = p = malloc(key_size);
+    if (!key)
+        return NULL;
+
+    memcpy(p, header, sizeof(header));
+    p += sizeof(header);
+    for (size_t i = 0; i < num_parts; i++) {
+        memcpy(p, parts[i], part_sizes[i]);
+        p += part_sizes[i];
+        *p++ = '\0';
+    }
+
+    *key_size_out = key_size;
+    return key;
+}
+
+static char *
+shared_keymap_key_from_names(const struct xkb_rule_names *rmlvo,
+                             enum xkb_keymap_compile_flags flags,
+                             size_t *key_size_out)
+{
+    const char *const parts[] = {
+        strempty(rmlvo->rules), strempty(rmlvo->model),
+        strempty(rmlvo->layout), strempty(rmlvo->variant),
+        strempty(rmlvo->options),
+    };
+    size_t part_sizes[ARRAY_SIZE(parts)];
+
+    for (size_t i = 0; i < ARRAY_SIZE(parts); i++)
+        part_sizes[i] = strlen(parts[i]);
+
+    return shared_keymap_key('N', XKB_KEYMAP_FORMAT_TEXT_V1, flags,
+                             parts, part_sizes, ARRAY_SIZE(parts),
+                             key_size_out);
+}
+
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_new_from_names(struct xkb_context *ctx,
                           const struct xkb_rule_names *rmlvo_in,
@@ -125,6 +203,8 @@ xkb_keymap_new_from_names(struct xkb_context *ctx,
     struct xkb_rule_names rmlvo;
     const enum xkb_keymap_format format = XKB_KEYMAP_FORMAT_TEXT_V1;
     const struct xkb_keymap_format_ops *ops;
+    char *key = NULL;
+    size_t key_size = 0;
 
     ops = get_keymap_format_ops(format);
     if (!ops || !ops->keymap_new_from_names) {
@@ -137,24 +217,90 @@ xkb_keymap_new_from_names(struct xkb_context *ctx,
         return NULL;
     }
 
-    keymap = xkb_keymap_new(ctx, format, flags);
-    if (!keymap)
-        return NULL;
-
     if (rmlvo_in)
         rmlvo = *rmlvo_in;
     else
         memset(&rmlvo, 0, sizeof(rmlvo));
     xkb_context_sanitize_rule_names(ctx, &rmlvo);
 
+    if (ctx->share_keymaps) {
+        key = shared_keymap_key_from_names(&rmlvo, flags, &key_size);
+        keymap = key ? xkb_context_find_shared_keymap(ctx, key, key_size)
+                     : NULL;
+        if (keymap) {
+            free(key);
+            return xkb_keymap_ref(keymap);
+        }
+    }
+
+    keymap = xkb_keymap_new(ctx, format, flags);
+    if (!keymap) {
+        free(key);
+        return NULL;
+    }
+
     if (!ops->keymap_new_from_names(keymap, &rmlvo)) {
+        free(key);
         xkb_keymap_unref(keymap);
         return NULL;
     }
 
+    if (key)
+        xkb_context_add_shared_keymap(ctx, key, key_size, keymap);
     return keymap;
 }
 
+XKB_EXPORT struct xkb_keymap *
+xkb_keymap_derive_from_names(struct xkb_keymap *keymap,
+                             const struct xkb_rule_names *rmlvo_in,
+                             enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_keymap *derived;
+    struct xkb_rule_names rmlvo;
+    const struct xkb_keymap_format_ops *ops;
+    char *key = NULL;
+    size_t key_size = 0;
+
+    ops = get_keymap_format_ops(keymap->format);
+    if (!ops || !ops->keymap_derive_from_names) {
+        log_err_func(keymap->ctx, "unsupported keymap format: %d\n",
+                     keymap->format);
+        return NULL;
+    }
+
+    if (flags & ~(XKB_KEYMAP_COMPILE_NO_FLAGS)) {
+        log_err_func(keymap->ctx, "unrecognized flags: %#x\n", flags);
+        return NULL;
+    }
+
+    if (rmlvo_in)
+        rmlvo = *rmlvo_in;
+    else
+        memset(&rmlvo, 0, sizeof(rmlvo));
+    xkb_context_sanitize_rule_names(keymap->ctx, &rmlvo);
+
+    if (keymap->ctx->share_keymaps) {
+        key = shared_keymap_key_from_names(&rmlvo, flags, &key_size);
+        derived = key ? xkb_context_find_shared_keymap(keymap->ctx, key,
+                                                       key_size)
+                      : NULL;
+        if (derived) {
+            free(key);
+            return xkb_keymap_ref(derived);
+        }
+    }
+
+    derived = ops->keymap_derive_from_names(keymap, &rmlvo, flags);
+    if (!derived) {
+        free(key);
+        return NULL;
+    }
+
+    if (key)
+        xkb_context_add_shared_keymap(keymap->ctx, key, key_size, derived);
+    return derived;
+}
+
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_new_from_string(struct xkb_context *ctx,
                            const char *string,
@@ -173,6 +319,8 @@ xkb_keymap_new_from_buffer(struct xkb_context *ctx,
 {
     struct xkb_keymap *keymap;
     const struct xkb_keymap_format_ops *ops;
+    char *key = NULL;
+    size_t key_size = 0;
 
     ops = get_keymap_format_ops(format);
     if (!ops || !ops->keymap_new_from_string) {
@@ -190,19 +338,35 @@ xkb_keymap_new_from_buffer(struct xkb_context *ctx,
         return NULL;
     }
 
-    keymap = xkb_keymap_new(ctx, format, flags);
-    if (!keymap)
-        return NULL;
-
     /* Allow a zero-terminated string as a buffer */
     if (length > 0 && buffer[length - 1] == '\0')
         length--;
 
+    if (ctx->share_keymaps) {
+        key = shared_keymap_key('S', format, flags, &buffer, &length, 1,
+                                &key_size);
+        keymap = key ? xkb_context_find_shared_keymap(ctx, key, key_size)
+                     : NULL;
+        if (keymap) {
+            free(key);
+            return xkb_keymap_ref(keymap);
+        }
+    }
+
+    keymap = xkb_keymap_new(ctx, format, flags);
+    if (!keymap) {
+        free(key);
+        return NULL;
+    }
+
     if (!ops->keymap_new_from_string(keymap, buffer, length)) {
+        free(key);
         xkb_keymap_unref(keymap);
         return NULL;
     }
 
+    if (key)
+        xkb_context_add_shared_keymap(ctx, key, key_size, keymap);
     return keymap;
 }
 
@@ -244,21 +408,166 @@ xkb_keymap_new_from_file(struct xkb_context *ctx,
 }
 
 XKB_EXPORT char *
-xkb_keymap_get_as_string(struct xkb_keymap *keymap,
-                         enum xkb_keymap_format format)
+xkb_keymap_get_as_string2(struct xkb_keymap *keymap,
+                          enum xkb_keymap_format format,
+                          enum xkb_keymap_serialize_flags flags)
 {
     const struct xkb_keymap_format_ops *ops;
 
+    if (flags & ~(XKB_KEYMAP_SERIALIZE_COMPACT)) {
+        log_err_func(keymap->ctx, "unrecognized flags: %#x\n", flags);
+        return NULL;
+    }
+
     if (format == XKB_KEYMAP_USE_ORIGINAL_FORMAT)
         format = keymap->format;
 
+    /* Copying is much cheaper than serializing again. */
+    if (keymap->cached_string && format == keymap->format &&
+        flags == XKB_KEYMAP_SERIALIZE_NO_FLAGS)
+        return memdup(keymap->cached_string, keymap->cached_string_size + 1,
+                      sizeof(char));
+
     ops = get_keymap_format_ops(format);
     if (!ops || !ops->keymap_get_as_string) {
         log_err_func(keymap->ctx, "unsupported keymap format: %d\n", format);
         return NULL;
     }
 
-    return ops->keymap_get_as_string(keymap);
+    return ops->keymap_get_as_string(keymap, flags);
+}
+
+XKB_EXPORT char *
+xkb_keymap_get_as_string(struct xkb_keymap *keymap,
+                         enum xkb_keymap_format format)
+{
+    return xkb_keymap_get_as_string2(keymap, format,
+                                     XKB_KEYMAP_SERIALIZE_NO_FLAGS);
+}
+
+XKB_EXPORT const char *
+xkb_keymap_get_as_cached_string(struct xkb_keymap *keymap,
+                                enum xkb_keymap_format format,
+                                size_t *size_out)
+{
+    if (format == XKB_KEYMAP_USE_ORIGINAL_FORMAT)
+        format = keymap->format;
+
+    if (format != keymap->format) {
+        log_err_func(keymap->ctx,
+                     "only the original format can be cached: %d\n", format);
+        return NULL;
+    }
+
+    if (!keymap->cached_string) {
+        char *string = xkb_keymap_get_as_string(keymap, format);
+        if (!string)
+            return NULL;
+
+        keymap->cached_string = string;
+        keymap->cached_string_size = strlen(string);
+    }
+
+    if (size_out)
+        *size_out = keymap->cached_string_size;
+    return keymap->cached_string;
+}
+
+XKB_EXPORT size_t
+xkb_keymap_write(struct xkb_keymap *keymap, enum xkb_keymap_format format,
+                 enum xkb_keymap_serialize_flags flags,
+                 xkb_keymap_write_fn write_fn, void *user_data)
+{
+    const struct xkb_keymap_format_ops *ops;
+    size_t size;
+
+    if (flags & ~(XKB_KEYMAP_SERIALIZE_COMPACT)) {
+        log_err_func(keymap->ctx, "unrecognized flags: %#x\n", flags);
+        return 0;
+    }
+
+    if (format == XKB_KEYMAP_USE_ORIGINAL_FORMAT)
+        format = keymap->format;
+
+    ops = get_keymap_format_ops(format);
+    if (!ops || !ops->keymap_write) {
+        log_err_func(keymap->ctx, "unsupported keymap format: %d\n", format);
+        return 0;
+    }
+
+    if (!ops->keymap_write(keymap, flags, write_fn, user_data, &size))
+        return 0;
+
+    return size;
+}
+
+#ifdef HAVE_MEMFD_CREATE
+static int
+write_to_fd(void *user_data, const char *data, size_t size)
+{
+    const int fd = *(const int *) user_data;
+
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        data += written;
+        size -= written;
+    }
+
+    return 1;
+}
+#endif
+
+XKB_EXPORT int
+xkb_keymap_get_as_fd(struct xkb_keymap *keymap, enum xkb_keymap_format format,
+                     enum xkb_keymap_serialize_flags flags, size_t *size_out)
+{
+#ifdef HAVE_MEMFD_CREATE
+    int fd;
+    size_t size;
+
+    fd = memfd_create("xkb-keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        log_err_func(keymap->ctx, "failed to create a memfd: %s\n",
+                     strerror(errno));
+        return -1;
+    }
+
+    if (format == XKB_KEYMAP_USE_ORIGINAL_FORMAT)
+        format = keymap->format;
+
+    if (keymap->cached_string && format == keymap->format &&
+        flags == XKB_KEYMAP_SERIALIZE_NO_FLAGS) {
+        size = keymap->cached_string_size;
+        if (!write_to_fd(&fd, keymap->cached_string, size))
+            size = 0;
+    }
+    else {
+        size = xkb_keymap_write(keymap, format, flags, write_to_fd, &fd);
+    }
+
+    if (size == 0 || !write_to_fd(&fd, "", 1) ||
+        lseek(fd, 0, SEEK_SET) < 0) {
+        log_err_func1(keymap->ctx, "failed to write the keymap\n");
+        close(fd);
+        return -1;
+    }
+
+    /* Not fatal: the file is still usable, just not shareable as safely. */
+    (void) fcntl(fd, F_ADD_SEALS,
+                 F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+    *size_out = size + 1;
+    return fd;
+#else
+    log_err_func1(keymap->ctx,
+                  "anonymous files are not supported on this system\n");
+    return -1;
+#endif
 }
 
 /**
@@ -473,6 +782,173 @@ xkb_keymap_key_get_mods_for_level(struct xkb_keymap *keymap,
     return count;
 }
 
+static int
+keysym_position_cmp(const void *a, const void *b)
+{
+    const struct xkb_keysym_position *pa = a, *pb = b;
+
+    if (pa->keysym != pb->keysym)
+        return pa->keysym < pb->keysym ? -1 : 1;
+    return pa->seq < pb->seq ? -1 : (pa->seq > pb->seq);
+}
+
+static int
+codepoint_position_cmp(const void *a, const void *b)
+{
+    const struct xkb_codepoint_position *pa = a, *pb = b;
+
+    if (pa->codepoint != pb->codepoint)
+        return pa->codepoint < pb->codepoint ? -1 : 1;
+    return pa->seq < pb->seq ? -1 : (pa->seq > pb->seq);
+}
+
+/*
+ * Build the reverse keysym index of a compiled keymap. It is built along
+ * with the keymap rather than on first use, so that looking up positions
+ * does not modify a keymap which may be shared between threads.
+ */
+void
+XkbBuildKeysymPositions(struct xkb_keymap *keymap)
+{
+    darray(struct xkb_keysym_position) positions = darray_new();
+    darray(struct xkb_codepoint_position) codepoints = darray_new();
+    darray(xkb_mod_mask_t) masks = darray_new();
+    const struct xkb_key *key;
+    xkb_level_index_t max_levels = 0;
+    unsigned int seq = 0;
+
+    for (unsigned i = 0; i < keymap->num_types; i++) {
+        max_levels = MAX(max_levels, keymap->types[i].num_levels);
+        /* At most one mask per entry, plus the empty one for level 0. */
+        if (keymap->types[i].num_entries + 1 > darray_size(masks))
+            darray_resize(masks, keymap->types[i].num_entries + 1);
+    }
+
+    /*
+     * Visit the levels in order of preference, so that the sequence number
+     * of a position is its rank.
+     */
+    for (xkb_layout_index_t layout = 0; layout < keymap->num_groups; layout++) {
+        for (xkb_level_index_t level = 0; level < max_levels; level++) {
+            xkb_keys_foreach(key, keymap) {
+                const struct xkb_level *leveli;
+                size_t num_masks;
+
+                if (layout >= key->num_groups ||
+                    level >= XkbKeyNumLevels(key, layout))
+                    continue;
+
+                leveli = &key->groups[layout].levels[level];
+                if (leveli->num_syms != 1)
+                    continue;
+
+                num_masks = xkb_keymap_key_get_mods_for_level(
+                    keymap, key->keycode, layout, level,
+                    masks.item, darray_size(masks)
+                );
+                for (size_t i = 0; i < num_masks; i++) {
+                    struct xkb_keysym_position position = {
+                        .keysym = leveli->u.sym,
+                        .seq = seq++,
+                        .pos = {
+                            .keycode = key->keycode,
+                            .layout = layout,
+                            .level = level,
+                            .mods = darray_item(masks, i),
+                        },
+                    };
+                    darray_append(positions, position);
+                }
+            }
+        }
+    }
+    darray_free(masks);
+
+    if (darray_size(positions) > 1)
+        qsort(positions.item, darray_size(positions),
+              sizeof(*positions.item), keysym_position_cmp);
+
+    for (unsigned i = 0; i < darray_size(positions); i++) {
+        struct xkb_codepoint_position codepoint = {
+            .codepoint = xkb_keysym_to_utf32(darray_item(positions, i).keysym),
+            .seq = darray_item(positions, i).seq,
+            .index = i,
+        };
+        if (codepoint.codepoint != 0)
+            darray_append(codepoints, codepoint);
+    }
+
+    if (darray_size(codepoints) > 1)
+        qsort(codepoints.item, darray_size(codepoints),
+              sizeof(*codepoints.item), codepoint_position_cmp);
+
+    keymap->num_keysym_positions = darray_size(positions);
+    darray_steal(positions, &keymap->keysym_positions, NULL);
+    keymap->num_codepoint_positions = darray_size(codepoints);
+    darray_steal(codepoints, &keymap->codepoint_positions, NULL);
+}
+
+XKB_EXPORT size_t
+xkb_keymap_keysym_get_positions(struct xkb_keymap *keymap,
+                                xkb_keysym_t keysym,
+                                struct xkb_key_position *positions_out,
+                                size_t positions_size)
+{
+    size_t lo = 0, hi, count = 0;
+
+    /* Find the first position of the keysym. */
+    hi = keymap->num_keysym_positions;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keymap->keysym_positions[mid].keysym < keysym)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (size_t i = lo; i < keymap->num_keysym_positions &&
+                        keymap->keysym_positions[i].keysym == keysym; i++) {
+        if (count < positions_size)
+            positions_out[count] = keymap->keysym_positions[i].pos;
+        count++;
+    }
+
+    return count;
+}
+
+XKB_EXPORT size_t
+xkb_keymap_utf32_get_positions(struct xkb_keymap *keymap,
+                               uint32_t ucs,
+                               struct xkb_key_position *positions_out,
+                               size_t positions_size)
+{
+    size_t lo = 0, hi, count = 0;
+
+    if (ucs == 0)
+        return 0;
+
+    /* Find the first position of the code point. */
+    hi = keymap->num_codepoint_positions;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keymap->codepoint_positions[mid].codepoint < ucs)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (size_t i = lo; i < keymap->num_codepoint_positions &&
+                        keymap->codepoint_positions[i].codepoint == ucs; i++) {
+        const unsigned int index = keymap->codepoint_positions[i].index;
+
+        if (count < positions_size)
+            positions_out[count] = keymap->keysym_positions[index].pos;
+        count++;
+    }
+
+    return count;
+}
+
 /**
  * As below, but takes an explicit layout/level rather than state.
  */
@@ -562,12 +1038,8 @@ xkb_keymap_key_by_name(struct xkb_keymap *keymap, const char *name)
     if (!atom)
         return XKB_KEYCODE_INVALID;
 
-    xkb_keys_foreach(key, keymap) {
-        if (key->name == atom)
-            return key->keycode;
-    }
-
-    return XKB_KEYCODE_INVALID;
+    key = XkbKeyByName(keymap, atom, false);
+    return key ? key->keycode : XKB_KEYCODE_INVALID;
 }
 
 /**
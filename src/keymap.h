@@ -286,6 +286,30 @@ struct xkb_key_alias {
     xkb_atom_t alias;
 };
 
+/* Entries of the reverse keysym index; see xkb_keymap_keysym_get_positions(). */
+struct xkb_keysym_position {
+    xkb_keysym_t keysym;
+    /* Rank of the position, from the most preferred. */
+    unsigned int seq;
+    struct xkb_key_position pos;
+};
+
+struct xkb_codepoint_position {
+    uint32_t codepoint;
+    unsigned int seq;
+    /* Index in keymap->keysym_positions. */
+    unsigned int index;
+};
+
+/* Entry of the key name index; see XkbBuildKeyNameIndex(). */
+struct xkb_key_name_entry {
+    xkb_atom_t name;
+    /* The key with this name, or XKB_KEYCODE_INVALID. */
+    xkb_keycode_t keycode;
+    /* If this name is an alias, the name it stands for. */
+    xkb_atom_t real;
+};
+
 struct xkb_controls {
     unsigned char groups_wrap;
     struct xkb_mods internal;
@@ -361,6 +385,14 @@ struct xkb_mod_set {
     unsigned int num_mods;
 };
 
+/* The KcCGST components, as resolved from RMLVO names by the rules. */
+struct xkb_component_names {
+    char *keycodes;
+    char *types;
+    char *compat;
+    char *symbols;
+};
+
 /* Common keyboard description structure */
 struct xkb_keymap {
     struct xkb_context *ctx;
@@ -375,10 +407,32 @@ struct xkb_keymap {
     xkb_keycode_t max_key_code;
     struct xkb_key *keys;
 
+    /*
+     * Contiguous storage of the groups, levels and multi-keysym arrays of
+     * all the keys, see XkbPackKeyLevels(). NULL while each key still owns
+     * its own allocations.
+     */
+    struct xkb_group *packed_groups;
+    struct xkb_level *packed_levels;
+    xkb_keysym_t *packed_syms;
+
     /* aliases in no particular order */
     unsigned int num_key_aliases;
     struct xkb_key_alias *key_aliases;
 
+    /* Open addressing hash table of the key names and aliases. */
+    unsigned int key_names_size;
+    struct xkb_key_name_entry *key_names;
+
+    /*
+     * Reverse keysym index, built after compiling: the positions sorted by
+     * keysym, and their indexes sorted by code point.
+     */
+    size_t num_keysym_positions;
+    struct xkb_keysym_position *keysym_positions;
+    size_t num_codepoint_positions;
+    struct xkb_codepoint_position *codepoint_positions;
+
     struct xkb_key_type *types;
     unsigned int num_types;
 
@@ -400,6 +454,22 @@ struct xkb_keymap {
     char *symbols_section_name;
     char *types_section_name;
     char *compat_section_name;
+
+    /*
+     * The keymap serialized in its own format, built on first use by
+     * xkb_keymap_get_as_cached_string().
+     */
+    char *cached_string;
+    size_t cached_string_size;
+
+    /*
+     * Keymaps compiled from RMLVO names keep the components they were
+     * compiled from. Once a keymap is derived from them, they also keep a
+     * keymap holding only the compiled keycodes, types and compat sections,
+     * shared with the derived keymaps; see xkb_keymap_derive_from_names().
+     */
+    struct xkb_component_names components;
+    struct xkb_keymap *base;
 };
 
 #define xkb_keys_foreach(iter, keymap) \
@@ -457,6 +527,18 @@ xkb_keymap_new(struct xkb_context *ctx,
                enum xkb_keymap_format format,
                enum xkb_keymap_compile_flags flags);
 
+bool
+XkbBuildKeyNameIndex(struct xkb_keymap *keymap);
+
+void
+XkbPackKeyLevels(struct xkb_keymap *keymap);
+
+void
+XkbBuildKeysymPositions(struct xkb_keymap *keymap);
+
+bool
+XkbCopyKeymapBase(struct xkb_keymap *keymap, const struct xkb_keymap *base);
+
 struct xkb_key *
 XkbKeyByName(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases);
 
@@ -488,7 +570,15 @@ struct xkb_keymap_format_ops {
     bool (*keymap_new_from_string)(struct xkb_keymap *keymap,
                                    const char *string, size_t length);
     bool (*keymap_new_from_file)(struct xkb_keymap *keymap, FILE *file);
-    char *(*keymap_get_as_string)(struct xkb_keymap *keymap);
+    char *(*keymap_get_as_string)(struct xkb_keymap *keymap,
+                                  enum xkb_keymap_serialize_flags flags);
+    bool (*keymap_write)(struct xkb_keymap *keymap,
+                         enum xkb_keymap_serialize_flags flags,
+                         xkb_keymap_write_fn write_fn, void *user_data,
+                         size_t *size_out);
+    struct xkb_keymap *(*keymap_derive_from_names)(
+        struct xkb_keymap *keymap, const struct xkb_rule_names *names,
+        enum xkb_keymap_compile_flags flags);
 };
 
 extern const struct xkb_keymap_format_ops text_v1_keymap_format_ops;
@@ -54,6 +54,7 @@
 #include "utils.h"
 #include "keysym.h"
 #include "ks_tables.h"
+#include "ks_props.h"
 
 static inline const char *
 get_name(const struct name_keysym *entry)
@@ -231,51 +232,56 @@ xkb_keysym_from_name(const char *name, enum xkb_keysym_flags flags)
     return XKB_KEY_NoSymbol;
 }
 
+static void
+XConvertCase(xkb_keysym_t sym, xkb_keysym_t *lower, xkb_keysym_t *upper);
+
+uint8_t
+xkb_keysym_get_properties(xkb_keysym_t ks)
+{
+    xkb_keysym_t lower, upper;
+    uint8_t props = 0;
+
+    /* Legacy keysyms, including Latin 1, keypad and modifiers. */
+    if (ks <= 0xffff)
+        return keysym_props_pages[keysym_props_page_index[ks >> 8]][ks & 0xff];
+
+    /* Other non-Unicode keysyms have no case and are no modifiers. */
+    if ((ks & 0xff000000) != 0x01000000)
+        return 0;
+
+    XConvertCase(ks, &lower, &upper);
+
+    if (lower != ks || upper != ks)
+        props |= XKB_KEYSYM_PROP_CASED;
+    if (lower != upper)
+        props |= (ks == lower ? XKB_KEYSYM_PROP_LOWER : 0) |
+                 (ks == upper ? XKB_KEYSYM_PROP_UPPER : 0);
+
+    return props;
+}
+
 bool
 xkb_keysym_is_keypad(xkb_keysym_t keysym)
 {
-    return keysym >= XKB_KEY_KP_Space && keysym <= XKB_KEY_KP_Equal;
+    return xkb_keysym_get_properties(keysym) & XKB_KEYSYM_PROP_KEYPAD;
 }
 
-
 bool
 xkb_keysym_is_modifier(xkb_keysym_t keysym)
 {
-    return
-        (keysym >= XKB_KEY_Shift_L && keysym <= XKB_KEY_Hyper_R) ||
-        /* libX11 only goes upto XKB_KEY_ISO_Level5_Lock. */
-        (keysym >= XKB_KEY_ISO_Lock && keysym <= XKB_KEY_ISO_Last_Group_Lock) ||
-        keysym == XKB_KEY_Mode_switch ||
-        keysym == XKB_KEY_Num_Lock;
+    return xkb_keysym_get_properties(keysym) & XKB_KEYSYM_PROP_MODIFIER;
 }
 
-static void
-XConvertCase(xkb_keysym_t sym, xkb_keysym_t *lower, xkb_keysym_t *upper);
-
 bool
 xkb_keysym_is_lower(xkb_keysym_t ks)
 {
-    xkb_keysym_t lower, upper;
-
-    XConvertCase(ks, &lower, &upper);
-
-    if (lower == upper)
-        return false;
-
-    return (ks == lower ? true : false);
+    return xkb_keysym_get_properties(ks) & XKB_KEYSYM_PROP_LOWER;
 }
 
 bool
 xkb_keysym_is_upper(xkb_keysym_t ks)
 {
-    xkb_keysym_t lower, upper;
-
-    XConvertCase(ks, &lower, &upper);
-
-    if (lower == upper)
-        return false;
-
-    return (ks == upper ? true : false);
+    return xkb_keysym_get_properties(ks) & XKB_KEYSYM_PROP_UPPER;
 }
 
 XKB_EXPORT xkb_keysym_t
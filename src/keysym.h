@@ -58,6 +58,34 @@
 /** Minimum keysym value */
 #define XKB_KEYSYM_MIN      0x00000000
 
+/**
+ * Keysym classification, as returned by xkb_keysym_get_properties().
+ *
+ * Keep in sync with scripts/makekeysymprops.
+ */
+enum keysym_property {
+    /** Keypad keysym, KP_Space to KP_Equal. */
+    XKB_KEYSYM_PROP_KEYPAD = (1 << 0),
+    /** Modifier keysym, as understood by libX11. */
+    XKB_KEYSYM_PROP_MODIFIER = (1 << 1),
+    /** Lower case letter, see xkb_keysym_is_lower(). */
+    XKB_KEYSYM_PROP_LOWER = (1 << 2),
+    /** Upper case letter, see xkb_keysym_is_upper(). */
+    XKB_KEYSYM_PROP_UPPER = (1 << 3),
+    /** xkb_keysym_to_lower() or xkb_keysym_to_upper() change the keysym. */
+    XKB_KEYSYM_PROP_CASED = (1 << 4),
+};
+
+/**
+ * Get all the properties of a keysym at once.
+ *
+ * Legacy keysyms are looked up in a table; Unicode keysyms are computed.
+ *
+ * @returns A mask of enum keysym_property.
+ */
+uint8_t
+xkb_keysym_get_properties(xkb_keysym_t keysym);
+
 bool
 xkb_keysym_is_lower(xkb_keysym_t keysym);
 
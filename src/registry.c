@@ -25,15 +25,18 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 
 #include "xkbcommon/xkbregistry.h"
 #include "utils.h"
 #include "util-list.h"
+#include "atom.h"
 
 struct rxkb_object;
 
@@ -53,12 +56,12 @@ struct rxkb_object {
 
 struct rxkb_iso639_code {
     struct rxkb_object base;
-    char *code;
+    const char *code;
 };
 
 struct rxkb_iso3166_code {
     struct rxkb_object base;
-    char *code;
+    const char *code;
 };
 
 enum context_state {
@@ -67,6 +70,42 @@ enum context_state {
     CONTEXT_FAILED,
 };
 
+/*
+ * All objects but the context, and their strings, are allocated from the
+ * context. The strings are interned, and the objects are stored
+ * back-to-back in large chunks, in the order they are created. Both are
+ * only freed with the context.
+ */
+#define ARENA_CHUNK_SIZE 16384
+
+struct rxkb_arena {
+    darray(char *) chunks;
+    /* Free space left in the last chunk. */
+    char *pos;
+    size_t left;
+};
+
+/*
+ * An insert-only hash table keyed by pairs of interned strings, which are
+ * compared by pointer. Either string may be NULL.
+ */
+struct rxkb_index_entry {
+    const char *key1;
+    const char *key2;
+    void *value;
+};
+
+struct rxkb_index {
+    struct rxkb_index_entry *entries;
+    size_t size;            /* a power of 2, or 0 */
+    size_t count;
+};
+
+/* The layouts with a given ISO code, in the order of the layout list. */
+struct rxkb_layout_set {
+    darray(struct rxkb_layout *) layouts;
+};
+
 struct rxkb_context {
     struct rxkb_object base;
     enum context_state context_state;
@@ -79,7 +118,19 @@ struct rxkb_context {
     struct list option_groups;  /* list of struct rxkb_option_group */
 
     darray(char *) includes;
+    char *cache_dir;
 
+    struct rxkb_arena arena;
+    struct atom_table *strings;
+
+    /* Built as the items are merged, see registry_add(). */
+    struct rxkb_index model_index;        /* name */
+    struct rxkb_index layout_index;       /* name, variant */
+    struct rxkb_index group_index;        /* name */
+    struct rxkb_index option_index;       /* name */
+    struct rxkb_index group_option_index; /* group name, name */
+    struct rxkb_index iso639_index;       /* code -> struct rxkb_layout_set */
+    struct rxkb_index iso3166_index;      /* code -> struct rxkb_layout_set */
 
     ATTR_PRINTF(3, 0) void (*log_fn)(struct rxkb_context *ctx,
                                      enum rxkb_log_level level,
@@ -92,19 +143,19 @@ struct rxkb_context {
 struct rxkb_model {
     struct rxkb_object base;
 
-    char *name;
-    char *vendor;
-    char *description;
+    const char *name;
+    const char *vendor;
+    const char *description;
     enum rxkb_popularity popularity;
 };
 
 struct rxkb_layout {
     struct rxkb_object base;
 
-    char *name;
-    char *brief;
-    char *description;
-    char *variant;
+    const char *name;
+    const char *brief;
+    const char *description;
+    const char *variant;
     enum rxkb_popularity popularity;
 
     struct list iso639s;  /* list of struct rxkb_iso639_code */
@@ -116,17 +167,17 @@ struct rxkb_option_group {
 
     bool allow_multiple;
     struct list options; /* list of struct rxkb_options */
-    char *name;
-    char *description;
+    const char *name;
+    const char *description;
     enum rxkb_popularity popularity;
 };
 
 struct rxkb_option {
     struct rxkb_object base;
 
-    char *name;
-    char *brief;
-    char *description;
+    const char *name;
+    const char *brief;
+    const char *description;
     enum rxkb_popularity popularity;
 };
 
@@ -177,11 +228,11 @@ XKB_EXPORT struct type_ * type_##_unref(struct type_ *object) { \
     return rxkb_object_unref(&object->base); \
 }
 
-#define DECLARE_CREATE_FOR_TYPE(type_) \
+#define DECLARE_CREATE_FOR_TYPE(type_, destroy_) \
 static inline struct type_ * type_##_create(struct rxkb_object *parent) { \
-    struct type_ *t = calloc(1, sizeof *t); \
+    struct type_ *t = rxkb_arena_alloc(parent, sizeof *t); \
     if (t) \
-        rxkb_object_init(&t->base, parent, (destroy_func_t)type_##_destroy); \
+        rxkb_object_init(&t->base, parent, (destroy_func_t)(destroy_)); \
     return t; \
 }
 
@@ -212,6 +263,179 @@ type_##_next(struct type_ *o) \
     return next; \
 }
 
+/* Allocate zeroed memory in the context of @parent. */
+static void *
+rxkb_arena_alloc(struct rxkb_object *parent, size_t size)
+{
+    struct rxkb_context *ctx;
+    struct rxkb_arena *arena;
+    void *mem;
+
+    while (parent->parent)
+        parent = parent->parent;
+    ctx = container_of(parent, struct rxkb_context, base);
+    arena = &ctx->arena;
+
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (size > arena->left) {
+        /* Oversized objects get a chunk of their own. */
+        size_t chunk_size = MAX(ARENA_CHUNK_SIZE, size);
+        char *chunk = calloc(1, chunk_size);
+        if (!chunk)
+            return NULL;
+        darray_append(arena->chunks, chunk);
+        arena->pos = chunk;
+        arena->left = chunk_size;
+    }
+
+    mem = arena->pos;
+    arena->pos += size;
+    arena->left -= size;
+    return mem;
+}
+
+static void
+rxkb_arena_free(struct rxkb_arena *arena)
+{
+    char **chunk;
+
+    darray_foreach(chunk, arena->chunks)
+        free(*chunk);
+    darray_free(arena->chunks);
+}
+
+/* Returns the interned copy of @str, or NULL if @str is NULL. */
+static const char *
+rxkb_intern(struct rxkb_context *ctx, const char *str)
+{
+    xkb_atom_t atom;
+
+    if (!str)
+        return NULL;
+
+    atom = atom_intern(ctx->strings, str, strlen(str), true);
+    return atom_text(ctx->strings, atom);
+}
+
+/*
+ * Returns the interned copy of @str if there is one. Nothing is found for
+ * a string that is not interned, so the lookups can start with this.
+ */
+static const char *
+rxkb_lookup_string(struct rxkb_context *ctx, const char *str)
+{
+    xkb_atom_t atom;
+
+    if (!str)
+        return NULL;
+
+    atom = atom_intern(ctx->strings, str, strlen(str), false);
+    return atom == XKB_ATOM_NONE ? NULL : atom_text(ctx->strings, atom);
+}
+
+static inline size_t
+rxkb_index_hash(const char *key1, const char *key2)
+{
+    uint64_t hash = (uintptr_t) key1 * UINT64_C(0x9e3779b97f4a7c15);
+
+    hash ^= (uintptr_t) key2 * UINT64_C(0xc2b2ae3d27d4eb4f);
+    return (size_t) (hash ^ (hash >> 29));
+}
+
+static struct rxkb_index_entry *
+rxkb_index_slot(struct rxkb_index_entry *entries, size_t size,
+                const char *key1, const char *key2)
+{
+    size_t i = rxkb_index_hash(key1, key2) & (size - 1);
+
+    /* The table is never full, and the empty entries have no value. */
+    while (entries[i].value &&
+           (entries[i].key1 != key1 || entries[i].key2 != key2))
+        i = (i + 1) & (size - 1);
+
+    return &entries[i];
+}
+
+static void *
+rxkb_index_find(const struct rxkb_index *index,
+                const char *key1, const char *key2)
+{
+    if (index->count == 0)
+        return NULL;
+
+    return rxkb_index_slot(index->entries, index->size, key1, key2)->value;
+}
+
+/* @value must not be NULL, and the key must not be in the index yet. */
+static void
+rxkb_index_add(struct rxkb_index *index,
+               const char *key1, const char *key2, void *value)
+{
+    struct rxkb_index_entry *entry;
+
+    if ((index->count + 1) * 4 > index->size * 3) {
+        size_t size = index->size ? index->size * 2 : 64;
+        struct rxkb_index_entry *entries = calloc(size, sizeof(*entries));
+
+        if (!entries)
+            return;
+
+        for (size_t i = 0; i < index->size; i++) {
+            struct rxkb_index_entry *old = &index->entries[i];
+
+            if (old->value)
+                *rxkb_index_slot(entries, size, old->key1, old->key2) = *old;
+        }
+        free(index->entries);
+        index->entries = entries;
+        index->size = size;
+    }
+
+    entry = rxkb_index_slot(index->entries, index->size, key1, key2);
+    assert(!entry->value);
+    *entry = (struct rxkb_index_entry) { key1, key2, value };
+    index->count++;
+}
+
+static void
+rxkb_index_free(struct rxkb_index *index)
+{
+    free(index->entries);
+    *index = (struct rxkb_index) { 0 };
+}
+
+/* Add @layout to the layouts with @code. */
+static void
+rxkb_index_add_code(struct rxkb_context *ctx, struct rxkb_index *index,
+                    const char *code, struct rxkb_layout *layout)
+{
+    struct rxkb_layout_set *set = rxkb_index_find(index, code, NULL);
+
+    if (!set) {
+        set = rxkb_arena_alloc(&ctx->base, sizeof(*set));
+        if (!set)
+            return;
+        rxkb_index_add(index, code, NULL, set);
+    }
+
+    /* A layout may list a code twice */
+    if (darray_empty(set->layouts) ||
+        darray_item(set->layouts, darray_size(set->layouts) - 1) != layout)
+        darray_append(set->layouts, layout);
+}
+
+static void
+rxkb_index_free_codes(struct rxkb_index *index)
+{
+    for (size_t i = 0; i < index->size; i++) {
+        struct rxkb_layout_set *set = index->entries[i].value;
+
+        if (set)
+            darray_free(set->layouts);
+    }
+    rxkb_index_free(index);
+}
+
 static void
 rxkb_object_init(struct rxkb_object *object, struct rxkb_object *parent, destroy_func_t destroy)
 {
@@ -227,7 +451,9 @@ rxkb_object_destroy(struct rxkb_object *object)
     if (object->destroy)
         object->destroy(object);
     list_remove(&object->link);
-    free(object);
+    /* Everything else is in the arena of the context. */
+    if (!object->parent)
+        free(object);
 }
 
 static void *
@@ -247,12 +473,6 @@ rxkb_object_unref(struct rxkb_object *object)
     return NULL;
 }
 
-static void
-rxkb_iso639_code_destroy(struct rxkb_iso639_code *code)
-{
-    free(code->code);
-}
-
 XKB_EXPORT struct rxkb_iso639_code *
 rxkb_layout_get_iso639_first(struct rxkb_layout *layout)
 {
@@ -281,15 +501,9 @@ rxkb_iso639_code_next(struct rxkb_iso639_code *code)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_iso639_code);
-DECLARE_CREATE_FOR_TYPE(rxkb_iso639_code);
+DECLARE_CREATE_FOR_TYPE(rxkb_iso639_code, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_iso639_code, code);
 
-static void
-rxkb_iso3166_code_destroy(struct rxkb_iso3166_code *code)
-{
-    free(code->code);
-}
-
 XKB_EXPORT struct rxkb_iso3166_code *
 rxkb_layout_get_iso3166_first(struct rxkb_layout *layout)
 {
@@ -318,19 +532,11 @@ rxkb_iso3166_code_next(struct rxkb_iso3166_code *code)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_iso3166_code);
-DECLARE_CREATE_FOR_TYPE(rxkb_iso3166_code);
+DECLARE_CREATE_FOR_TYPE(rxkb_iso3166_code, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_iso3166_code, code);
 
-static void
-rxkb_option_destroy(struct rxkb_option *o)
-{
-    free(o->name);
-    free(o->brief);
-    free(o->description);
-}
-
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_option);
-DECLARE_CREATE_FOR_TYPE(rxkb_option);
+DECLARE_CREATE_FOR_TYPE(rxkb_option, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_option, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_option, brief);
 DECLARE_GETTER_FOR_TYPE(rxkb_option, description);
@@ -343,11 +549,6 @@ rxkb_layout_destroy(struct rxkb_layout *l)
     struct rxkb_iso639_code *iso639, *tmp_639;
     struct rxkb_iso3166_code *iso3166, *tmp_3166;
 
-    free(l->name);
-    free(l->brief);
-    free(l->description);
-    free(l->variant);
-
     list_for_each_safe(iso639, tmp_639, &l->iso639s, base.link) {
         rxkb_iso639_code_unref(iso639);
     }
@@ -357,7 +558,7 @@ rxkb_layout_destroy(struct rxkb_layout *l)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_layout);
-DECLARE_CREATE_FOR_TYPE(rxkb_layout);
+DECLARE_CREATE_FOR_TYPE(rxkb_layout, rxkb_layout_destroy);
 DECLARE_GETTER_FOR_TYPE(rxkb_layout, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_layout, brief);
 DECLARE_GETTER_FOR_TYPE(rxkb_layout, description);
@@ -365,16 +566,8 @@ DECLARE_GETTER_FOR_TYPE(rxkb_layout, variant);
 DECLARE_TYPED_GETTER_FOR_TYPE(rxkb_layout, popularity, enum rxkb_popularity);
 DECLARE_FIRST_NEXT_FOR_TYPE(rxkb_layout, rxkb_context, layouts);
 
-static void
-rxkb_model_destroy(struct rxkb_model *m)
-{
-    free(m->name);
-    free(m->vendor);
-    free(m->description);
-}
-
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_model);
-DECLARE_CREATE_FOR_TYPE(rxkb_model);
+DECLARE_CREATE_FOR_TYPE(rxkb_model, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_model, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_model, vendor);
 DECLARE_GETTER_FOR_TYPE(rxkb_model, description);
@@ -386,9 +579,6 @@ rxkb_option_group_destroy(struct rxkb_option_group *og)
 {
     struct rxkb_option *o, *otmp;
 
-    free(og->name);
-    free(og->description);
-
     list_for_each_safe(o, otmp, &og->options, base.link) {
         rxkb_option_unref(o);
     }
@@ -401,7 +591,8 @@ rxkb_option_group_allows_multiple(struct rxkb_option_group *g)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_option_group);
-DECLARE_CREATE_FOR_TYPE(rxkb_option_group);
+DECLARE_CREATE_FOR_TYPE(rxkb_option_group,
+                        rxkb_option_group_destroy);
 DECLARE_GETTER_FOR_TYPE(rxkb_option_group, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_option_group, description);
 DECLARE_TYPED_GETTER_FOR_TYPE(rxkb_option_group, popularity, enum rxkb_popularity);
@@ -432,10 +623,22 @@ rxkb_context_destroy(struct rxkb_context *ctx)
     darray_free(ctx->includes);
 
     assert(darray_empty(ctx->includes));
+
+    free(ctx->cache_dir);
+
+    rxkb_index_free(&ctx->model_index);
+    rxkb_index_free(&ctx->layout_index);
+    rxkb_index_free(&ctx->group_index);
+    rxkb_index_free(&ctx->option_index);
+    rxkb_index_free(&ctx->group_option_index);
+    rxkb_index_free_codes(&ctx->iso639_index);
+    rxkb_index_free_codes(&ctx->iso3166_index);
+
+    rxkb_arena_free(&ctx->arena);
+    atom_table_free(ctx->strings);
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_context);
-DECLARE_CREATE_FOR_TYPE(rxkb_context);
 DECLARE_TYPED_GETTER_FOR_TYPE(rxkb_context, log_level, enum rxkb_log_level);
 
 static char *
@@ -512,12 +715,14 @@ log_level(const char *level) {
 XKB_EXPORT struct rxkb_context *
 rxkb_context_new(enum rxkb_context_flags flags)
 {
-    struct rxkb_context *ctx = rxkb_context_create(NULL);
+    struct rxkb_context *ctx = calloc(1, sizeof(*ctx));
     const char *env;
 
     if (!ctx)
         return NULL;
 
+    rxkb_object_init(&ctx->base, NULL, (destroy_func_t) rxkb_context_destroy);
+
     ctx->context_state = CONTEXT_NEW;
     ctx->load_extra_rules_files = flags & RXKB_CONTEXT_LOAD_EXOTIC_RULES;
     ctx->use_secure_getenv = !(flags & RXKB_CONTEXT_NO_SECURE_GETENV);
@@ -533,6 +738,12 @@ rxkb_context_new(enum rxkb_context_flags flags)
     list_init(&ctx->layouts);
     list_init(&ctx->option_groups);
 
+    ctx->strings = atom_table_new();
+    if (!ctx->strings) {
+        rxkb_context_unref(ctx);
+        return NULL;
+    }
+
     if (!(flags & RXKB_CONTEXT_NO_DEFAULT_INCLUDES) &&
         !rxkb_context_include_path_append_default(ctx)) {
         rxkb_context_unref(ctx);
@@ -634,6 +845,33 @@ rxkb_context_include_path_append_default(struct rxkb_context *ctx)
     return ret;
 }
 
+XKB_EXPORT bool
+rxkb_context_set_cache_dir(struct rxkb_context *ctx, const char *path)
+{
+    struct stat stat_buf;
+    char *tmp;
+
+    if (ctx->context_state != CONTEXT_NEW) {
+        log_err(ctx, "the cache directory can only be set on a new context\n");
+        return false;
+    }
+
+    if (stat(path, &stat_buf) != 0 || !S_ISDIR(stat_buf.st_mode))
+        return false;
+
+    if (!check_eaccess(path, R_OK | W_OK | X_OK))
+        return false;
+
+    tmp = strdup(path);
+    if (!tmp)
+        return false;
+
+    free(ctx->cache_dir);
+    ctx->cache_dir = tmp;
+
+    return true;
+}
+
 XKB_EXPORT bool
 rxkb_context_parse_default_ruleset(struct rxkb_context *ctx)
 {
@@ -688,413 +926,513 @@ rxkb_context_get_user_data(struct rxkb_context *ctx)
     return ctx->userdata;
 }
 
-static inline bool
-is_node(xmlNode *node, const char *name)
+XKB_EXPORT struct rxkb_model *
+rxkb_model_find(struct rxkb_context *ctx, const char *name)
 {
-    return node->type == XML_ELEMENT_NODE &&
-        xmlStrEqual(node->name, (const xmlChar*)name);
+    name = rxkb_lookup_string(ctx, name);
+    if (!name)
+        return NULL;
+
+    return rxkb_index_find(&ctx->model_index, name, NULL);
 }
 
-/* return a copy of the text content from the first text node of this node */
-static char *
-extract_text(xmlNode *node)
+XKB_EXPORT struct rxkb_layout *
+rxkb_layout_find(struct rxkb_context *ctx, const char *name,
+                 const char *variant)
 {
-    xmlNode *n;
+    name = rxkb_lookup_string(ctx, name);
+    if (!name)
+        return NULL;
 
-    for (n = node->children; n; n = n->next) {
-        if (n->type == XML_TEXT_NODE)
-            return (char *)xmlStrdup(n->content);
+    if (variant) {
+        variant = rxkb_lookup_string(ctx, variant);
+        if (!variant)
+            return NULL;
     }
-    return NULL;
+
+    return rxkb_index_find(&ctx->layout_index, name, variant);
 }
 
-static bool
-parse_config_item(struct rxkb_context *ctx,
-                  xmlNode *parent,
-                  char **name,
-                  char **description,
-                  char **brief,
-                  char **vendor)
-{
-    xmlNode *node = NULL;
-    xmlNode *ci = NULL;
-
-    for (ci = parent->children; ci; ci = ci->next) {
-        if (is_node(ci, "configItem")) {
-            *name = NULL;
-            *description = NULL;
-            *brief = NULL;
-            *vendor = NULL;
-
-            for (node = ci->children; node; node = node->next) {
-                if (is_node(node, "name"))
-                    *name = extract_text(node);
-                else if (is_node(node, "description"))
-                    *description = extract_text(node);
-                else if (is_node(node, "shortDescription"))
-                    *brief = extract_text(node);
-                else if (is_node(node, "vendor"))
-                    *vendor = extract_text(node);
-                /* Note: the DTD allows for vendor + brief but models only use
-                 * vendor and everything else only uses shortDescription */
-            }
-
-            if (!*name || !strlen(*name))  {
-                log_err(ctx, "xml:%d: missing required element 'name'\n",
-                        ci->line);
-                free(*name);
-                free(*description);
-                free(*brief);
-                free(*vendor);
-                return false;
-            }
-
-            return true; /* only one configItem allowed in the dtd */
-        }
-    }
+XKB_EXPORT struct rxkb_option_group *
+rxkb_option_group_find(struct rxkb_context *ctx, const char *name)
+{
+    name = rxkb_lookup_string(ctx, name);
+    if (!name)
+        return NULL;
 
-    return false;
+    return rxkb_index_find(&ctx->group_index, name, NULL);
 }
 
-static void
-parse_model(struct rxkb_context *ctx, xmlNode *model,
-            enum rxkb_popularity popularity)
-{
-    char *name, *description, *brief, *vendor;
-
-    if (parse_config_item(ctx, model, &name, &description, &brief, &vendor)) {
-        struct rxkb_model *m;
-
-        list_for_each(m, &ctx->models, base.link) {
-            if (streq(m->name, name)) {
-                free(name);
-                free(description);
-                free(brief);
-                free(vendor);
-                return;
-            }
-        }
+XKB_EXPORT struct rxkb_option *
+rxkb_option_find(struct rxkb_context *ctx, const char *name)
+{
+    name = rxkb_lookup_string(ctx, name);
+    if (!name)
+        return NULL;
 
-        /* new model */
-        m = rxkb_model_create(&ctx->base);
-        m->name = name;
-        m->description = description;
-        m->vendor = vendor;
-        m->popularity = popularity;
-        list_append(&ctx->models, &m->base.link);
-    }
+    return rxkb_index_find(&ctx->option_index, name, NULL);
 }
 
-static void
-parse_model_list(struct rxkb_context *ctx, xmlNode *model_list,
-                enum rxkb_popularity popularity)
+static size_t
+find_layouts_by_code(struct rxkb_context *ctx, struct rxkb_index *index,
+                     const char *code, struct rxkb_layout **layouts_out,
+                     size_t layouts_size)
 {
-    xmlNode *node = NULL;
+    struct rxkb_layout_set *set;
+    size_t count;
 
-    for (node = model_list->children; node; node = node->next) {
-        if (is_node(node, "model"))
-            parse_model(ctx, node, popularity);
-    }
+    code = rxkb_lookup_string(ctx, code);
+    if (!code)
+        return 0;
+
+    set = rxkb_index_find(index, code, NULL);
+    if (!set)
+        return 0;
+
+    count = darray_size(set->layouts);
+    if (layouts_out)
+        memcpy(layouts_out, set->layouts.item,
+               MIN(count, layouts_size) * sizeof(*layouts_out));
+
+    return count;
 }
 
-static void
-parse_language_list(xmlNode *language_list, struct rxkb_layout *layout)
+XKB_EXPORT size_t
+rxkb_context_find_layouts_by_iso639(struct rxkb_context *ctx, const char *code,
+                                    struct rxkb_layout **layouts_out,
+                                    size_t layouts_size)
 {
-    xmlNode *node = NULL;
-    struct rxkb_iso639_code *code;
+    return find_layouts_by_code(ctx, &ctx->iso639_index, code,
+                                layouts_out, layouts_size);
+}
 
-    for (node = language_list->children; node; node = node->next) {
-        if (is_node(node, "iso639Id")) {
-            char *str = extract_text(node);
-            struct rxkb_object *parent;
+XKB_EXPORT size_t
+rxkb_context_find_layouts_by_iso3166(struct rxkb_context *ctx,
+                                     const char *code,
+                                     struct rxkb_layout **layouts_out,
+                                     size_t layouts_size)
+{
+    return find_layouts_by_code(ctx, &ctx->iso3166_index, code,
+                                layouts_out, layouts_size);
+}
 
-            if (!str || strlen(str) != 3) {
-                free(str);
-                continue;
-            }
+/*
+ * An item of a rules XML file. The XML parser records the items of a file
+ * in order, in a compact serialized form; once the whole file has been
+ * read, they are replayed into the context by registry_add(). A cache
+ * file holds the same record.
+ *
+ * Variants belong to the last layout, and options to the last group.
+ */
+enum registry_item_type {
+    ITEM_MODEL = 1,
+    ITEM_LAYOUT,
+    ITEM_VARIANT,
+    ITEM_OPTION_GROUP,
+    ITEM_OPTION,
+};
 
-            parent = &layout->base;
-            code = rxkb_iso639_code_create(parent);
-            code->code = str;
-            list_append(&layout->iso639s, &code->base.link);
-        }
+/* The ISO codes of a layout or variant. */
+struct iso_codes {
+    /* Whether the item has such a list; variants inherit it otherwise. */
+    bool found;
+    darray(const char *) codes;
+};
+
+/*
+ * The strings belong to the XML parser, or to the record being replayed;
+ * registry_add() interns the ones it keeps.
+ */
+struct registry_item {
+    enum registry_item_type type;
+    const char *name;
+    const char *description;
+    const char *brief;
+    const char *vendor;
+    bool allow_multiple;
+    struct iso_codes iso639;
+    struct iso_codes iso3166;
+};
+
+struct registry_parser {
+    struct rxkb_context *ctx;
+    enum rxkb_popularity popularity;
+    /* Where the variants and the options go. */
+    struct rxkb_layout *layout;
+    struct rxkb_option_group *group;
+};
+
+static void
+add_iso639_codes(struct rxkb_context *ctx, struct rxkb_layout *layout,
+                 const struct iso_codes *codes)
+{
+    const char **str;
+
+    darray_foreach(str, codes->codes) {
+        struct rxkb_iso639_code *code = rxkb_iso639_code_create(&layout->base);
+        code->code = rxkb_intern(ctx, *str);
+        list_append(&layout->iso639s, &code->base.link);
+        rxkb_index_add_code(ctx, &ctx->iso639_index, code->code, layout);
+    }
+}
+
+static void
+add_iso3166_codes(struct rxkb_context *ctx, struct rxkb_layout *layout,
+                  const struct iso_codes *codes)
+{
+    const char **str;
+
+    darray_foreach(str, codes->codes) {
+        struct rxkb_iso3166_code *code =
+            rxkb_iso3166_code_create(&layout->base);
+        code->code = rxkb_intern(ctx, *str);
+        list_append(&layout->iso3166s, &code->base.link);
+        rxkb_index_add_code(ctx, &ctx->iso3166_index, code->code, layout);
     }
 }
 
 static void
-parse_country_list(xmlNode *country_list, struct rxkb_layout *layout)
+add_model(struct registry_parser *p, const struct registry_item *item)
 {
-    xmlNode *node = NULL;
-    struct rxkb_iso3166_code *code;
+    const char *name = rxkb_intern(p->ctx, item->name);
+    struct rxkb_model *m;
 
-    for (node = country_list->children; node; node = node->next) {
-        if (is_node(node, "iso3166Id")) {
-            char *str = extract_text(node);
-            struct rxkb_object *parent;
+    if (rxkb_index_find(&p->ctx->model_index, name, NULL))
+        return;
 
-            if (!str || strlen(str) != 2) {
-                free(str);
-                continue;
-            }
+    /* new model */
+    m = rxkb_model_create(&p->ctx->base);
+    m->name = name;
+    m->description = rxkb_intern(p->ctx, item->description);
+    m->vendor = rxkb_intern(p->ctx, item->vendor);
+    m->popularity = p->popularity;
+    list_append(&p->ctx->models, &m->base.link);
+    rxkb_index_add(&p->ctx->model_index, name, NULL, m);
+}
 
-            parent = &layout->base;
-            code = rxkb_iso3166_code_create(parent);
-            code->code = str;
-            list_append(&layout->iso3166s, &code->base.link);
-        }
+static void
+add_layout(struct registry_parser *p, const struct registry_item *item)
+{
+    const char *name = rxkb_intern(p->ctx, item->name);
+    struct rxkb_layout *l;
+
+    l = rxkb_index_find(&p->ctx->layout_index, name, NULL);
+    if (l) {
+        p->layout = l;
+        return;
     }
+
+    l = rxkb_layout_create(&p->ctx->base);
+    list_init(&l->iso639s);
+    list_init(&l->iso3166s);
+    l->name = name;
+    l->variant = NULL;
+    l->description = rxkb_intern(p->ctx, item->description);
+    l->brief = rxkb_intern(p->ctx, item->brief);
+    l->popularity = p->popularity;
+    add_iso639_codes(p->ctx, l, &item->iso639);
+    add_iso3166_codes(p->ctx, l, &item->iso3166);
+    list_append(&p->ctx->layouts, &l->base.link);
+    rxkb_index_add(&p->ctx->layout_index, name, NULL, l);
+    p->layout = l;
 }
 
 static void
-parse_variant(struct rxkb_context *ctx, struct rxkb_layout *l,
-              xmlNode *variant, enum rxkb_popularity popularity)
+add_variant(struct registry_parser *p, const struct registry_item *item)
 {
-    xmlNode *ci;
-    char *name, *description, *brief, *vendor;
+    struct rxkb_layout *l = p->layout;
+    const char *name;
+    struct rxkb_layout *v;
 
-    if (parse_config_item(ctx, variant, &name, &description, &brief, &vendor)) {
-        struct rxkb_layout *v;
-        bool exists = false;
+    if (!l)
+        return;
 
-        list_for_each(v, &ctx->layouts, base.link) {
-            if (streq(v->name, name) && streq(v->name, l->name)) {
-                exists = true;
-                break;
-            }
-        }
+    name = rxkb_intern(p->ctx, item->name);
+    if (rxkb_index_find(&p->ctx->layout_index, l->name, name))
+        return;
 
-        if (!exists) {
-            v = rxkb_layout_create(&ctx->base);
-            list_init(&v->iso639s);
-            list_init(&v->iso3166s);
-            v->name = strdup(l->name);
-            v->variant = name;
-            v->description = description;
-            // if variant omits brief, inherit from parent layout.
-            v->brief = brief == NULL ? strdup_safe(l->brief) : brief;
-            v->popularity = popularity;
-            list_append(&ctx->layouts, &v->base.link);
-
-            for (ci = variant->children; ci; ci = ci->next) {
-                xmlNode *node;
-
-                if (!is_node(ci, "configItem"))
-                    continue;
-
-                bool found_language_list = false;
-                bool found_country_list = false;
-                for (node = ci->children; node; node = node->next) {
-                    if (is_node(node, "languageList")) {
-                        parse_language_list(node, v);
-                        found_language_list = true;
-                    }
-                    if (is_node(node, "countryList")) {
-                        parse_country_list(node, v);
-                        found_country_list = true;
-                    }
-                }
-                if (!found_language_list) {
-                    // inherit from parent layout
-                    struct rxkb_iso639_code* x;
-                    list_for_each(x, &l->iso639s, base.link) {
-                        struct rxkb_iso639_code* code = rxkb_iso639_code_create(&v->base);
-                        code->code = strdup(x->code);
-                        list_append(&v->iso639s, &code->base.link);
-                    }
-                }
-                if (!found_country_list) {
-                    // inherit from parent layout
-                    struct rxkb_iso3166_code* x;
-                    list_for_each(x, &l->iso3166s, base.link) {
-                        struct rxkb_iso3166_code* code = rxkb_iso3166_code_create(&v->base);
-                        code->code = strdup(x->code);
-                        list_append(&v->iso3166s, &code->base.link);
-                    }
-                }
-            }
-        } else {
-            free(name);
-            free(description);
-            free(brief);
-            free(vendor);
+    v = rxkb_layout_create(&p->ctx->base);
+    list_init(&v->iso639s);
+    list_init(&v->iso3166s);
+    v->name = l->name;
+    v->variant = name;
+    v->description = rxkb_intern(p->ctx, item->description);
+    // if variant omits brief, inherit from parent layout.
+    v->brief = item->brief ? rxkb_intern(p->ctx, item->brief) : l->brief;
+    v->popularity = p->popularity;
+    list_append(&p->ctx->layouts, &v->base.link);
+    rxkb_index_add(&p->ctx->layout_index, v->name, name, v);
+
+    if (item->iso639.found) {
+        add_iso639_codes(p->ctx, v, &item->iso639);
+    }
+    else {
+        // inherit from parent layout
+        struct rxkb_iso639_code* x;
+        list_for_each(x, &l->iso639s, base.link) {
+            struct rxkb_iso639_code* code = rxkb_iso639_code_create(&v->base);
+            code->code = x->code;
+            list_append(&v->iso639s, &code->base.link);
+            rxkb_index_add_code(p->ctx, &p->ctx->iso639_index, x->code, v);
+        }
+    }
+    if (item->iso3166.found) {
+        add_iso3166_codes(p->ctx, v, &item->iso3166);
+    }
+    else {
+        // inherit from parent layout
+        struct rxkb_iso3166_code* x;
+        list_for_each(x, &l->iso3166s, base.link) {
+            struct rxkb_iso3166_code* code = rxkb_iso3166_code_create(&v->base);
+            code->code = x->code;
+            list_append(&v->iso3166s, &code->base.link);
+            rxkb_index_add_code(p->ctx, &p->ctx->iso3166_index, x->code, v);
         }
     }
 }
 
 static void
-parse_variant_list(struct rxkb_context *ctx, struct rxkb_layout *l,
-                   xmlNode *variant_list, enum rxkb_popularity popularity)
+add_option_group(struct registry_parser *p, const struct registry_item *item)
 {
-    xmlNode *node = NULL;
+    const char *name = rxkb_intern(p->ctx, item->name);
+    struct rxkb_option_group *g;
 
-    for (node = variant_list->children; node; node = node->next) {
-        if (is_node(node, "variant"))
-            parse_variant(ctx, l, node, popularity);
+    g = rxkb_index_find(&p->ctx->group_index, name, NULL);
+    if (g) {
+        p->group = g;
+        return;
     }
+
+    g = rxkb_option_group_create(&p->ctx->base);
+    g->name = name;
+    g->description = rxkb_intern(p->ctx, item->description);
+    g->popularity = p->popularity;
+    g->allow_multiple = item->allow_multiple;
+    list_init(&g->options);
+    list_append(&p->ctx->option_groups, &g->base.link);
+    rxkb_index_add(&p->ctx->group_index, name, NULL, g);
+    p->group = g;
 }
 
 static void
-parse_layout(struct rxkb_context *ctx, xmlNode *layout,
-             enum rxkb_popularity popularity)
+add_option(struct registry_parser *p, const struct registry_item *item)
 {
-    char *name, *description, *brief, *vendor;
-    struct rxkb_layout *l;
-    xmlNode *node = NULL;
-    bool exists = false;
+    struct rxkb_option_group *group = p->group;
+    const char *name;
+    struct rxkb_option *o;
 
-    if (!parse_config_item(ctx, layout, &name, &description, &brief, &vendor))
+    if (!group)
         return;
 
-    list_for_each(l, &ctx->layouts, base.link) {
-        if (streq(l->name, name) && l->variant == NULL) {
-            exists = true;
-            break;
-        }
-    }
+    name = rxkb_intern(p->ctx, item->name);
+    if (rxkb_index_find(&p->ctx->group_option_index, group->name, name))
+        return;
 
-    if (!exists) {
-        l = rxkb_layout_create(&ctx->base);
-        list_init(&l->iso639s);
-        list_init(&l->iso3166s);
-        l->name = name;
-        l->variant = NULL;
-        l->description = description;
-        l->brief = brief;
-        l->popularity = popularity;
-        list_append(&ctx->layouts, &l->base.link);
-    } else {
-        free(name);
-        free(description);
-        free(brief);
-        free(vendor);
-    }
+    o = rxkb_option_create(&group->base);
+    o->name = name;
+    o->description = rxkb_intern(p->ctx, item->description);
+    o->popularity = p->popularity;
+    list_append(&group->options, &o->base.link);
+    rxkb_index_add(&p->ctx->group_option_index, group->name, name, o);
+    /* The same option may be in several groups; the first one wins */
+    if (!rxkb_index_find(&p->ctx->option_index, name, NULL))
+        rxkb_index_add(&p->ctx->option_index, name, NULL, o);
+}
 
-    for (node = layout->children; node; node = node->next) {
-        if (is_node(node, "variantList")) {
-            parse_variant_list(ctx, l, node, popularity);
-        }
-        if (!exists && is_node(node, "configItem")) {
-            xmlNode *ll;
-            for (ll = node->children; ll; ll = ll->next) {
-                if (is_node(ll, "languageList"))
-                    parse_language_list(ll, l);
-                if (is_node(ll, "countryList"))
-                    parse_country_list(ll, l);
-            }
-        }
-    }
+static void
+record_string(darray_char *record, const char *str)
+{
+    uint32_t len = str ? strlen(str) : UINT32_MAX;
+
+    darray_append_items(*record, (const char *) &len, sizeof(len));
+    if (str)
+        darray_append_items(*record, str, len + 1);
 }
 
 static void
-parse_layout_list(struct rxkb_context *ctx, xmlNode *layout_list,
-                  enum rxkb_popularity popularity)
+record_iso_codes(darray_char *record, const struct iso_codes *codes)
 {
-    xmlNode *node = NULL;
+    uint32_t count = darray_size(codes->codes);
+    const char **code;
 
-    for (node = layout_list->children; node; node = node->next) {
-        if (is_node(node, "layout"))
-            parse_layout(ctx, node, popularity);
-    }
+    darray_append(*record, (char) codes->found);
+    darray_append_items(*record, (const char *) &count, sizeof(count));
+    darray_foreach(code, codes->codes)
+        record_string(record, *code);
 }
 
 static void
-parse_option(struct rxkb_context *ctx, struct rxkb_option_group *group,
-             xmlNode *option, enum rxkb_popularity popularity)
-{
-    char *name, *description, *brief, *vendor;
-
-    if (parse_config_item(ctx, option, &name, &description, &brief, &vendor)) {
-        struct rxkb_option *o;
-
-        list_for_each(o, &group->options, base.link) {
-            if (streq(o->name, name)) {
-                free(name);
-                free(description);
-                free(brief);
-                free(vendor);
-                return;
-            }
-        }
+record_item(darray_char *record, const struct registry_item *item)
+{
+    darray_append(*record, (char) item->type);
+    darray_append(*record, (char) item->allow_multiple);
+    record_string(record, item->name);
+    record_string(record, item->description);
+    record_string(record, item->brief);
+    record_string(record, item->vendor);
+    record_iso_codes(record, &item->iso639);
+    record_iso_codes(record, &item->iso3166);
+}
 
-        o = rxkb_option_create(&group->base);
-        o->name = name;
-        o->description = description;
-        o->popularity = popularity;
-        list_append(&group->options, &o->base.link);
+/*
+ * Merge an item into the context. Data from previously loaded files is
+ * never overwritten. Takes the strings the item ends up using; the
+ * caller frees the item.
+ */
+static void
+registry_add(struct registry_parser *p, struct registry_item *item)
+{
+    switch (item->type) {
+    case ITEM_MODEL:
+        add_model(p, item);
+        break;
+    case ITEM_LAYOUT:
+        add_layout(p, item);
+        break;
+    case ITEM_VARIANT:
+        add_variant(p, item);
+        break;
+    case ITEM_OPTION_GROUP:
+        add_option_group(p, item);
+        break;
+    case ITEM_OPTION:
+        add_option(p, item);
+        break;
     }
 }
 
-static void
-parse_group(struct rxkb_context *ctx, xmlNode *group,
-            enum rxkb_popularity popularity)
+struct record_reader {
+    const char *pos;
+    const char *end;
+};
+
+static bool
+record_read_u8(struct record_reader *r, uint8_t *v)
 {
-    char *name, *description, *brief, *vendor;
-    struct rxkb_option_group *g;
-    xmlNode *node = NULL;
-    xmlChar *multiple;
-    bool exists = false;
+    if (r->pos >= r->end)
+        return false;
+    *v = (uint8_t) *r->pos++;
+    return true;
+}
 
-    if (!parse_config_item(ctx, group, &name, &description, &brief, &vendor))
-        return;
+static bool
+record_read_u32(struct record_reader *r, uint32_t *v)
+{
+    if (r->end - r->pos < (ptrdiff_t) sizeof(*v))
+        return false;
+    memcpy(v, r->pos, sizeof(*v));
+    r->pos += sizeof(*v);
+    return true;
+}
 
-    list_for_each(g, &ctx->option_groups, base.link) {
-        if (streq(g->name, name)) {
-            exists = true;
-            break;
-        }
+/* Sets @out to NULL for a NULL string, or to the string in the record. */
+static bool
+record_read_string(struct record_reader *r, const char **out)
+{
+    uint32_t len;
+
+    if (!record_read_u32(r, &len))
+        return false;
+
+    if (len == UINT32_MAX) {
+        *out = NULL;
+        return true;
     }
 
-    if (!exists) {
-        g = rxkb_option_group_create(&ctx->base);
-        g->name = name;
-        g->description = description;
-        g->popularity = popularity;
+    if ((size_t) (r->end - r->pos) <= len || r->pos[len] != '\0')
+        return false;
 
-        multiple = xmlGetProp(group, (const xmlChar*)"allowMultipleSelection");
-        if (multiple && xmlStrEqual(multiple, (const xmlChar*)"true"))
-            g->allow_multiple = true;
-        xmlFree(multiple);
+    *out = r->pos;
+    r->pos += len + 1;
+    return true;
+}
 
-        list_init(&g->options);
-        list_append(&ctx->option_groups, &g->base.link);
-    } else {
-        free(name);
-        free(description);
-        free(brief);
-        free(vendor);
-    }
+static bool
+record_read_iso_codes(struct record_reader *r, struct iso_codes *codes)
+{
+    uint8_t found;
+    uint32_t count;
+
+    if (!record_read_u8(r, &found) || !record_read_u32(r, &count))
+        return false;
 
-    for (node = group->children; node; node = node->next) {
-        if (is_node(node, "option"))
-            parse_option(ctx, g, node, popularity);
+    codes->found = found;
+    for (uint32_t i = 0; i < count; i++) {
+        const char *code;
+
+        if (!record_read_string(r, &code) || !code)
+            return false;
+        darray_append(codes->codes, code);
     }
+
+    return true;
+}
+
+/* Read the next item. Its strings point into the record. */
+static bool
+record_read_item(struct record_reader *r, struct registry_item *item)
+{
+    uint8_t type, allow_multiple;
+    const char *strs[4];
+
+    if (!record_read_u8(r, &type) || !record_read_u8(r, &allow_multiple))
+        return false;
+    if (type < ITEM_MODEL || type > ITEM_OPTION)
+        return false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(strs); i++)
+        if (!record_read_string(r, &strs[i]))
+            return false;
+    if (!strs[0])
+        return false;
+
+    item->type = type;
+    item->allow_multiple = allow_multiple;
+    item->name = strs[0];
+    item->description = strs[1];
+    item->brief = strs[2];
+    item->vendor = strs[3];
+
+    return record_read_iso_codes(r, &item->iso639) &&
+           record_read_iso_codes(r, &item->iso3166);
 }
 
 static void
-parse_option_list(struct rxkb_context *ctx, xmlNode *option_list,
-                  enum rxkb_popularity popularity)
+record_item_free(struct registry_item *item)
+{
+    darray_free(item->iso639.codes);
+    darray_free(item->iso3166.codes);
+}
+
+static bool
+record_check(const char *start, const char *end)
 {
-    xmlNode *node = NULL;
+    struct record_reader r = { start, end };
+
+    while (r.pos < r.end) {
+        struct registry_item item = { 0 };
+        bool ok = record_read_item(&r, &item);
 
-    for (node = option_list->children; node; node = node->next) {
-        if (is_node(node, "group"))
-            parse_group(ctx, node, popularity);
+        record_item_free(&item);
+        if (!ok)
+            return false;
     }
+
+    return true;
 }
 
+/* Merge a record into the context. The record must have been checked. */
 static void
-parse_rules_xml(struct rxkb_context *ctx, xmlNode *root,
-                enum rxkb_popularity popularity)
-{
-    xmlNode *node = NULL;
-
-    for (node = root->children; node; node = node->next) {
-        if (is_node(node, "modelList"))
-            parse_model_list(ctx, node, popularity);
-        else if (is_node(node, "layoutList"))
-            parse_layout_list(ctx, node, popularity);
-        else if (is_node(node, "optionList"))
-            parse_option_list(ctx, node, popularity);
+registry_replay(struct registry_parser *p, const char *start, const char *end)
+{
+    struct record_reader r = { start, end };
+
+    while (r.pos < r.end) {
+        struct registry_item item = { 0 };
+
+        record_read_item(&r, &item);
+        registry_add(p, &item);
+        record_item_free(&item);
     }
 }
 
@@ -1139,99 +1477,534 @@ xml_error_func(void *ctx, const char *msg, ...)
     }
 }
 
+/*
+ * The XML parser streams through the file with an xmlTextReader, and
+ * records the items as their configItem elements end. Instead of the
+ * full DTD, the structure is checked with the parent of each element:
+ * this is all we need to know which layout a variant belongs to.
+ */
+enum xml_element {
+    ELEM_NONE,
+    ELEM_REGISTRY,
+    ELEM_MODEL_LIST,
+    ELEM_MODEL,
+    ELEM_LAYOUT_LIST,
+    ELEM_LAYOUT,
+    ELEM_VARIANT_LIST,
+    ELEM_VARIANT,
+    ELEM_OPTION_LIST,
+    ELEM_GROUP,
+    ELEM_OPTION,
+    ELEM_CONFIG_ITEM,
+    ELEM_NAME,
+    ELEM_SHORT_DESCRIPTION,
+    ELEM_DESCRIPTION,
+    ELEM_VENDOR,
+    ELEM_COUNTRY_LIST,
+    ELEM_ISO3166_ID,
+    ELEM_LANGUAGE_LIST,
+    ELEM_ISO639_ID,
+    ELEM_HW_LIST,
+    ELEM_HW_ID,
+};
+
+static const struct {
+    const char *name;
+    /* ELEM_NONE for the root element, and for configItem, see below */
+    enum xml_element parent;
+} xml_elements[] = {
+    [ELEM_REGISTRY] = { "xkbConfigRegistry", ELEM_NONE },
+    [ELEM_MODEL_LIST] = { "modelList", ELEM_REGISTRY },
+    [ELEM_MODEL] = { "model", ELEM_MODEL_LIST },
+    [ELEM_LAYOUT_LIST] = { "layoutList", ELEM_REGISTRY },
+    [ELEM_LAYOUT] = { "layout", ELEM_LAYOUT_LIST },
+    [ELEM_VARIANT_LIST] = { "variantList", ELEM_LAYOUT },
+    [ELEM_VARIANT] = { "variant", ELEM_VARIANT_LIST },
+    [ELEM_OPTION_LIST] = { "optionList", ELEM_REGISTRY },
+    [ELEM_GROUP] = { "group", ELEM_OPTION_LIST },
+    [ELEM_OPTION] = { "option", ELEM_GROUP },
+    [ELEM_CONFIG_ITEM] = { "configItem", ELEM_NONE },
+    [ELEM_NAME] = { "name", ELEM_CONFIG_ITEM },
+    [ELEM_SHORT_DESCRIPTION] = { "shortDescription", ELEM_CONFIG_ITEM },
+    [ELEM_DESCRIPTION] = { "description", ELEM_CONFIG_ITEM },
+    [ELEM_VENDOR] = { "vendor", ELEM_CONFIG_ITEM },
+    [ELEM_COUNTRY_LIST] = { "countryList", ELEM_CONFIG_ITEM },
+    [ELEM_ISO3166_ID] = { "iso3166Id", ELEM_COUNTRY_LIST },
+    [ELEM_LANGUAGE_LIST] = { "languageList", ELEM_CONFIG_ITEM },
+    [ELEM_ISO639_ID] = { "iso639Id", ELEM_LANGUAGE_LIST },
+    [ELEM_HW_LIST] = { "hwList", ELEM_CONFIG_ITEM },
+    [ELEM_HW_ID] = { "hwId", ELEM_HW_LIST },
+};
+
+/* The deepest element is iso639Id in a variant. */
+#define XML_MAX_DEPTH 8
+
+struct xml_parser {
+    struct rxkb_context *ctx;
+    xmlTextReader *reader;
+    darray_char *record;
+
+    struct {
+        enum xml_element elem;
+        /* For items: whether we had the configItem. */
+        bool has_config_item;
+    } stack[XML_MAX_DEPTH];
+    unsigned depth;
+
+    /* The configItem being read. */
+    struct registry_item item;
+    /* The allowMultipleSelection attribute of the current group. */
+    bool allow_multiple;
+    /* The current layout or group is invalid: skip its children. */
+    bool skip_children;
+};
+
+static enum registry_item_type
+item_type(enum xml_element elem)
+{
+    switch (elem) {
+    case ELEM_MODEL:
+        return ITEM_MODEL;
+    case ELEM_LAYOUT:
+        return ITEM_LAYOUT;
+    case ELEM_VARIANT:
+        return ITEM_VARIANT;
+    case ELEM_GROUP:
+        return ITEM_OPTION_GROUP;
+    case ELEM_OPTION:
+        return ITEM_OPTION;
+    default:
+        return 0;
+    }
+}
+
+static enum xml_element
+xml_element_lookup(const char *name)
+{
+    for (enum xml_element e = ELEM_REGISTRY; e < ARRAY_SIZE(xml_elements); e++)
+        if (streq(xml_elements[e].name, name))
+            return e;
+    return ELEM_NONE;
+}
+
+static int
+xml_line(struct xml_parser *x)
+{
+    return xmlGetLineNo(xmlTextReaderCurrentNode(x->reader));
+}
+
+/* Replace @text with the text content of the current element. */
+static void
+xml_item_free(struct registry_item *item)
+{
+    const char **code;
+
+    free((char *) item->name);
+    free((char *) item->description);
+    free((char *) item->brief);
+    free((char *) item->vendor);
+    darray_foreach(code, item->iso639.codes)
+        free((char *) *code);
+    darray_free(item->iso639.codes);
+    darray_foreach(code, item->iso3166.codes)
+        free((char *) *code);
+    darray_free(item->iso3166.codes);
+}
+
+static void
+xml_read_text(struct xml_parser *x, const char **text)
+{
+    free((char *) *text);
+    *text = (const char *) xmlTextReaderReadString(x->reader);
+}
+
+static void
+xml_read_code(struct xml_parser *x, struct iso_codes *codes, size_t len)
+{
+    char *code = (char *) xmlTextReaderReadString(x->reader);
+
+    if (!code || strlen(code) != len) {
+        free(code);
+        return;
+    }
+
+    darray_append(codes->codes, code);
+}
+
 static bool
-validate(struct rxkb_context *ctx, xmlDoc *doc)
+xml_start_element(struct xml_parser *x)
 {
-    bool success = false;
-    xmlValidCtxt *dtdvalid = NULL;
-    xmlDtd *dtd = NULL;
-    xmlParserInputBufferPtr buf = NULL;
-    /* This is a modified version of the xkeyboard-config xkb.dtd. That one
-     * requires modelList, layoutList and optionList, we
-     * allow for any of those to be missing.
-     */
-    const char dtdstr[] =
-        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-        "<!ELEMENT xkbConfigRegistry (modelList?, layoutList?, optionList?)>\n"
-        "<!ATTLIST xkbConfigRegistry version CDATA \"1.1\">\n"
-        "<!ELEMENT modelList (model*)>\n"
-        "<!ELEMENT model (configItem)>\n"
-        "<!ELEMENT layoutList (layout*)>\n"
-        "<!ELEMENT layout (configItem,  variantList?)>\n"
-        "<!ELEMENT optionList (group*)>\n"
-        "<!ELEMENT variantList (variant*)>\n"
-        "<!ELEMENT variant (configItem)>\n"
-        "<!ELEMENT group (configItem, option*)>\n"
-        "<!ATTLIST group allowMultipleSelection (true|false) \"false\">\n"
-        "<!ELEMENT option (configItem)>\n"
-        "<!ELEMENT configItem (name, shortDescription?, description?, vendor?, countryList?, languageList?, hwList?)>\n"
-        "<!ATTLIST configItem popularity (standard|exotic) \"standard\">\n"
-        "<!ELEMENT name (#PCDATA)>\n"
-        "<!ELEMENT shortDescription (#PCDATA)>\n"
-        "<!ELEMENT description (#PCDATA)>\n"
-        "<!ELEMENT vendor (#PCDATA)>\n"
-        "<!ELEMENT countryList (iso3166Id+)>\n"
-        "<!ELEMENT iso3166Id (#PCDATA)>\n"
-        "<!ELEMENT languageList (iso639Id+)>\n"
-        "<!ELEMENT iso639Id (#PCDATA)>\n"
-        "<!ELEMENT hwList (hwId+)>\n"
-        "<!ELEMENT hwId (#PCDATA)>\n";
-
-    /* Note: do not use xmlParserInputBufferCreateStatic, it generates random
-     * DTD validity errors for unknown reasons */
-    buf = xmlParserInputBufferCreateMem(dtdstr, sizeof(dtdstr),
-                                        XML_CHAR_ENCODING_UTF8);
-    if (!buf)
-        return false;
+    const char *name = (const char *) xmlTextReaderConstLocalName(x->reader);
+    enum xml_element parent = x->depth ?
+                              x->stack[x->depth - 1].elem : ELEM_NONE;
+    enum xml_element elem = xml_element_lookup(name);
+    bool allowed;
+
+    if (elem == ELEM_CONFIG_ITEM)
+        allowed = item_type(parent) != 0;
+    else if (elem == ELEM_VARIANT_LIST || elem == ELEM_OPTION)
+        /* Where the configItem comes first, as in the DTD. */
+        allowed = xml_elements[elem].parent == parent &&
+                  x->stack[x->depth - 1].has_config_item;
+    else
+        allowed = elem != ELEM_NONE && xml_elements[elem].parent == parent;
 
-    dtd = xmlIOParseDTD(NULL, buf, XML_CHAR_ENCODING_UTF8);
-    if (!dtd) {
-        log_err(ctx, "Failed to load DTD\n");
+    if (!allowed) {
+        log_err(x->ctx, "xml:%d: unexpected element '%s'\n",
+                xml_line(x), name);
         return false;
     }
 
-    dtdvalid = xmlNewValidCtxt();
-    if (xmlValidateDtd(dtdvalid, doc, dtd))
-        success = true;
+    assert(x->depth < XML_MAX_DEPTH);
+    x->stack[x->depth].elem = elem;
+    x->stack[x->depth].has_config_item = false;
+    x->depth++;
+
+    switch (elem) {
+    case ELEM_LAYOUT:
+        x->skip_children = false;
+        break;
+    case ELEM_GROUP: {
+        xmlChar *multiple;
+
+        x->skip_children = false;
+        multiple = xmlTextReaderGetAttribute(x->reader,
+                                    (const xmlChar *) "allowMultipleSelection");
+        x->allow_multiple = multiple &&
+                            xmlStrEqual(multiple, (const xmlChar *) "true");
+        xmlFree(multiple);
+        break;
+    }
+    case ELEM_CONFIG_ITEM:
+        if (x->stack[x->depth - 2].has_config_item) {
+            log_err(x->ctx, "xml:%d: duplicate element 'configItem'\n",
+                    xml_line(x));
+            return false;
+        }
+        x->stack[x->depth - 2].has_config_item = true;
+        x->item.type = item_type(parent);
+        x->item.allow_multiple = parent == ELEM_GROUP && x->allow_multiple;
+        break;
+    case ELEM_NAME:
+        xml_read_text(x, &x->item.name);
+        break;
+    case ELEM_SHORT_DESCRIPTION:
+        xml_read_text(x, &x->item.brief);
+        break;
+    case ELEM_DESCRIPTION:
+        xml_read_text(x, &x->item.description);
+        break;
+    case ELEM_VENDOR:
+        /* Note: the DTD allows for vendor + brief but models only use
+         * vendor and everything else only uses shortDescription */
+        xml_read_text(x, &x->item.vendor);
+        break;
+    case ELEM_COUNTRY_LIST:
+        x->item.iso3166.found = true;
+        break;
+    case ELEM_ISO3166_ID:
+        xml_read_code(x, &x->item.iso3166, 2);
+        break;
+    case ELEM_LANGUAGE_LIST:
+        x->item.iso639.found = true;
+        break;
+    case ELEM_ISO639_ID:
+        xml_read_code(x, &x->item.iso639, 3);
+        break;
+    default:
+        break;
+    }
 
-    if (dtd)
-        xmlFreeDtd(dtd);
-    if (dtdvalid)
-        xmlFreeValidCtxt(dtdvalid);
+    return true;
+}
 
-    return success;
+static bool
+xml_end_element(struct xml_parser *x)
+{
+    struct registry_item *item = &x->item;
+
+    x->depth--;
+
+    switch (x->stack[x->depth].elem) {
+    case ELEM_MODEL:
+    case ELEM_LAYOUT:
+    case ELEM_VARIANT:
+    case ELEM_GROUP:
+    case ELEM_OPTION:
+        if (!x->stack[x->depth].has_config_item) {
+            log_err(x->ctx, "xml:%d: missing required element 'configItem'\n",
+                    xml_line(x));
+            return false;
+        }
+        break;
+    case ELEM_CONFIG_ITEM:
+        if (!item->name || !strlen(item->name)) {
+            log_err(x->ctx, "xml:%d: missing required element 'name'\n",
+                    xml_line(x));
+            if (item->type == ITEM_LAYOUT || item->type == ITEM_OPTION_GROUP)
+                x->skip_children = true;
+        }
+        else if (!x->skip_children ||
+                 (item->type != ITEM_VARIANT && item->type != ITEM_OPTION)) {
+            record_item(x->record, item);
+        }
+        xml_item_free(item);
+        *item = (struct registry_item) { 0 };
+        break;
+    default:
+        break;
+    }
+
+    return true;
 }
 
+/* Parse a rules XML file into a record of its items. */
 static bool
-parse(struct rxkb_context *ctx, const char *path,
-      enum rxkb_popularity popularity)
+parse_xml(struct rxkb_context *ctx, const char *path, darray_char *record)
 {
+    struct xml_parser x = {
+        .ctx = ctx,
+        .record = record,
+    };
     bool success = false;
-    xmlDoc *doc = NULL;
-    xmlNode *root = NULL;
-
-    if (!check_eaccess(path, R_OK))
-        return false;
+    bool has_root = false;
+    int ret;
 
     LIBXML_TEST_VERSION
 
     xmlSetGenericErrorFunc(ctx, xml_error_func);
 
-    doc = xmlParseFile(path);
-    if (!doc)
+    x.reader = xmlReaderForFile(path, NULL, 0);
+    if (!x.reader)
         return false;
 
-    if (!validate(ctx, doc)) {
+    while ((ret = xmlTextReaderRead(x.reader)) == 1) {
+        switch (xmlTextReaderNodeType(x.reader)) {
+        case XML_READER_TYPE_ELEMENT:
+            if (!xml_start_element(&x))
+                goto error;
+            has_root = true;
+            if (xmlTextReaderIsEmptyElement(x.reader) &&
+                !xml_end_element(&x))
+                goto error;
+            break;
+        case XML_READER_TYPE_END_ELEMENT:
+            if (!xml_end_element(&x))
+                goto error;
+            break;
+        default:
+            break;
+        }
+    }
+
+    success = ret == 0 && has_root;
+error:
+    if (!success)
         log_err(ctx, "XML error: failed to validate document at %s\n", path);
-        goto error;
+    xml_item_free(&x.item);
+    xmlFreeTextReader(x.reader);
+
+    return success;
+}
+
+/*
+ * The registry cache: a cache file holds the record of one rules XML file,
+ * after a header identifying the source file. If the source file changes,
+ * the cache is rebuilt. A source file modified in the second it is read is
+ * not cached, as it could change again without its mtime changing.
+ */
+#define CACHE_MAGIC "RXKBCACH"
+#define CACHE_VERSION 2
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t path_len;      /* followed by the source path, no NUL */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    int64_t ctime;
+    int64_t ctime_nsec;
+    uint64_t record_size;   /* follows the path */
+    uint32_t record_hash;
+    uint32_t unused;        /* no padding, always 0 */
+};
+
+/* The source file identification of a cache header. */
+static void
+cache_header_set_stat(struct cache_header *header, const struct stat *st)
+{
+    header->dev = st->st_dev;
+    header->ino = st->st_ino;
+    header->size = st->st_size;
+    header->mtime = st->st_mtime;
+    header->ctime = st->st_ctime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    header->mtime_nsec = st->st_mtim.tv_nsec;
+    header->ctime_nsec = st->st_ctim.tv_nsec;
+#else
+    header->mtime_nsec = header->ctime_nsec = 0;
+#endif
+}
+
+static bool
+cache_file_path(struct rxkb_context *ctx, const char *path,
+                char *buf, size_t sz)
+{
+    uint32_t hash = hash_buf(path, strlen(path));
+
+    return snprintf_safe(buf, sz, "%s/rxkb-%08x.cache",
+                         ctx->cache_dir, hash);
+}
+
+static bool
+cache_load(struct registry_parser *p, const char *cache_path,
+           const char *path, const struct stat *st)
+{
+    FILE *file;
+    char *data;
+    size_t size;
+    struct cache_header header;
+    struct cache_header expected;
+    const char *items;
+    bool ok;
+
+    file = fopen(cache_path, "rb");
+    if (!file)
+        return false;
+
+    ok = map_file(file, &data, &size);
+    fclose(file);
+    if (!ok)
+        return false;
+
+    ok = false;
+    if (size < sizeof(header))
+        goto out;
+
+    memcpy(&header, data, sizeof(header));
+    cache_header_set_stat(&expected, st);
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.dev != expected.dev ||
+        header.ino != expected.ino ||
+        header.size != expected.size ||
+        header.mtime != expected.mtime ||
+        header.mtime_nsec != expected.mtime_nsec ||
+        header.ctime != expected.ctime ||
+        header.ctime_nsec != expected.ctime_nsec ||
+        header.path_len != strlen(path) ||
+        size - sizeof(header) < header.path_len ||
+        memcmp(data + sizeof(header), path, header.path_len) != 0)
+        goto out;
+
+    /* Check the whole file first, so we never merge half of it. */
+    items = data + sizeof(header) + header.path_len;
+    if (header.record_size != (uint64_t) (data + size - items) ||
+        header.record_hash != hash_buf(items, header.record_size)) {
+        log_dbg(p->ctx, "Ignoring the corrupted cache file %s\n",
+                cache_path);
+        goto out;
     }
+    if (!record_check(items, data + size))
+        goto out;
 
-    root = xmlDocGetRootElement(doc);
-    parse_rules_xml(ctx, root, popularity);
+    registry_replay(p, items, data + size);
 
-    success = true;
-error:
-    xmlFreeDoc(doc);
+    ok = true;
+out:
+    unmap_file(data, size);
+    return ok;
+}
+
+static void
+cache_write(struct rxkb_context *ctx, const char *cache_path,
+            const char *path, const struct stat *st, const darray_char *record)
+{
+#ifdef HAVE_MKOSTEMP
+    char tmp[PATH_MAX];
+    struct cache_header header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .path_len = strlen(path),
+        .record_size = darray_size(*record),
+        .record_hash = hash_buf(record->item, darray_size(*record)),
+    };
+    FILE *file;
+    int fd;
+    bool ok;
+
+    if (st->st_mtime >= time(NULL))
+        return;
+
+    cache_header_set_stat(&header, st);
+    if (!snprintf_safe(tmp, sizeof(tmp), "%s.XXXXXX", cache_path))
+        return;
+
+    fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        log_dbg(ctx, "Failed to create the cache file %s\n", tmp);
+        return;
+    }
+
+    file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(path, 1, header.path_len, file) == header.path_len &&
+         fwrite(record->item, 1, darray_size(*record), file) ==
+            darray_size(*record);
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(tmp, cache_path) != 0) {
+        log_dbg(ctx, "Failed to write the cache file %s\n", cache_path);
+        unlink(tmp);
+    }
+#endif
+}
+
+static bool
+parse(struct rxkb_context *ctx, const char *path,
+      enum rxkb_popularity popularity)
+{
+    struct registry_parser p = {
+        .ctx = ctx,
+        .popularity = popularity,
+    };
+    char cache_path[PATH_MAX];
+    darray_char record = darray_new();
+    struct stat st;
+    bool use_cache;
+    bool success;
+
+    if (!check_eaccess(path, R_OK))
+        return false;
+
+    use_cache = ctx->cache_dir &&
+                stat(path, &st) == 0 &&
+                cache_file_path(ctx, path, cache_path, sizeof(cache_path));
+
+    if (use_cache && cache_load(&p, cache_path, path, &st)) {
+        log_dbg(ctx, "Loaded %s from the cache %s\n", path, cache_path);
+        return true;
+    }
+
+    /* Only merge the items once the whole file has been validated */
+    success = parse_xml(ctx, path, &record);
+    if (success) {
+        if (!darray_empty(record))
+            registry_replay(&p, record.item,
+                            record.item + darray_size(record));
+        if (use_cache)
+            cache_write(ctx, cache_path, path, &st, &record);
+    }
+    darray_free(record);
 
     return success;
 }
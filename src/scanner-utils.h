@@ -49,19 +49,56 @@ struct scanner {
     size_t len;
     char buf[1024];
     size_t buf_pos;
-    size_t line, column;
-    /* The line/column of the start of the current token. */
-    size_t token_line, token_column;
+    /* The position of the start of the current token. */
+    size_t token_pos;
+    /*
+     * Line and column are only needed for diagnostics, so they are not
+     * tracked while scanning, but computed from token_pos on demand.
+     * The last computed location is cached, so that successive
+     * diagnostics only need to count the newlines in between.
+     */
+    size_t cached_pos, cached_line, cached_line_start;
+    /* If non-zero, the location to report instead of the token's. */
+    size_t fixed_line, fixed_column;
     const char *file_name;
     struct xkb_context *ctx;
     void *priv;
 };
 
-#define scanner_log(scanner, level, fmt, ...) \
+static inline void
+scanner_token_location(struct scanner *s, size_t *line, size_t *column)
+{
+    const char *nl;
+
+    if (s->fixed_line != 0) {
+        *line = s->fixed_line;
+        *column = s->fixed_column;
+        return;
+    }
+
+    if (s->token_pos < s->cached_pos) {
+        s->cached_pos = s->cached_line_start = 0;
+        s->cached_line = 1;
+    }
+
+    while ((nl = memchr(s->s + s->cached_pos, '\n',
+                        s->token_pos - s->cached_pos))) {
+        s->cached_line++;
+        s->cached_pos = s->cached_line_start = nl - s->s + 1;
+    }
+    s->cached_pos = s->token_pos;
+
+    *line = s->cached_line;
+    *column = s->token_pos - s->cached_line_start + 1;
+}
+
+#define scanner_log(scanner, level, fmt, ...) do { \
+    size_t line_, column_; \
+    scanner_token_location((scanner), &line_, &column_); \
     xkb_log((scanner)->ctx, (level), 0, \
             "%s:%zu:%zu: " fmt "\n", \
-             (scanner)->file_name, \
-             (scanner)->token_line, (scanner)->token_column, ##__VA_ARGS__)
+             (scanner)->file_name, line_, column_, ##__VA_ARGS__); \
+} while (0)
 
 #define scanner_err(scanner, fmt, ...) \
     scanner_log(scanner, XKB_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
@@ -77,8 +114,10 @@ scanner_init(struct scanner *s, struct xkb_context *ctx,
     s->s = string;
     s->len = len;
     s->pos = 0;
-    s->line = s->column = 1;
-    s->token_line = s->token_column = 1;
+    s->token_pos = 0;
+    s->cached_pos = s->cached_line_start = 0;
+    s->cached_line = 1;
+    s->fixed_line = s->fixed_column = 0;
     s->file_name = file_name;
     s->ctx = ctx;
     s->priv = priv;
@@ -108,9 +147,7 @@ static inline void
 scanner_skip_to_eol(struct scanner *s)
 {
     const char *nl = memchr(s->s + s->pos, '\n', s->len - s->pos);
-    const size_t new_pos = nl ? (size_t) (nl - s->s) : s->len;
-    s->column += new_pos - s->pos;
-    s->pos = new_pos;
+    s->pos = nl ? (size_t) (nl - s->s) : s->len;
 }
 
 static inline char
@@ -118,13 +155,6 @@ scanner_next(struct scanner *s)
 {
     if (unlikely(scanner_eof(s)))
         return '\0';
-    if (unlikely(scanner_eol(s))) {
-        s->line++;
-        s->column = 1;
-    }
-    else {
-        s->column++;
-    }
     return s->s[s->pos++];
 }
 
@@ -133,7 +163,7 @@ scanner_chr(struct scanner *s, char ch)
 {
     if (likely(scanner_peek(s) != ch))
         return false;
-    s->pos++; s->column++;
+    s->pos++;
     return true;
 }
 
@@ -144,7 +174,7 @@ scanner_str(struct scanner *s, const char *string, size_t len)
         return false;
     if (memcmp(s->s + s->pos, string, len) != 0)
         return false;
-    s->pos += len; s->column += len;
+    s->pos += len;
     return true;
 }
 
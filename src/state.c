@@ -929,7 +929,8 @@ xkb_state_key_get_one_sym(struct xkb_state *state, xkb_keycode_t kc)
 
     sym = syms[0];
 
-    if (should_do_caps_transformation(state, kc))
+    if ((xkb_keysym_get_properties(sym) & XKB_KEYSYM_PROP_CASED) &&
+        should_do_caps_transformation(state, kc))
         sym = xkb_keysym_to_upper(sym);
 
     return sym;
@@ -981,7 +982,8 @@ get_one_sym_for_string(struct xkb_state *state, xkb_keycode_t kc)
         }
     }
 
-    if (should_do_caps_transformation(state, kc)) {
+    if ((xkb_keysym_get_properties(sym) & XKB_KEYSYM_PROP_CASED) &&
+        should_do_caps_transformation(state, kc)) {
         sym = xkb_keysym_to_upper(sym);
     }
 
@@ -1096,7 +1096,8 @@ get_names(struct xkb_keymap *keymap, struct x11_atom_interner *interner,
         !get_vmod_names(keymap, interner, reply, &list) ||
         !get_group_names(keymap, interner, reply, &list) ||
         !get_key_names(keymap, conn, reply, &list) ||
-        !get_aliases(keymap, conn, reply, &list))
+        !get_aliases(keymap, conn, reply, &list) ||
+        !XkbBuildKeyNameIndex(keymap))
         goto fail;
 
     free(reply);
@@ -1189,6 +1190,8 @@ xkb_x11_keymap_new_from_device(struct xkb_context *ctx,
     if (interner.had_error)
         goto err_interner;
 
+    XkbPackKeyLevels(keymap);
+    XkbBuildKeysymPositions(keymap);
     return keymap;
 
 err_map:
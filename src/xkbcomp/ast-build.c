@@ -57,10 +57,121 @@
 #include "ast-build.h"
 #include "include.h"
 
+/*
+ * All the nodes of a parsed file are allocated from a simple bump arena,
+ * owned by the root XkbFile. Freeing a file is then a matter of releasing
+ * a handful of blocks, rather than walking the whole tree node by node.
+ * Since a root file owns everything reachable from it, it can also be kept
+ * around and shared as a unit.
+ */
+
+#define AST_ARENA_BLOCK_SIZE 4096
+#define AST_ARENA_ALIGN 8
+#define AST_ARENA_ALIGN_UP(size) \
+    (((size) + (AST_ARENA_ALIGN - 1)) & ~(size_t) (AST_ARENA_ALIGN - 1))
+
+struct ast_arena_block {
+    struct ast_arena_block *next;
+    size_t size;
+    size_t used;
+};
+
+#define AST_ARENA_BLOCK_HEADER_SIZE \
+    AST_ARENA_ALIGN_UP(sizeof(struct ast_arena_block))
+
+struct ast_arena {
+    struct ast_arena_block *blocks;
+    /* Keysym lists grow their arrays on the heap; free them on teardown. */
+    darray(ExprKeysymList *) keysym_lists;
+};
+
+struct ast_arena *
+ast_arena_new(void)
+{
+    struct ast_arena *arena = calloc(1, sizeof(*arena));
+    if (!arena)
+        return NULL;
+
+    darray_init(arena->keysym_lists);
+
+    return arena;
+}
+
+void
+ast_arena_free(struct ast_arena *arena)
+{
+    struct ast_arena_block *block, *next;
+    ExprKeysymList **list;
+
+    if (!arena)
+        return;
+
+    darray_foreach(list, arena->keysym_lists) {
+        darray_free((*list)->syms);
+        darray_free((*list)->symsMapIndex);
+        darray_free((*list)->symsNumEntries);
+    }
+    darray_free(arena->keysym_lists);
+
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+
+    free(arena);
+}
+
+void *
+ast_arena_alloc(struct ast_arena *arena, size_t size)
+{
+    struct ast_arena_block *block = arena->blocks;
+    char *ptr;
+
+    size = AST_ARENA_ALIGN_UP(size);
+
+    if (!block || block->size - block->used < size) {
+        size_t block_size = MAX(size, AST_ARENA_BLOCK_SIZE);
+
+        block = malloc(AST_ARENA_BLOCK_HEADER_SIZE + block_size);
+        if (!block)
+            return NULL;
+
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    ptr = (char *) block + AST_ARENA_BLOCK_HEADER_SIZE + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+char *
+ast_arena_strndup(struct ast_arena *arena, const char *str, size_t len)
+{
+    char *copy = ast_arena_alloc(arena, len + 1);
+    if (!copy)
+        return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+char *
+ast_arena_strdup(struct ast_arena *arena, const char *str)
+{
+    return str ? ast_arena_strndup(arena, str, strlen(str)) : NULL;
+}
+
 static ExprDef *
-ExprCreate(enum expr_op_type op, enum expr_value_type type, size_t size)
+ExprCreate(struct ast_arena *arena, enum expr_op_type op,
+           enum expr_value_type type, size_t size)
 {
-    ExprDef *expr = malloc(size);
+    ExprDef *expr = ast_arena_alloc(arena, size);
     if (!expr)
         return NULL;
 
@@ -73,9 +184,9 @@ ExprCreate(enum expr_op_type op, enum expr_value_type type, size_t size)
 }
 
 ExprDef *
-ExprCreateString(xkb_atom_t str)
+ExprCreateString(struct ast_arena *arena, xkb_atom_t str)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_STRING, sizeof(ExprString));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_STRING, sizeof(ExprString));
     if (!expr)
         return NULL;
     expr->string.str = str;
@@ -83,9 +194,9 @@ ExprCreateString(xkb_atom_t str)
 }
 
 ExprDef *
-ExprCreateInteger(int ival)
+ExprCreateInteger(struct ast_arena *arena, int ival)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_INT, sizeof(ExprInteger));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_INT, sizeof(ExprInteger));
     if (!expr)
         return NULL;
     expr->integer.ival = ival;
@@ -93,18 +204,18 @@ ExprCreateInteger(int ival)
 }
 
 ExprDef *
-ExprCreateFloat(void)
+ExprCreateFloat(struct ast_arena *arena)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_FLOAT, sizeof(ExprFloat));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_FLOAT, sizeof(ExprFloat));
     if (!expr)
         return NULL;
     return expr;
 }
 
 ExprDef *
-ExprCreateBoolean(bool set)
+ExprCreateBoolean(struct ast_arena *arena, bool set)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_BOOLEAN, sizeof(ExprBoolean));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_BOOLEAN, sizeof(ExprBoolean));
     if (!expr)
         return NULL;
     expr->boolean.set = set;
@@ -112,9 +223,9 @@ ExprCreateBoolean(bool set)
 }
 
 ExprDef *
-ExprCreateKeyName(xkb_atom_t key_name)
+ExprCreateKeyName(struct ast_arena *arena, xkb_atom_t key_name)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_KEYNAME, sizeof(ExprKeyName));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_KEYNAME, sizeof(ExprKeyName));
     if (!expr)
         return NULL;
     expr->key_name.key_name = key_name;
@@ -122,9 +233,9 @@ ExprCreateKeyName(xkb_atom_t key_name)
 }
 
 ExprDef *
-ExprCreateIdent(xkb_atom_t ident)
+ExprCreateIdent(struct ast_arena *arena, xkb_atom_t ident)
 {
-    ExprDef *expr = ExprCreate(EXPR_IDENT, EXPR_TYPE_UNKNOWN, sizeof(ExprIdent));
+    ExprDef *expr = ExprCreate(arena, EXPR_IDENT, EXPR_TYPE_UNKNOWN, sizeof(ExprIdent));
     if (!expr)
         return NULL;
     expr->ident.ident = ident;
@@ -132,10 +243,10 @@ ExprCreateIdent(xkb_atom_t ident)
 }
 
 ExprDef *
-ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
-                ExprDef *child)
+ExprCreateUnary(struct ast_arena *arena, enum expr_op_type op,
+                enum expr_value_type type, ExprDef *child)
 {
-    ExprDef *expr = ExprCreate(op, type, sizeof(ExprUnary));
+    ExprDef *expr = ExprCreate(arena, op, type, sizeof(ExprUnary));
     if (!expr)
         return NULL;
     expr->unary.child = child;
@@ -143,9 +254,10 @@ ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
 }
 
 ExprDef *
-ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
+ExprCreateBinary(struct ast_arena *arena, enum expr_op_type op,
+                 ExprDef *left, ExprDef *right)
 {
-    ExprDef *expr = ExprCreate(op, EXPR_TYPE_UNKNOWN, sizeof(ExprBinary));
+    ExprDef *expr = ExprCreate(arena, op, EXPR_TYPE_UNKNOWN, sizeof(ExprBinary));
     if (!expr)
         return NULL;
 
@@ -161,9 +273,10 @@ ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
 }
 
 ExprDef *
-ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field)
+ExprCreateFieldRef(struct ast_arena *arena, xkb_atom_t element,
+                   xkb_atom_t field)
 {
-    ExprDef *expr = ExprCreate(EXPR_FIELD_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprFieldRef));
+    ExprDef *expr = ExprCreate(arena, EXPR_FIELD_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprFieldRef));
     if (!expr)
         return NULL;
     expr->field_ref.element = element;
@@ -172,9 +285,10 @@ ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field)
 }
 
 ExprDef *
-ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry)
+ExprCreateArrayRef(struct ast_arena *arena, xkb_atom_t element,
+                   xkb_atom_t field, ExprDef *entry)
 {
-    ExprDef *expr = ExprCreate(EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprArrayRef));
+    ExprDef *expr = ExprCreate(arena, EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprArrayRef));
     if (!expr)
         return NULL;
     expr->array_ref.element = element;
@@ -184,9 +298,9 @@ ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry)
 }
 
 ExprDef *
-ExprCreateAction(xkb_atom_t name, ExprDef *args)
+ExprCreateAction(struct ast_arena *arena, xkb_atom_t name, ExprDef *args)
 {
-    ExprDef *expr = ExprCreate(EXPR_ACTION_DECL, EXPR_TYPE_UNKNOWN, sizeof(ExprAction));
+    ExprDef *expr = ExprCreate(arena, EXPR_ACTION_DECL, EXPR_TYPE_UNKNOWN, sizeof(ExprAction));
     if (!expr)
         return NULL;
     expr->action.name = name;
@@ -195,9 +309,9 @@ ExprCreateAction(xkb_atom_t name, ExprDef *args)
 }
 
 ExprDef *
-ExprCreateActionList(ExprDef *actions)
+ExprCreateActionList(struct ast_arena *arena, ExprDef *actions)
 {
-    ExprDef *expr = ExprCreate(EXPR_ACTION_LIST, EXPR_TYPE_ACTIONS, sizeof(ExprActionList));
+    ExprDef *expr = ExprCreate(arena, EXPR_ACTION_LIST, EXPR_TYPE_ACTIONS, sizeof(ExprActionList));
     if (!expr)
         return NULL;
     expr->actions.actions = actions;
@@ -205,15 +319,16 @@ ExprCreateActionList(ExprDef *actions)
 }
 
 ExprDef *
-ExprCreateKeysymList(xkb_keysym_t sym)
+ExprCreateKeysymList(struct ast_arena *arena, xkb_keysym_t sym)
 {
-    ExprDef *expr = ExprCreate(EXPR_KEYSYM_LIST, EXPR_TYPE_SYMBOLS, sizeof(ExprKeysymList));
+    ExprDef *expr = ExprCreate(arena, EXPR_KEYSYM_LIST, EXPR_TYPE_SYMBOLS, sizeof(ExprKeysymList));
     if (!expr)
         return NULL;
 
     darray_init(expr->keysym_list.syms);
     darray_init(expr->keysym_list.symsMapIndex);
     darray_init(expr->keysym_list.symsNumEntries);
+    darray_append(arena->keysym_lists, &expr->keysym_list);
 
     darray_append(expr->keysym_list.syms, sym);
     darray_append(expr->keysym_list.symsMapIndex, 0);
@@ -257,15 +372,18 @@ ExprAppendMultiKeysymList(ExprDef *expr, ExprDef *append)
     darray_append(expr->keysym_list.symsNumEntries, numEntries);
     darray_concat(expr->keysym_list.syms, append->keysym_list.syms);
 
-    FreeStmt((ParseCommon *) append);
+    /* The node itself stays in the arena until the file is freed. */
+    darray_free(append->keysym_list.syms);
+    darray_free(append->keysym_list.symsMapIndex);
+    darray_free(append->keysym_list.symsNumEntries);
 
     return expr;
 }
 
 KeycodeDef *
-KeycodeCreate(xkb_atom_t name, int64_t value)
+KeycodeCreate(struct ast_arena *arena, xkb_atom_t name, int64_t value)
 {
-    KeycodeDef *def = malloc(sizeof(*def));
+    KeycodeDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -278,9 +396,9 @@ KeycodeCreate(xkb_atom_t name, int64_t value)
 }
 
 KeyAliasDef *
-KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
+KeyAliasCreate(struct ast_arena *arena, xkb_atom_t alias, xkb_atom_t real)
 {
-    KeyAliasDef *def = malloc(sizeof(*def));
+    KeyAliasDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -293,9 +411,9 @@ KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
 }
 
 VModDef *
-VModCreate(xkb_atom_t name, ExprDef *value)
+VModCreate(struct ast_arena *arena, xkb_atom_t name, ExprDef *value)
 {
-    VModDef *def = malloc(sizeof(*def));
+    VModDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -308,9 +426,9 @@ VModCreate(xkb_atom_t name, ExprDef *value)
 }
 
 VarDef *
-VarCreate(ExprDef *name, ExprDef *value)
+VarCreate(struct ast_arena *arena, ExprDef *name, ExprDef *value)
 {
-    VarDef *def = malloc(sizeof(*def));
+    VarDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -323,29 +441,20 @@ VarCreate(ExprDef *name, ExprDef *value)
 }
 
 VarDef *
-BoolVarCreate(xkb_atom_t ident, bool set)
+BoolVarCreate(struct ast_arena *arena, xkb_atom_t ident, bool set)
 {
     ExprDef *name, *value;
-    VarDef *def;
-    if (!(name = ExprCreateIdent(ident))) {
+    if (!(name = ExprCreateIdent(arena, ident)))
         return NULL;
-    }
-    if (!(value = ExprCreateBoolean(set))) {
-        FreeStmt((ParseCommon *) name);
+    if (!(value = ExprCreateBoolean(arena, set)))
         return NULL;
-    }
-    if (!(def = VarCreate(name, value))) {
-        FreeStmt((ParseCommon *) name);
-        FreeStmt((ParseCommon *) value);
-        return NULL;
-    }
-    return def;
+    return VarCreate(arena, name, value);
 }
 
 InterpDef *
-InterpCreate(xkb_keysym_t sym, ExprDef *match)
+InterpCreate(struct ast_arena *arena, xkb_keysym_t sym, ExprDef *match)
 {
-    InterpDef *def = malloc(sizeof(*def));
+    InterpDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -359,9 +468,9 @@ InterpCreate(xkb_keysym_t sym, ExprDef *match)
 }
 
 KeyTypeDef *
-KeyTypeCreate(xkb_atom_t name, VarDef *body)
+KeyTypeCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body)
 {
-    KeyTypeDef *def = malloc(sizeof(*def));
+    KeyTypeDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -375,9 +484,9 @@ KeyTypeCreate(xkb_atom_t name, VarDef *body)
 }
 
 SymbolsDef *
-SymbolsCreate(xkb_atom_t keyName, VarDef *symbols)
+SymbolsCreate(struct ast_arena *arena, xkb_atom_t keyName, VarDef *symbols)
 {
-    SymbolsDef *def = malloc(sizeof(*def));
+    SymbolsDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -391,9 +500,9 @@ SymbolsCreate(xkb_atom_t keyName, VarDef *symbols)
 }
 
 GroupCompatDef *
-GroupCompatCreate(unsigned group, ExprDef *val)
+GroupCompatCreate(struct ast_arena *arena, unsigned group, ExprDef *val)
 {
-    GroupCompatDef *def = malloc(sizeof(*def));
+    GroupCompatDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -407,9 +516,9 @@ GroupCompatCreate(unsigned group, ExprDef *val)
 }
 
 ModMapDef *
-ModMapCreate(xkb_atom_t modifier, ExprDef *keys)
+ModMapCreate(struct ast_arena *arena, xkb_atom_t modifier, ExprDef *keys)
 {
-    ModMapDef *def = malloc(sizeof(*def));
+    ModMapDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -423,9 +532,9 @@ ModMapCreate(xkb_atom_t modifier, ExprDef *keys)
 }
 
 LedMapDef *
-LedMapCreate(xkb_atom_t name, VarDef *body)
+LedMapCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body)
 {
-    LedMapDef *def = malloc(sizeof(*def));
+    LedMapDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -439,9 +548,10 @@ LedMapCreate(xkb_atom_t name, VarDef *body)
 }
 
 LedNameDef *
-LedNameCreate(unsigned ndx, ExprDef *name, bool virtual)
+LedNameCreate(struct ast_arena *arena, unsigned ndx, ExprDef *name,
+              bool virtual)
 {
-    LedNameDef *def = malloc(sizeof(*def));
+    LedNameDef *def = ast_arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -455,19 +565,18 @@ LedNameCreate(unsigned ndx, ExprDef *name, bool virtual)
     return def;
 }
 
-static void
-FreeInclude(IncludeStmt *incl);
-
 IncludeStmt *
-IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
+IncludeCreate(struct xkb_context *ctx, struct ast_arena *arena,
+              const char *str, enum merge_mode merge)
 {
     IncludeStmt *incl, *first;
     char *stmt, *tmp;
     char nextop;
 
     incl = first = NULL;
-    tmp = str;
-    stmt = strdup_safe(str);
+    /* ParseIncludeMap() splits the string in place; keep str intact. */
+    tmp = ast_arena_strdup(arena, str);
+    stmt = ast_arena_strdup(arena, str);
     while (tmp && *tmp)
     {
         char *file = NULL, *map = NULL, *extra_data = NULL;
@@ -489,9 +598,9 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
         }
 
         if (first == NULL) {
-            first = incl = malloc(sizeof(*first));
+            first = incl = ast_arena_alloc(arena, sizeof(*first));
         } else {
-            incl->next_incl = malloc(sizeof(*first));
+            incl->next_incl = ast_arena_alloc(arena, sizeof(*first));
             incl = incl->next_incl;
         }
 
@@ -506,11 +615,15 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
         incl->common.next = NULL;
         incl->merge = merge;
         incl->stmt = NULL;
-        incl->file = file;
-        incl->map = map;
-        incl->modifier = extra_data;
+        incl->file = ast_arena_strdup(arena, file);
+        incl->map = ast_arena_strdup(arena, map);
+        incl->modifier = ast_arena_strdup(arena, extra_data);
         incl->next_incl = NULL;
 
+        free(file);
+        free(map);
+        free(extra_data);
+
         if (nextop == '|')
             merge = MERGE_AUGMENT;
         else
@@ -519,31 +632,28 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
 
     if (first)
         first->stmt = stmt;
-    else
-        free(stmt);
 
     return first;
 
 err:
     log_err(ctx, "Illegal include statement \"%s\"; Ignored\n", stmt);
-    FreeInclude(first);
-    free(stmt);
     return NULL;
 }
 
 XkbFile *
-XkbFileCreate(enum xkb_file_type type, char *name, ParseCommon *defs,
-              enum xkb_map_flags flags)
+XkbFileCreate(struct ast_arena *arena, enum xkb_file_type type, char *name,
+              ParseCommon *defs, enum xkb_map_flags flags)
 {
     XkbFile *file;
 
-    file = calloc(1, sizeof(*file));
+    file = ast_arena_alloc(arena, sizeof(*file));
     if (!file)
         return NULL;
 
     XkbEscapeMapName(name);
+    memset(file, 0, sizeof(*file));
     file->file_type = type;
-    file->name = name ? name : strdup("(unnamed)");
+    file->name = name ? name : ast_arena_strdup(arena, "(unnamed)");
     file->defs = defs;
     file->flags = flags;
 
@@ -562,17 +672,20 @@ XkbFileFromComponents(struct xkb_context *ctx,
     IncludeStmt *include = NULL;
     XkbFile *file = NULL;
     ParseCommon *defs = NULL, *defsLast = NULL;
+    struct ast_arena *arena;
+
+    arena = ast_arena_new();
+    if (!arena)
+        return NULL;
 
     for (type = FIRST_KEYMAP_FILE_TYPE; type <= LAST_KEYMAP_FILE_TYPE; type++) {
-        include = IncludeCreate(ctx, components[type], MERGE_DEFAULT);
+        include = IncludeCreate(ctx, arena, components[type], MERGE_DEFAULT);
         if (!include)
             goto err;
 
-        file = XkbFileCreate(type, NULL, (ParseCommon *) include, 0);
-        if (!file) {
-            FreeInclude(include);
+        file = XkbFileCreate(arena, type, NULL, (ParseCommon *) include, 0);
+        if (!file)
             goto err;
-        }
 
         if (!defs)
             defsLast = defs = &file->common;
@@ -580,168 +693,24 @@ XkbFileFromComponents(struct xkb_context *ctx,
             defsLast = defsLast->next = &file->common;
     }
 
-    file = XkbFileCreate(FILE_TYPE_KEYMAP, NULL, defs, 0);
+    file = XkbFileCreate(arena, FILE_TYPE_KEYMAP, NULL, defs, 0);
     if (!file)
         goto err;
 
+    file->arena = arena;
     return file;
 
 err:
-    FreeXkbFile((XkbFile *) defs);
+    ast_arena_free(arena);
     return NULL;
 }
 
-static void
-FreeExpr(ExprDef *expr)
-{
-    if (!expr)
-        return;
-
-    switch (expr->expr.op) {
-    case EXPR_NEGATE:
-    case EXPR_UNARY_PLUS:
-    case EXPR_NOT:
-    case EXPR_INVERT:
-        FreeStmt((ParseCommon *) expr->unary.child);
-        break;
-
-    case EXPR_DIVIDE:
-    case EXPR_ADD:
-    case EXPR_SUBTRACT:
-    case EXPR_MULTIPLY:
-    case EXPR_ASSIGN:
-        FreeStmt((ParseCommon *) expr->binary.left);
-        FreeStmt((ParseCommon *) expr->binary.right);
-        break;
-
-    case EXPR_ACTION_DECL:
-        FreeStmt((ParseCommon *) expr->action.args);
-        break;
-
-    case EXPR_ACTION_LIST:
-        FreeStmt((ParseCommon *) expr->actions.actions);
-        break;
-
-    case EXPR_ARRAY_REF:
-        FreeStmt((ParseCommon *) expr->array_ref.entry);
-        break;
-
-    case EXPR_KEYSYM_LIST:
-        darray_free(expr->keysym_list.syms);
-        darray_free(expr->keysym_list.symsMapIndex);
-        darray_free(expr->keysym_list.symsNumEntries);
-        break;
-
-    default:
-        break;
-    }
-}
-
-static void
-FreeInclude(IncludeStmt *incl)
-{
-    IncludeStmt *next;
-
-    while (incl)
-    {
-        next = incl->next_incl;
-
-        free(incl->file);
-        free(incl->map);
-        free(incl->modifier);
-        free(incl->stmt);
-
-        free(incl);
-        incl = next;
-    }
-}
-
-void
-FreeStmt(ParseCommon *stmt)
-{
-    ParseCommon *next;
-
-    while (stmt)
-    {
-        next = stmt->next;
-
-        switch (stmt->type) {
-        case STMT_INCLUDE:
-            FreeInclude((IncludeStmt *) stmt);
-            /* stmt is already free'd here. */
-            stmt = NULL;
-            break;
-        case STMT_EXPR:
-            FreeExpr((ExprDef *) stmt);
-            break;
-        case STMT_VAR:
-            FreeStmt((ParseCommon *) ((VarDef *) stmt)->name);
-            FreeStmt((ParseCommon *) ((VarDef *) stmt)->value);
-            break;
-        case STMT_TYPE:
-            FreeStmt((ParseCommon *) ((KeyTypeDef *) stmt)->body);
-            break;
-        case STMT_INTERP:
-            FreeStmt((ParseCommon *) ((InterpDef *) stmt)->match);
-            FreeStmt((ParseCommon *) ((InterpDef *) stmt)->def);
-            break;
-        case STMT_VMOD:
-            FreeStmt((ParseCommon *) ((VModDef *) stmt)->value);
-            break;
-        case STMT_SYMBOLS:
-            FreeStmt((ParseCommon *) ((SymbolsDef *) stmt)->symbols);
-            break;
-        case STMT_MODMAP:
-            FreeStmt((ParseCommon *) ((ModMapDef *) stmt)->keys);
-            break;
-        case STMT_GROUP_COMPAT:
-            FreeStmt((ParseCommon *) ((GroupCompatDef *) stmt)->def);
-            break;
-        case STMT_LED_MAP:
-            FreeStmt((ParseCommon *) ((LedMapDef *) stmt)->body);
-            break;
-        case STMT_LED_NAME:
-            FreeStmt((ParseCommon *) ((LedNameDef *) stmt)->name);
-            break;
-        default:
-            break;
-        }
-
-        free(stmt);
-        stmt = next;
-    }
-}
-
 void
 FreeXkbFile(XkbFile *file)
 {
-    XkbFile *next;
-
-    while (file)
-    {
-        next = (XkbFile *) file->common.next;
-
-        switch (file->file_type) {
-        case FILE_TYPE_KEYMAP:
-            FreeXkbFile((XkbFile *) file->defs);
-            break;
-
-        case FILE_TYPE_TYPES:
-        case FILE_TYPE_COMPAT:
-        case FILE_TYPE_SYMBOLS:
-        case FILE_TYPE_KEYCODES:
-        case FILE_TYPE_GEOMETRY:
-            FreeStmt(file->defs);
-            break;
-
-        default:
-            break;
-        }
-
-        free(file->name);
-        free(file);
-        file = next;
-    }
+    /* Only root files own an arena; nested files are freed along with it. */
+    if (file)
+        ast_arena_free(file->arena);
 }
 
 static const char *xkb_file_type_strings[_FILE_TYPE_NUM_ENTRIES] = {
@@ -355,6 +355,8 @@ typedef struct {
     char *name;
     ParseCommon *defs;
     enum xkb_map_flags flags;
+    /* Set on root files only: owns the memory of the whole tree. */
+    struct ast_arena *arena;
 } XkbFile;
 
 #endif
@@ -429,8 +429,7 @@ HandleIncludeCompatMap(CompatInfo *info, IncludeStmt *include)
     CompatInfo included;
 
     InitCompatInfo(&included, info->ctx, info->actions, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         CompatInfo next_incl;
@@ -55,6 +55,7 @@
 
 #include "xkbcomp-priv.h"
 #include "include.h"
+#include "bundle.h"
 
 /**
  * Parse an include statement. Each call returns a file name, along with
@@ -221,28 +222,41 @@ LogIncludePaths(struct xkb_context *ctx)
 }
 
 /**
- * Return an open file handle to the first file (counting from offset) with the
- * given name in the include paths, starting at the offset.
+ * Find the first file (counting from offset) with the given name in the
+ * include paths, starting at the offset, and get its contents, which must
+ * be released with ReleaseIncludeFile().
  *
  * offset must be zero the first time this is called and is set to the index the
  * file was found. Call again with offset+1 to keep searching through the
  * include paths.
  *
- * If this function returns NULL, no more files are available.
+ * If this function returns false, no more files are available.
  */
-FILE *
+bool
 FindFileInXkbPath(struct xkb_context *ctx, const char *name,
                   enum xkb_file_type type, char **pathRtrn,
-                  unsigned int *offset)
+                  unsigned int *offset, struct include_file *out)
 {
     unsigned int i;
-    FILE *file = NULL;
+    FILE *file;
     char *buf = NULL;
     const char *typeDir;
+    struct xkb_bundle *bundle;
 
     typeDir = DirectoryForInclude(type);
 
     for (i = *offset; i < xkb_context_num_include_paths(ctx); i++) {
+        bundle = xkb_context_include_path_get_bundle(ctx, i);
+        if (bundle) {
+            if (!xkb_bundle_find(bundle, typeDir, name,
+                                 &out->string, &out->size))
+                continue;
+            out->mapped = false;
+        }
+        else if (!xkb_context_include_dir_may_contain(ctx, i, typeDir, name)) {
+            continue;
+        }
+
         buf = asprintf_safe("%s/%s/%s", xkb_context_include_path_get(ctx, i),
                             typeDir, name);
         if (!buf) {
@@ -251,15 +265,33 @@ FindFileInXkbPath(struct xkb_context *ctx, const char *name,
             continue;
         }
 
-        file = fopen(buf, "rb");
-        if (file) {
-            if (pathRtrn) {
-                *pathRtrn = buf;
-                buf = NULL;
+        if (!bundle) {
+            char *string;
+
+            file = fopen(buf, "rb");
+            if (!file) {
+                free(buf);
+                continue;
             }
-            *offset = i;
-            goto out;
+
+            out->mapped = xkb_context_map_file(ctx, file, &string, &out->size);
+            if (!out->mapped)
+                log_err(ctx, "Couldn't read XKB file %s: %s\n",
+                        buf, strerror(errno));
+            fclose(file);
+            if (!out->mapped) {
+                free(buf);
+                continue;
+            }
+            out->string = string;
         }
+
+        if (pathRtrn)
+            *pathRtrn = buf;
+        else
+            free(buf);
+        *offset = i;
+        return true;
     }
 
     /* We only print warnings if we can't find the file on the first lookup */
@@ -269,26 +301,34 @@ FindFileInXkbPath(struct xkb_context *ctx, const char *name,
         LogIncludePaths(ctx);
     }
 
-out:
-    free(buf);
-    return file;
+    return false;
+}
+
+void
+ReleaseIncludeFile(struct xkb_context *ctx, struct include_file *file)
+{
+    if (file->mapped)
+        xkb_context_unmap_file(ctx, (char *) file->string, file->size);
 }
 
 XkbFile *
 ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
                    enum xkb_file_type file_type)
 {
-    FILE *file;
+    struct include_file file;
     XkbFile *xkb_file = NULL;
     unsigned int offset = 0;
+    bool found;
 
-    file = FindFileInXkbPath(ctx, stmt->file, file_type, NULL, &offset);
-    if (!file)
+    found = FindFileInXkbPath(ctx, stmt->file, file_type, NULL, &offset,
+                              &file);
+    if (!found)
         return NULL;
 
-    while (file) {
-        xkb_file = XkbParseFile(ctx, file, stmt->file, stmt->map);
-        fclose(file);
+    while (found) {
+        xkb_file = XkbParseString(ctx, file.string, file.size,
+                                  stmt->file, stmt->map);
+        ReleaseIncludeFile(ctx, &file);
 
         if (xkb_file) {
             if (xkb_file->file_type != file_type) {
@@ -305,7 +345,8 @@ ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
         }
 
         offset++;
-        file = FindFileInXkbPath(ctx, stmt->file, file_type, NULL, &offset);
+        found = FindFileInXkbPath(ctx, stmt->file, file_type, NULL, &offset,
+                                  &file);
     }
 
     if (!xkb_file) {
@@ -31,10 +31,21 @@ bool
 ParseIncludeMap(char **str_inout, char **file_rtrn, char **map_rtrn,
                 char *nextop_rtrn, char **extra_data);
 
-FILE *
+/* The contents of a file found in the include path. */
+struct include_file {
+    const char *string;
+    size_t size;
+    /* False if the contents are in an include bundle. */
+    bool mapped;
+};
+
+bool
 FindFileInXkbPath(struct xkb_context *ctx, const char *name,
                   enum xkb_file_type type, char **pathRtrn,
-                  unsigned int *offset);
+                  unsigned int *offset, struct include_file *out);
+
+void
+ReleaseIncludeFile(struct xkb_context *ctx, struct include_file *file);
 
 XkbFile *
 ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
@@ -337,8 +337,7 @@ HandleIncludeKeycodes(KeyNamesInfo *info, IncludeStmt *include)
     KeyNamesInfo included;
 
     InitKeyNamesInfo(&included, info->ctx);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         KeyNamesInfo next_incl;
@@ -553,7 +552,8 @@ CopyKeyNamesToKeymap(struct xkb_keymap *keymap, KeyNamesInfo *info)
     keymap->min_key_code = min_key_code;
     keymap->max_key_code = max_key_code;
     keymap->keys = keys;
-    return true;
+    /* The aliases are checked against the key names, index them already. */
+    return XkbBuildKeyNameIndex(keymap);
 }
 
 static bool
@@ -612,7 +612,7 @@ CopyKeyAliasesToKeymap(struct xkb_keymap *keymap, KeyNamesInfo *info)
 
     keymap->num_key_aliases = num_key_aliases;
     keymap->key_aliases = key_aliases;
-    return true;
+    return XkbBuildKeyNameIndex(keymap);
 }
 
 static bool
@@ -56,10 +56,30 @@
 
 #define BUF_CHUNK_SIZE 4096
 
+/*
+ * The output buffer. By default it holds the whole keymap string. With a
+ * write_fn, it is flushed to it whenever it is full, and only needs to
+ * hold a chunk; with count_only, flushed chunks are dropped and only the
+ * size of the output is kept.
+ */
 struct buf {
     char *buf;
     size_t size;
     size_t alloc;
+
+    xkb_keymap_write_fn write_fn;
+    void *user_data;
+    bool count_only;
+    /* Total size of the output so far, including flushed chunks. */
+    size_t total;
+
+    /* XKB_KEYMAP_SERIALIZE_COMPACT: see compact_text(). */
+    bool compact;
+    bool in_string;
+    bool escaped;
+    char last_flushed;
+    /* The virtual modifiers to declare. */
+    xkb_mod_mask_t vmods;
 };
 
 static bool
@@ -67,9 +87,10 @@ do_realloc(struct buf *buf, size_t at_least)
 {
     char *new;
 
-    buf->alloc += BUF_CHUNK_SIZE;
-    if (at_least >= BUF_CHUNK_SIZE)
-        buf->alloc += at_least;
+    /* Grow geometrically: keymaps are large and written in small bits. */
+    buf->alloc = MAX(buf->alloc * 2, BUF_CHUNK_SIZE);
+    while (at_least >= buf->alloc - buf->size)
+        buf->alloc *= 2;
 
     new = realloc(buf->buf, buf->alloc);
     if (!new)
@@ -79,12 +100,81 @@ do_realloc(struct buf *buf, size_t at_least)
     return true;
 }
 
+static bool
+flush_buf(struct buf *buf)
+{
+    if (buf->size == 0)
+        return true;
+
+    if (buf->write_fn && !buf->write_fn(buf->user_data, buf->buf, buf->size))
+        return false;
+
+    buf->last_flushed = buf->buf[buf->size - 1];
+    buf->size = 0;
+    return true;
+}
+
+/*
+ * Squeeze the whitespace out of the text just printed at the end of the
+ * buffer, outside of strings: indentation, padding, blank lines, line
+ * breaks inside blocks and lists, and spaces next to punctuation. One
+ * space is kept between words, and statements stay on their own line.
+ * Returns the new size of the buffer.
+ */
+static size_t
+compact_text(struct buf *buf, size_t printed)
+{
+    size_t w = buf->size;
+    const size_t end = buf->size + printed;
+
+    for (size_t r = buf->size; r < end; r++) {
+        const char c = buf->buf[r];
+        const char last = w > 0 ? buf->buf[w - 1] : buf->last_flushed;
+
+        if (buf->in_string) {
+            if (buf->escaped)
+                buf->escaped = false;
+            else if (c == '\\')
+                buf->escaped = true;
+            else if (c == '"')
+                buf->in_string = false;
+            buf->buf[w++] = c;
+            continue;
+        }
+
+        switch (c) {
+        case '\t':
+            continue;
+        case ' ':
+            if (last == '\0' || strchr(" \n([{,=;", last))
+                continue;
+            break;
+        case '\n':
+            if (last == '\0' || strchr("\n{,", last))
+                continue;
+            break;
+        case '=': case ',': case ';': case ')': case ']': case '}':
+            /* The space may already have been flushed; keep it then. */
+            if (w > 0 && buf->buf[w - 1] == ' ')
+                w--;
+            break;
+        case '"':
+            buf->in_string = true;
+            break;
+        }
+
+        buf->buf[w++] = c;
+    }
+
+    return w;
+}
+
 ATTR_PRINTF(2, 3) static bool
 check_write_buf(struct buf *buf, const char *fmt, ...)
 {
     va_list args;
     int printed;
-    size_t available;
+    size_t available, size;
 
     available = buf->alloc - buf->size;
     va_start(args, fmt);
@@ -94,21 +184,33 @@ check_write_buf(struct buf *buf, const char *fmt, ...)
     if (printed < 0)
         goto err;
 
-    if ((size_t) printed >= available)
-        if (!do_realloc(buf, printed))
+    if ((size_t) printed >= available) {
+        if ((buf->write_fn || buf->count_only) && !flush_buf(buf))
+            goto err;
+
+        if ((size_t) printed >= buf->alloc - buf->size &&
+            !do_realloc(buf, printed))
             goto err;
 
-    /* The buffer has enough space now. */
+        /* The buffer has enough space now. */
 
-    available = buf->alloc - buf->size;
-    va_start(args, fmt);
-    printed = vsnprintf(buf->buf + buf->size, available, fmt, args);
-    va_end(args);
+        available = buf->alloc - buf->size;
+        va_start(args, fmt);
+        printed = vsnprintf(buf->buf + buf->size, available, fmt, args);
+        va_end(args);
 
-    if (printed < 0 || (size_t) printed >= available)
-        goto err;
+        if (printed < 0 || (size_t) printed >= available)
+            goto err;
+    }
+
+    size = buf->size + printed;
+    if (buf->compact) {
+        size = compact_text(buf, printed);
+        buf->buf[size] = '\0';
+    }
 
-    buf->size += printed;
+    buf->total = buf->total - buf->size + size;
+    buf->size = size;
     return true;
 
 err:
@@ -122,14 +224,108 @@ err:
         return false; \
 } while (0)
 
+/*
+ * In compact mode, types no key uses are left out. Keys whose type is not
+ * explicit get the same type again when the output is compiled, so it is
+ * always among the used ones.
+ */
+static bool
+is_type_used(struct xkb_keymap *keymap, const struct xkb_key_type *type)
+{
+    const struct xkb_key *key;
+
+    xkb_keys_foreach(key, keymap)
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++)
+            if (key->groups[i].type == type)
+                return true;
+
+    return false;
+}
+
+/*
+ * In compact mode, interpretations of keysyms no key has are left out:
+ * they cannot match anything.
+ */
+static bool
+is_interp_used(struct xkb_keymap *keymap, const struct xkb_sym_interpret *si)
+{
+    return si->sym == XKB_KEY_NoSymbol ||
+           xkb_keymap_keysym_get_positions(keymap, si->sym, NULL, 0) > 0;
+}
+
+static xkb_mod_mask_t
+action_mods(const union xkb_action *action)
+{
+    switch (action->type) {
+    case ACTION_TYPE_MOD_SET:
+    case ACTION_TYPE_MOD_LATCH:
+    case ACTION_TYPE_MOD_LOCK:
+        return action->mods.mods.mods;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * The modifiers referred to by what is written out, to only declare the
+ * virtual modifiers in use in compact mode.
+ */
+static xkb_mod_mask_t
+get_used_mods(struct xkb_keymap *keymap)
+{
+    const struct xkb_key *key;
+    const struct xkb_led *led;
+    xkb_mod_mask_t mask = 0;
+
+    for (unsigned i = 0; i < keymap->num_types; i++) {
+        const struct xkb_key_type *type = &keymap->types[i];
+
+        if (!is_type_used(keymap, type))
+            continue;
+
+        mask |= type->mods.mods;
+        for (unsigned j = 0; j < type->num_entries; j++)
+            mask |= type->entries[j].mods.mods |
+                    type->entries[j].preserve.mods;
+    }
+
+    for (unsigned i = 0; i < keymap->num_sym_interprets; i++) {
+        const struct xkb_sym_interpret *si = &keymap->sym_interprets[i];
+
+        if (!is_interp_used(keymap, si))
+            continue;
+
+        if (si->match != MATCH_ANY_OR_NONE || si->mods != MOD_REAL_MASK_ALL)
+            mask |= si->mods;
+        if (si->virtual_mod != XKB_MOD_INVALID)
+            mask |= 1u << si->virtual_mod;
+        mask |= action_mods(&si->action);
+    }
+
+    xkb_leds_foreach(led, keymap)
+        mask |= led->mods.mods;
+
+    xkb_keys_foreach(key, keymap) {
+        if (key->explicit & EXPLICIT_VMODMAP)
+            mask |= key->vmodmap;
+        if (!(key->explicit & EXPLICIT_INTERP))
+            continue;
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++)
+            for (xkb_level_index_t j = 0; j < XkbKeyNumLevels(key, i); j++)
+                mask |= action_mods(&key->groups[i].levels[j].action);
+    }
+
+    return mask;
+}
+
 static bool
 write_vmods(struct xkb_keymap *keymap, struct buf *buf)
 {
     const struct xkb_mod *mod;
-    xkb_mod_index_t num_vmods = 0;
+    xkb_mod_index_t i, num_vmods = 0;
 
-    xkb_mods_foreach(mod, &keymap->mods) {
-        if (mod->type != MOD_VIRT)
+    xkb_mods_enumerate(i, mod, &keymap->mods) {
+        if (mod->type != MOD_VIRT || !(buf->vmods & (1u << i)))
             continue;
 
         if (num_vmods == 0)
@@ -203,11 +399,16 @@ write_types(struct xkb_keymap *keymap, struct buf *buf)
     for (unsigned i = 0; i < keymap->num_types; i++) {
         const struct xkb_key_type *type = &keymap->types[i];
 
+        if (buf->compact && !is_type_used(keymap, type))
+            continue;
+
         write_buf(buf, "\ttype \"%s\" {\n",
                   xkb_atom_text(keymap->ctx, type->name));
 
-        write_buf(buf, "\t\tmodifiers= %s;\n",
-                  ModMaskText(keymap->ctx, &keymap->mods, type->mods.mods));
+        if (!buf->compact || type->mods.mods != 0)
+            write_buf(buf, "\t\tmodifiers= %s;\n",
+                      ModMaskText(keymap->ctx, &keymap->mods,
+                                  type->mods.mods));
 
         for (unsigned j = 0; j < type->num_entries; j++) {
             const char *str;
@@ -419,16 +620,26 @@ write_compat(struct xkb_keymap *keymap, struct buf *buf)
 
     write_vmods(keymap, buf);
 
-    write_buf(buf, "\tinterpret.useModMapMods= AnyLevel;\n");
-    write_buf(buf, "\tinterpret.repeat= False;\n");
+    /* These are the defaults anyway. */
+    if (!buf->compact) {
+        write_buf(buf, "\tinterpret.useModMapMods= AnyLevel;\n");
+        write_buf(buf, "\tinterpret.repeat= False;\n");
+    }
 
     for (unsigned i = 0; i < keymap->num_sym_interprets; i++) {
         const struct xkb_sym_interpret *si = &keymap->sym_interprets[i];
+        const char *sym = si->sym ? KeysymText(keymap->ctx, si->sym) : "Any";
 
-        write_buf(buf, "\tinterpret %s+%s(%s) {\n",
-                  si->sym ? KeysymText(keymap->ctx, si->sym) : "Any",
-                  SIMatchText(si->match),
-                  ModMaskText(keymap->ctx, &keymap->mods, si->mods));
+        if (buf->compact && !is_interp_used(keymap, si))
+            continue;
+
+        if (buf->compact && si->match == MATCH_ANY_OR_NONE &&
+            si->mods == MOD_REAL_MASK_ALL)
+            write_buf(buf, "\tinterpret %s {\n", sym);
+        else
+            write_buf(buf, "\tinterpret %s+%s(%s) {\n", sym,
+                      SIMatchText(si->match),
+                      ModMaskText(keymap->ctx, &keymap->mods, si->mods));
 
         if (si->virtual_mod != XKB_MOD_INVALID)
             write_buf(buf, "\t\tvirtualModifier= %s;\n",
@@ -441,7 +652,8 @@ write_compat(struct xkb_keymap *keymap, struct buf *buf)
         if (si->repeat)
             write_buf(buf, "\t\trepeat= True;\n");
 
-        write_action(keymap, buf, &si->action, "\t\taction= ", ";\n");
+        if (!buf->compact || si->action.type != ACTION_TYPE_NONE)
+            write_action(keymap, buf, &si->action, "\t\taction= ", ";\n");
         write_buf(buf, "\t};\n");
     }
 
@@ -644,8 +856,12 @@ write_symbols(struct xkb_keymap *keymap, struct buf *buf)
 }
 
 static bool
-write_keymap(struct xkb_keymap *keymap, struct buf *buf)
+write_keymap(struct xkb_keymap *keymap, struct buf *buf,
+             enum xkb_keymap_serialize_flags flags)
 {
+    buf->compact = (flags & XKB_KEYMAP_SERIALIZE_COMPACT);
+    buf->vmods = buf->compact ? get_used_mods(keymap) : ~(xkb_mod_mask_t) 0;
+
     return (check_write_buf(buf, "xkb_keymap {\n") &&
             write_keycodes(keymap, buf) &&
             write_types(keymap, buf) &&
@@ -655,14 +871,37 @@ write_keymap(struct xkb_keymap *keymap, struct buf *buf)
 }
 
 char *
-text_v1_keymap_get_as_string(struct xkb_keymap *keymap)
+text_v1_keymap_get_as_string(struct xkb_keymap *keymap,
+                             enum xkb_keymap_serialize_flags flags)
 {
     struct buf buf = { NULL, 0, 0 };
 
-    if (!write_keymap(keymap, &buf)) {
+    if (!write_keymap(keymap, &buf, flags)) {
         free(buf.buf);
         return NULL;
     }
 
     return buf.buf;
 }
+
+bool
+text_v1_keymap_write(struct xkb_keymap *keymap,
+                     enum xkb_keymap_serialize_flags flags,
+                     xkb_keymap_write_fn write_fn, void *user_data,
+                     size_t *size_out)
+{
+    struct buf buf = {
+        .write_fn = write_fn,
+        .user_data = user_data,
+        .count_only = !write_fn,
+    };
+    bool ok;
+
+    ok = write_keymap(keymap, &buf, flags) && (!write_fn || flush_buf(&buf));
+    free(buf.buf);
+    if (!ok)
+        return false;
+
+    *size_out = buf.total;
+    return true;
+}
@@ -63,71 +63,169 @@ static const struct xkb_sym_interpret default_interpret = {
     .action = { .type = ACTION_TYPE_NONE },
 };
 
+/*
+ * Index of the keymap's interprets by keysym, so that each level only needs
+ * to look at the interprets which may apply to it. Both lists hold indexes
+ * into keymap->sym_interprets in ascending order, i.e. from the most
+ * specific to the least specific (see CopyCompatToKeymap).
+ */
+struct interp_entry {
+    xkb_keysym_t sym;
+    unsigned int idx;
+};
+
+struct interp_index {
+    /* Interprets for a specific keysym, sorted by keysym. */
+    struct interp_entry *by_sym;
+    unsigned int num_by_sym;
+    /* Interprets for XKB_KEY_NoSymbol, which apply to any keysym. */
+    unsigned int *wildcards;
+    unsigned int num_wildcards;
+};
+
+static int
+cmp_interp_entry(const void *a, const void *b)
+{
+    const struct interp_entry *ea = a, *eb = b;
+
+    if (ea->sym != eb->sym)
+        return ea->sym < eb->sym ? -1 : 1;
+    return ea->idx < eb->idx ? -1 : (ea->idx > eb->idx);
+}
+
+static bool
+BuildInterpIndex(struct xkb_keymap *keymap, struct interp_index *index)
+{
+    const unsigned int num = keymap->num_sym_interprets;
+
+    index->num_by_sym = index->num_wildcards = 0;
+    index->by_sym = calloc(num, sizeof(*index->by_sym));
+    index->wildcards = calloc(num, sizeof(*index->wildcards));
+    if (num > 0 && (!index->by_sym || !index->wildcards)) {
+        free(index->by_sym);
+        free(index->wildcards);
+        return false;
+    }
+
+    for (unsigned int i = 0; i < num; i++) {
+        const xkb_keysym_t sym = keymap->sym_interprets[i].sym;
+
+        if (sym == XKB_KEY_NoSymbol) {
+            index->wildcards[index->num_wildcards++] = i;
+        }
+        else {
+            index->by_sym[index->num_by_sym].sym = sym;
+            index->by_sym[index->num_by_sym].idx = i;
+            index->num_by_sym++;
+        }
+    }
+
+    if (index->num_by_sym > 1)
+        qsort(index->by_sym, index->num_by_sym, sizeof(*index->by_sym),
+              cmp_interp_entry);
+
+    return true;
+}
+
+static void
+FreeInterpIndex(struct interp_index *index)
+{
+    free(index->by_sym);
+    free(index->wildcards);
+}
+
+static bool
+InterpMatchesMods(const struct xkb_sym_interpret *interp,
+                  const struct xkb_key *key, xkb_level_index_t level)
+{
+    xkb_mod_mask_t mods;
+
+    if (interp->level_one_only && level != 0)
+        mods = 0;
+    else
+        mods = key->modmap;
+
+    switch (interp->match) {
+    case MATCH_NONE:
+        return !(interp->mods & mods);
+    case MATCH_ANY_OR_NONE:
+        return (!mods || (interp->mods & mods));
+    case MATCH_ANY:
+        return (interp->mods & mods);
+    case MATCH_ALL:
+        return ((interp->mods & mods) == interp->mods);
+    case MATCH_EXACTLY:
+        return (interp->mods == mods);
+    }
+
+    return false;
+}
+
 /**
  * Find an interpretation which applies to this particular level, either by
  * finding an exact match for the symbol and modifier combination, or a
  * generic XKB_KEY_NoSymbol match.
  */
 static const struct xkb_sym_interpret *
-FindInterpForKey(struct xkb_keymap *keymap, const struct xkb_key *key,
+FindInterpForKey(struct xkb_keymap *keymap, const struct interp_index *index,
+                 const struct xkb_key *key,
                  xkb_layout_index_t group, xkb_level_index_t level)
 {
     const xkb_keysym_t *syms;
     int num_syms;
+    unsigned int first = 0, last = 0, w = 0;
 
     num_syms = xkb_keymap_key_get_syms_by_level(keymap, key->keycode, group,
                                                 level, &syms);
     if (num_syms == 0)
         return NULL;
 
+    /*
+     * Only a level with a single keysym can match a specific interpret;
+     * find the range of those for this keysym.
+     */
+    if (num_syms == 1) {
+        unsigned int lo = 0, hi = index->num_by_sym;
+
+        while (lo < hi) {
+            unsigned int mid = lo + (hi - lo) / 2;
+            if (index->by_sym[mid].sym < syms[0])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        first = last = lo;
+        while (last < index->num_by_sym && index->by_sym[last].sym == syms[0])
+            last++;
+    }
+
     /*
      * There may be multiple matchings interprets; we should always return
      * the most specific. Here we rely on compat.c to set up the
      * sym_interprets array from the most specific to the least specific,
-     * such that when we find a match we return immediately.
+     * so we walk both candidate lists merged back into that order, and
+     * return as soon as we find a match.
      */
-    for (unsigned i = 0; i < keymap->num_sym_interprets; i++) {
-        const struct xkb_sym_interpret *interp = &keymap->sym_interprets[i];
+    while (first < last || w < index->num_wildcards) {
+        unsigned int idx;
 
-        xkb_mod_mask_t mods;
-        bool found = false;
-
-        if ((num_syms > 1 || interp->sym != syms[0]) &&
-            interp->sym != XKB_KEY_NoSymbol)
-            continue;
-
-        if (interp->level_one_only && level != 0)
-            mods = 0;
+        if (w >= index->num_wildcards ||
+            (first < last && index->by_sym[first].idx < index->wildcards[w]))
+            idx = index->by_sym[first++].idx;
         else
-            mods = key->modmap;
-
-        switch (interp->match) {
-        case MATCH_NONE:
-            found = !(interp->mods & mods);
-            break;
-        case MATCH_ANY_OR_NONE:
-            found = (!mods || (interp->mods & mods));
-            break;
-        case MATCH_ANY:
-            found = (interp->mods & mods);
-            break;
-        case MATCH_ALL:
-            found = ((interp->mods & mods) == interp->mods);
-            break;
-        case MATCH_EXACTLY:
-            found = (interp->mods == mods);
-            break;
-        }
+            idx = index->wildcards[w++];
 
-        if (found)
-            return interp;
+        if (InterpMatchesMods(&keymap->sym_interprets[idx], key, level))
+            return &keymap->sym_interprets[idx];
     }
 
     return &default_interpret;
 }
 
 static bool
-ApplyInterpsToKey(struct xkb_keymap *keymap, struct xkb_key *key)
+ApplyInterpsToKey(struct xkb_keymap *keymap, const struct interp_index *index,
+                  struct xkb_key *key)
 {
     xkb_mod_mask_t vmodmap = 0;
     xkb_layout_index_t group;
@@ -141,7 +239,7 @@ ApplyInterpsToKey(struct xkb_keymap *keymap, struct xkb_key *key)
         for (level = 0; level < XkbKeyNumLevels(key, group); level++) {
             const struct xkb_sym_interpret *interp;
 
-            interp = FindInterpForKey(keymap, key, group, level);
+            interp = FindInterpForKey(keymap, index, key, group, level);
             if (!interp)
                 continue;
 
@@ -177,13 +275,22 @@ UpdateDerivedKeymapFields(struct xkb_keymap *keymap)
     struct xkb_key *key;
     struct xkb_mod *mod;
     struct xkb_led *led;
+    struct interp_index index;
     unsigned int i, j;
 
+    if (!BuildInterpIndex(keymap, &index))
+        return false;
+
     /* Find all the interprets for the key and bind them to actions,
      * which will also update the vmodmap. */
-    xkb_keys_foreach(key, keymap)
-        if (!ApplyInterpsToKey(keymap, key))
+    xkb_keys_foreach(key, keymap) {
+        if (!ApplyInterpsToKey(keymap, &index, key)) {
+            FreeInterpIndex(&index);
             return false;
+        }
+    }
+
+    FreeInterpIndex(&index);
 
     /* Update keymap->mods, the virtual -> real mod mapping. */
     xkb_keys_foreach(key, keymap)
@@ -230,8 +337,15 @@ static const compile_file_fn compile_file_fns[LAST_KEYMAP_FILE_TYPE + 1] = {
     [FILE_TYPE_SYMBOLS] = CompileSymbols,
 };
 
+/*
+ * Compile the sections of type first to last of a keymap file into the
+ * keymap. The sections must be compiled in order: each one builds on what
+ * the previous ones left in the keymap.
+ */
 bool
-CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
+CompileKeymapSections(XkbFile *file, struct xkb_keymap *keymap,
+                      enum merge_mode merge,
+                      enum xkb_file_type first, enum xkb_file_type last)
 {
     bool ok;
     XkbFile *files[LAST_KEYMAP_FILE_TYPE + 1] = { NULL };
@@ -269,9 +383,7 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
      * Report everything before failing.
      */
     ok = true;
-    for (type = FIRST_KEYMAP_FILE_TYPE;
-         type <= LAST_KEYMAP_FILE_TYPE;
-         type++) {
+    for (type = first; type <= last; type++) {
         if (files[type] == NULL) {
             log_err(ctx, "Required section %s missing from keymap\n",
                     xkb_file_type_to_string(type));
@@ -282,9 +394,7 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
         return false;
 
     /* Compile sections. */
-    for (type = FIRST_KEYMAP_FILE_TYPE;
-         type <= LAST_KEYMAP_FILE_TYPE;
-         type++) {
+    for (type = first; type <= last; type++) {
         log_dbg(ctx, "Compiling %s \"%s\"\n",
                 xkb_file_type_to_string(type), files[type]->name);
 
@@ -296,5 +406,26 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
         }
     }
 
-    return UpdateDerivedKeymapFields(keymap);
+    return true;
+}
+
+/* Compute the derived fields of a keymap whose sections are all compiled. */
+bool
+FinalizeKeymap(struct xkb_keymap *keymap)
+{
+    if (!UpdateDerivedKeymapFields(keymap))
+        return false;
+
+    XkbPackKeyLevels(keymap);
+    XkbBuildKeysymPositions(keymap);
+    return true;
+}
+
+bool
+CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
+{
+    return CompileKeymapSections(file, keymap, merge,
+                                 FIRST_KEYMAP_FILE_TYPE,
+                                 LAST_KEYMAP_FILE_TYPE) &&
+           FinalizeKeymap(keymap);
 }
@@ -68,19 +68,23 @@ static unsigned char gperf_downcase[256] =
   };
 #endif
 
-#ifndef GPERF_CASE_STRCMP
-#define GPERF_CASE_STRCMP 1
+#ifndef GPERF_CASE_STRNCMP
+#define GPERF_CASE_STRNCMP 1
 static int
-gperf_case_strcmp (register const char *s1, register const char *s2)
+gperf_case_strncmp (register const char *s1, register const char *s2, register size_t n)
 {
-  for (;;)
+  for (; n > 0;)
     {
       unsigned char c1 = gperf_downcase[(unsigned char)*s1++];
       unsigned char c2 = gperf_downcase[(unsigned char)*s2++];
       if (c1 != 0 && c1 == c2)
-        continue;
+        {
+          n--;
+          continue;
+        }
       return (int)c1 - (int)c2;
     }
+  return 0;
 }
 #endif
 
@@ -369,7 +373,7 @@ keyword_gperf_lookup (register const char *str, register size_t len)
             {
               register const char *s = o + stringpool;
 
-              if ((((unsigned char)*str ^ (unsigned char)*s) & ~32) == 0 && !gperf_case_strcmp (str, s))
+              if ((((unsigned char)*str ^ (unsigned char)*s) & ~32) == 0 && !gperf_case_strncmp (str, s, len) && s[len] == '\0')
                 return &wordlist[key];
             }
         }
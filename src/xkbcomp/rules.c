@@ -52,6 +52,7 @@
 #include "xkbcomp-priv.h"
 #include "rules.h"
 #include "include.h"
+#include "bundle.h"
 #include "scanner-utils.h"
 
 #define MAX_INCLUDE_DEPTH 5
@@ -115,8 +116,7 @@ skip_more_whitespace_and_comments:
     if (scanner_eof(s)) return TOK_END_OF_FILE;
 
     /* New token. */
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
 
     /* Operators and punctuation. */
     if (scanner_chr(s, '!')) return TOK_BANG;
@@ -212,9 +212,21 @@ struct rule_names {
     darray_matched_sval options;
 };
 
+/*
+ * An insert-only linear probing hash index over the values of a
+ * darray_sval. The slots hold the position of a value in the array plus
+ * one, or 0 if empty. Only the first of equal values is indexed, so a
+ * lookup finds the same one as a linear search would.
+ */
+struct sval_index {
+    darray(uint32_t) slots;
+    unsigned int count;
+};
+
 struct group {
     struct sval name;
     darray_sval elements;
+    struct sval_index element_index;
 };
 
 struct mapping {
@@ -244,23 +256,39 @@ struct rule {
 };
 
 /*
- * This is the main object used to match a given RMLVO against a rules
- * file and aggragate the results in a KcCGST. It goes through a simple
- * matching state machine, with tokens as transitions (see
- * matcher_match()).
+ * An RMLVO being matched, and the KcCGST it resolves to.
+ */
+struct match_target {
+    struct rule_names rmlvo;
+    /* Where the KcCGST goes once the whole file is matched. */
+    struct xkb_component_names *out;
+    /* Whether the rest of the current rule set is skipped for it. */
+    bool skip;
+    darray_char kccgst[_KCCGST_NUM_ENTRIES];
+};
+
+/*
+ * This is the main object used to match one or more RMLVO against a rules
+ * file and aggragate the results of each in a KcCGST. It goes through a
+ * simple matching state machine, with tokens as transitions (see
+ * matcher_match()). Each rule is matched against all the RMLVO at once,
+ * so the file is only read once however many there are.
  */
 struct matcher {
     struct xkb_context *ctx;
-    /* Input.*/
-    struct rule_names rmlvo;
+    /* Input and output. */
+    darray(struct match_target) targets;
+    /* The targets not skipping the current rule set. */
+    unsigned int num_active_targets;
     union lvalue val;
     darray(struct group) groups;
+    /* Also hold the group names, for group_index. */
+    darray_sval group_names;
+    struct sval_index group_index;
     /* Current mapping. */
     struct mapping mapping;
     /* Current rule. */
     struct rule rule;
-    /* Output. */
-    darray_char kccgst[_KCCGST_NUM_ENTRIES];
 };
 
 static struct sval
@@ -299,38 +327,116 @@ split_comma_separated_mlvo(const char *s)
     return arr;
 }
 
+static uint32_t *
+sval_index_slot(struct sval_index *index, const darray_sval *vals,
+                struct sval val)
+{
+    const uint32_t mask = darray_size(index->slots) - 1;
+    uint32_t i = hash_buf(val.start, val.len) & mask;
+
+    while (darray_item(index->slots, i) != 0 &&
+           !svaleq(darray_item(*vals, darray_item(index->slots, i) - 1), val))
+        i = (i + 1) & mask;
+
+    return &darray_item(index->slots, i);
+}
+
+static bool
+sval_index_find(struct sval_index *index, const darray_sval *vals,
+                struct sval val, unsigned int *pos_out)
+{
+    uint32_t *slot;
+
+    if (index->count == 0)
+        return false;
+
+    slot = sval_index_slot(index, vals, val);
+    if (*slot == 0)
+        return false;
+
+    *pos_out = *slot - 1;
+    return true;
+}
+
+/* Index the last value of @vals. */
+static void
+sval_index_add_last(struct sval_index *index, const darray_sval *vals)
+{
+    const unsigned int pos = darray_size(*vals) - 1;
+    uint32_t *slot;
+
+    /* Keep the load factor under 1/2. */
+    if (2 * (index->count + 1) > darray_size(index->slots)) {
+        unsigned int size = darray_size(index->slots);
+
+        size = size ? 2 * size : 16;
+        darray_resize0(index->slots, 0);
+        darray_resize0(index->slots, size);
+        index->count = 0;
+        for (unsigned int i = 0; i < pos; i++) {
+            slot = sval_index_slot(index, vals, darray_item(*vals, i));
+            if (*slot == 0) {
+                *slot = i + 1;
+                index->count++;
+            }
+        }
+    }
+
+    slot = sval_index_slot(index, vals, darray_item(*vals, pos));
+    if (*slot == 0) {
+        *slot = pos + 1;
+        index->count++;
+    }
+}
+
 static struct matcher *
-matcher_new(struct xkb_context *ctx,
-            const struct xkb_rule_names *rmlvo)
+matcher_new(struct xkb_context *ctx)
 {
     struct matcher *m = calloc(1, sizeof(*m));
     if (!m)
         return NULL;
 
     m->ctx = ctx;
-    m->rmlvo.model.sval.start = rmlvo->model;
-    m->rmlvo.model.sval.len = strlen_safe(rmlvo->model);
-    m->rmlvo.layouts = split_comma_separated_mlvo(rmlvo->layout);
-    m->rmlvo.variants = split_comma_separated_mlvo(rmlvo->variant);
-    m->rmlvo.options = split_comma_separated_mlvo(rmlvo->options);
 
     return m;
 }
 
+static void
+matcher_add_target(struct matcher *m, const struct xkb_rule_names *rmlvo,
+                   struct xkb_component_names *out)
+{
+    struct match_target target = { .out = out };
+
+    target.rmlvo.model.sval.start = rmlvo->model;
+    target.rmlvo.model.sval.len = strlen_safe(rmlvo->model);
+    target.rmlvo.layouts = split_comma_separated_mlvo(rmlvo->layout);
+    target.rmlvo.variants = split_comma_separated_mlvo(rmlvo->variant);
+    target.rmlvo.options = split_comma_separated_mlvo(rmlvo->options);
+    darray_append(m->targets, target);
+}
+
 static void
 matcher_free(struct matcher *m)
 {
+    struct match_target *target;
     struct group *group;
     if (!m)
         return;
-    darray_free(m->rmlvo.layouts);
-    darray_free(m->rmlvo.variants);
-    darray_free(m->rmlvo.options);
-    darray_foreach(group, m->groups)
+    darray_foreach(target, m->targets) {
+        darray_free(target->rmlvo.layouts);
+        darray_free(target->rmlvo.variants);
+        darray_free(target->rmlvo.options);
+        for (int i = 0; i < _KCCGST_NUM_ENTRIES; i++)
+            darray_free(target->kccgst[i]);
+    }
+    darray_free(m->targets);
+    darray_foreach(group, m->groups) {
         darray_free(group->elements);
-    for (int i = 0; i < _KCCGST_NUM_ENTRIES; i++)
-        darray_free(m->kccgst[i]);
+        darray_free(group->element_index.slots);
+    }
     darray_free(m->groups);
+    darray_free(m->group_names);
+    darray_free(m->group_index.slots);
     free(m);
 }
 
@@ -339,14 +445,18 @@ matcher_group_start_new(struct matcher *m, struct sval name)
 {
     struct group group = { .name = name, .elements = darray_new() };
     darray_append(m->groups, group);
+    darray_append(m->group_names, name);
+    sval_index_add_last(&m->group_index, &m->group_names);
 }
 
 static void
 matcher_group_add_element(struct matcher *m, struct scanner *s,
                           struct sval element)
 {
-    darray_append(darray_item(m->groups, darray_size(m->groups) - 1).elements,
-                  element);
+    struct group *group = &darray_item(m->groups, darray_size(m->groups) - 1);
+
+    darray_append(group->elements, element);
+    sval_index_add_last(&group->element_index, &group->elements);
 }
 
 static bool
@@ -356,6 +466,39 @@ read_rules_file(struct xkb_context *ctx,
                 FILE *file,
                 const char *path);
 
+static bool
+read_rules_string(struct matcher *matcher,
+                  unsigned include_depth,
+                  const char *string,
+                  size_t size,
+                  const char *path);
+
+/*
+ * Look up a rules file of the system root in the include bundles, which
+ * hold snapshots of include roots and take precedence over them.
+ */
+static bool
+matcher_include_from_bundle(struct matcher *m, unsigned include_depth,
+                            const char *name, const char *path)
+{
+    struct xkb_bundle *bundle;
+    const char *string;
+    size_t size;
+
+    for (unsigned i = 0; i < xkb_context_num_include_paths(m->ctx); i++) {
+        bundle = xkb_context_include_path_get_bundle(m->ctx, i);
+        if (!bundle || !xkb_bundle_find(bundle, "rules", name,
+                                        &string, &size))
+            continue;
+
+        if (!read_rules_string(m, include_depth, string, size, path))
+            log_err(m->ctx, "No components returned from included XKB rules \"%s\"\n", path);
+        return true;
+    }
+
+    return false;
+}
+
 static void
 matcher_include(struct matcher *m, struct scanner *parent_scanner,
                 unsigned include_depth,
@@ -363,11 +506,11 @@ matcher_include(struct matcher *m, struct scanner *parent_scanner,
 {
     struct scanner s; /* parses the !include value */
     FILE *file;
+    size_t system_rules_end = 0;
 
     scanner_init(&s, m->ctx, inc.start, inc.len,
                  parent_scanner->file_name, NULL);
-    s.token_line = parent_scanner->token_line;
-    s.token_column = parent_scanner->token_column;
+    scanner_token_location(parent_scanner, &s.fixed_line, &s.fixed_column);
     s.buf_pos = 0;
 
     if (include_depth >= MAX_INCLUDE_DEPTH) {
@@ -394,10 +537,13 @@ matcher_include(struct matcher *m, struct scanner *parent_scanner,
             }
             else if (scanner_chr(&s, 'S')) {
                 const char *default_root = xkb_context_include_path_get_system_path(m->ctx);
+                bool leading = s.buf_pos == 0;
                 if (!scanner_buf_appends(&s, default_root) || !scanner_buf_appends(&s, "/rules")) {
                     scanner_err(&s, "include path after expanding %%S is too long");
                     return;
                 }
+                if (leading)
+                    system_rules_end = s.buf_pos;
             }
             else if (scanner_chr(&s, 'E')) {
                 const char *default_root = xkb_context_include_path_get_extra_path(m->ctx);
@@ -420,6 +566,11 @@ matcher_include(struct matcher *m, struct scanner *parent_scanner,
         return;
     }
 
+    if (system_rules_end > 0 && s.buf[system_rules_end] == '/' &&
+        matcher_include_from_bundle(m, include_depth + 1,
+                                    s.buf + system_rules_end + 1, s.buf))
+        return;
+
     file = fopen(s.buf, "rb");
     if (file) {
         bool ret = read_rules_file(m->ctx, m, include_depth + 1, file, s.buf);
@@ -445,6 +596,15 @@ matcher_mapping_start_new(struct matcher *m)
     m->mapping.skip = false;
 }
 
+/* Skip the rest of the current rule set for @target. */
+static void
+matcher_target_skip_mapping(struct matcher *m, struct match_target *target)
+{
+    target->skip = true;
+    if (--m->num_active_targets == 0)
+        m->mapping.skip = true;
+}
+
 static int
 extract_layout_index(const char *s, size_t max_len, xkb_layout_index_t *out)
 {
@@ -554,19 +714,9 @@ matcher_mapping_set_kccgst(struct matcher *m, struct scanner *s, struct sval ide
     m->mapping.num_kccgst++;
 }
 
-static void
-matcher_mapping_verify(struct matcher *m, struct scanner *s)
+static bool
+matcher_mapping_applies_to(struct matcher *m, struct match_target *target)
 {
-    if (m->mapping.num_mlvo == 0) {
-        scanner_err(s, "invalid mapping: must have at least one value on the left hand side; ignoring rule set");
-        goto skip;
-    }
-
-    if (m->mapping.num_kccgst == 0) {
-        scanner_err(s, "invalid mapping: must have at least one value on the right hand side; ignoring rule set");
-        goto skip;
-    }
-
     /*
      * This following is very stupid, but this is how it works.
      * See the "Notes" section in the overview above.
@@ -574,28 +724,53 @@ matcher_mapping_verify(struct matcher *m, struct scanner *s)
 
     if (m->mapping.defined_mlvo_mask & (1u << MLVO_LAYOUT)) {
         if (m->mapping.layout_idx == XKB_LAYOUT_INVALID) {
-            if (darray_size(m->rmlvo.layouts) > 1)
-                goto skip;
+            if (darray_size(target->rmlvo.layouts) > 1)
+                return false;
         }
         else {
-            if (darray_size(m->rmlvo.layouts) == 1 ||
-                m->mapping.layout_idx >= darray_size(m->rmlvo.layouts))
-                goto skip;
+            if (darray_size(target->rmlvo.layouts) == 1 ||
+                m->mapping.layout_idx >= darray_size(target->rmlvo.layouts))
+                return false;
         }
     }
 
     if (m->mapping.defined_mlvo_mask & (1u << MLVO_VARIANT)) {
         if (m->mapping.variant_idx == XKB_LAYOUT_INVALID) {
-            if (darray_size(m->rmlvo.variants) > 1)
-                goto skip;
+            if (darray_size(target->rmlvo.variants) > 1)
+                return false;
         }
         else {
-            if (darray_size(m->rmlvo.variants) == 1 ||
-                m->mapping.variant_idx >= darray_size(m->rmlvo.variants))
-                goto skip;
+            if (darray_size(target->rmlvo.variants) == 1 ||
+                m->mapping.variant_idx >= darray_size(target->rmlvo.variants))
+                return false;
         }
     }
 
+    return true;
+}
+
+static void
+matcher_mapping_verify(struct matcher *m, struct scanner *s)
+{
+    struct match_target *target;
+
+    if (m->mapping.num_mlvo == 0) {
+        scanner_err(s, "invalid mapping: must have at least one value on the left hand side; ignoring rule set");
+        goto skip;
+    }
+
+    if (m->mapping.num_kccgst == 0) {
+        scanner_err(s, "invalid mapping: must have at least one value on the right hand side; ignoring rule set");
+        goto skip;
+    }
+
+    m->num_active_targets = darray_size(m->targets);
+    darray_foreach(target, m->targets) {
+        target->skip = false;
+        if (!matcher_mapping_applies_to(m, target))
+            matcher_target_skip_mapping(m, target);
+    }
+
     return;
 
 skip:
@@ -662,17 +837,9 @@ static bool
 match_group(struct matcher *m, struct sval group_name, struct sval to)
 {
     struct group *group;
-    struct sval *element;
-    bool found = false;
+    unsigned int pos;
 
-    darray_foreach(group, m->groups) {
-        if (svaleq(group->name, group_name)) {
-            found = true;
-            break;
-        }
-    }
-
-    if (!found) {
+    if (!sval_index_find(&m->group_index, &m->group_names, group_name, &pos)) {
         /*
          * rules/evdev intentionally uses some undeclared group names
          * in rules (e.g. commented group definitions which may be
@@ -681,11 +848,8 @@ match_group(struct matcher *m, struct sval group_name, struct sval to)
         return false;
     }
 
-    darray_foreach(element, group->elements)
-        if (svaleq(to, *element))
-            return true;
-
-    return false;
+    group = &darray_item(m->groups, pos);
+    return sval_index_find(&group->element_index, &group->elements, to, &pos);
 }
 
 static bool
@@ -715,6 +879,7 @@ match_value_and_mark(struct matcher *m, struct sval val,
  */
 static bool
 append_expanded_kccgst_value(struct matcher *m, struct scanner *s,
+                             struct match_target *target,
                              darray_char *to, struct sval value)
 {
     const char *str = value.start;
@@ -784,24 +949,24 @@ append_expanded_kccgst_value(struct matcher *m, struct scanner *s,
 
         if (mlv == MLVO_LAYOUT) {
             if (idx != XKB_LAYOUT_INVALID &&
-                idx < darray_size(m->rmlvo.layouts) &&
-                darray_size(m->rmlvo.layouts) > 1)
-                expanded_value = &darray_item(m->rmlvo.layouts, idx);
+                idx < darray_size(target->rmlvo.layouts) &&
+                darray_size(target->rmlvo.layouts) > 1)
+                expanded_value = &darray_item(target->rmlvo.layouts, idx);
             else if (idx == XKB_LAYOUT_INVALID &&
-                     darray_size(m->rmlvo.layouts) == 1)
-                expanded_value = &darray_item(m->rmlvo.layouts, 0);
+                     darray_size(target->rmlvo.layouts) == 1)
+                expanded_value = &darray_item(target->rmlvo.layouts, 0);
         }
         else if (mlv == MLVO_VARIANT) {
             if (idx != XKB_LAYOUT_INVALID &&
-                idx < darray_size(m->rmlvo.variants) &&
-                darray_size(m->rmlvo.variants) > 1)
-                expanded_value = &darray_item(m->rmlvo.variants, idx);
+                idx < darray_size(target->rmlvo.variants) &&
+                darray_size(target->rmlvo.variants) > 1)
+                expanded_value = &darray_item(target->rmlvo.variants, idx);
             else if (idx == XKB_LAYOUT_INVALID &&
-                     darray_size(m->rmlvo.variants) == 1)
-                expanded_value = &darray_item(m->rmlvo.variants, 0);
+                     darray_size(target->rmlvo.variants) == 1)
+                expanded_value = &darray_item(target->rmlvo.variants, 0);
         }
         else if (mlv == MLVO_MODEL) {
-            expanded_value = &m->rmlvo.model;
+            expanded_value = &target->rmlvo.model;
         }
 
         /* If we didn't get one, skip silently. */
@@ -855,7 +1020,8 @@ matcher_rule_verify(struct matcher *m, struct scanner *s)
 }
 
 static void
-matcher_rule_apply_if_matches(struct matcher *m, struct scanner *s)
+matcher_rule_apply_if_matches(struct matcher *m, struct scanner *s,
+                              struct match_target *target)
 {
     for (unsigned i = 0; i < m->mapping.num_mlvo; i++) {
         enum rules_mlvo mlvo = m->mapping.mlvo_at_pos[i];
@@ -865,23 +1031,23 @@ matcher_rule_apply_if_matches(struct matcher *m, struct scanner *s)
         bool matched = false;
 
         if (mlvo == MLVO_MODEL) {
-            to = &m->rmlvo.model;
+            to = &target->rmlvo.model;
             matched = match_value_and_mark(m, value, to, match_type);
         }
         else if (mlvo == MLVO_LAYOUT) {
             xkb_layout_index_t idx = m->mapping.layout_idx;
             idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
-            to = &darray_item(m->rmlvo.layouts, idx);
+            to = &darray_item(target->rmlvo.layouts, idx);
             matched = match_value_and_mark(m, value, to, match_type);
         }
         else if (mlvo == MLVO_VARIANT) {
             xkb_layout_index_t idx = m->mapping.layout_idx;
             idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
-            to = &darray_item(m->rmlvo.variants, idx);
+            to = &darray_item(target->rmlvo.variants, idx);
             matched = match_value_and_mark(m, value, to, match_type);
         }
         else if (mlvo == MLVO_OPTION) {
-            darray_foreach(to, m->rmlvo.options) {
+            darray_foreach(to, target->rmlvo.options) {
                 matched = match_value_and_mark(m, value, to, match_type);
                 if (matched)
                     break;
@@ -895,7 +1061,8 @@ matcher_rule_apply_if_matches(struct matcher *m, struct scanner *s)
     for (unsigned i = 0; i < m->mapping.num_kccgst; i++) {
         enum rules_kccgst kccgst = m->mapping.kccgst_at_pos[i];
         struct sval value = m->rule.kccgst_value_at_pos[i];
-        append_expanded_kccgst_value(m, s, &m->kccgst[kccgst], value);
+        append_expanded_kccgst_value(m, s, target, &target->kccgst[kccgst],
+                                     value);
     }
 
     /*
@@ -904,7 +1071,17 @@ matcher_rule_apply_if_matches(struct matcher *m, struct scanner *s)
      * several legitimate rules, so they are processed entirely.
      */
     if (!(m->mapping.defined_mlvo_mask & (1 << MLVO_OPTION)))
-        m->mapping.skip = true;
+        matcher_target_skip_mapping(m, target);
+}
+
+static void
+matcher_rule_apply(struct matcher *m, struct scanner *s)
+{
+    struct match_target *target;
+
+    darray_foreach(target, m->targets)
+        if (!target->skip)
+            matcher_rule_apply_if_matches(m, s, target);
 }
 
 static enum rules_token
@@ -1050,7 +1227,7 @@ rule_kccgst:
         if (!m->rule.skip)
             matcher_rule_verify(m, s);
         if (!m->rule.skip)
-            matcher_rule_apply_if_matches(m, s);
+            matcher_rule_apply(m, s);
         goto rule_mlvo_first;
     default:
         goto unexpected;
@@ -1073,6 +1250,20 @@ error:
     return false;
 }
 
+static bool
+read_rules_string(struct matcher *matcher,
+                  unsigned include_depth,
+                  const char *string,
+                  size_t size,
+                  const char *path)
+{
+    struct scanner scanner;
+
+    scanner_init(&scanner, matcher->ctx, string, size, path, NULL);
+
+    return matcher_match(matcher, &scanner, include_depth, string, size, path);
+}
+
 static bool
 read_rules_file(struct xkb_context *ctx,
                 struct matcher *matcher,
@@ -1083,81 +1274,148 @@ read_rules_file(struct xkb_context *ctx,
     bool ret = false;
     char *string;
     size_t size;
-    struct scanner scanner;
 
-    ret = map_file(file, &string, &size);
+    ret = xkb_context_map_file(ctx, file, &string, &size);
     if (!ret) {
         log_err(ctx, "Couldn't read rules file \"%s\": %s\n",
                 path, strerror(errno));
         goto out;
     }
 
-    scanner_init(&scanner, matcher->ctx, string, size, path, NULL);
-
-    ret = matcher_match(matcher, &scanner, include_depth, string, size, path);
+    ret = read_rules_string(matcher, include_depth, string, size, path);
 
-    unmap_file(string, size);
+    xkb_context_unmap_file(ctx, string, size);
 out:
     return ret;
 }
 
-bool
-xkb_components_from_rules(struct xkb_context *ctx,
-                          const struct xkb_rule_names *rmlvo,
-                          struct xkb_component_names *out)
+/* Hand the KcCGST of @target over to its output. */
+static bool
+matcher_target_finish(struct matcher *m, struct match_target *target,
+                      const char *path)
 {
-    bool ret = false;
-    FILE *file;
-    char *path = NULL;
-    struct matcher *matcher = NULL;
     struct matched_sval *mval;
-    unsigned int offset = 0;
-
-    file = FindFileInXkbPath(ctx, rmlvo->rules, FILE_TYPE_RULES, &path, &offset);
-    if (!file)
-        goto err_out;
 
-    matcher = matcher_new(ctx, rmlvo);
-
-    ret = read_rules_file(ctx, matcher, 0, file, path);
-    if (!ret ||
-        darray_empty(matcher->kccgst[KCCGST_KEYCODES]) ||
-        darray_empty(matcher->kccgst[KCCGST_TYPES]) ||
-        darray_empty(matcher->kccgst[KCCGST_COMPAT]) ||
-        /* darray_empty(matcher->kccgst[KCCGST_GEOMETRY]) || */
-        darray_empty(matcher->kccgst[KCCGST_SYMBOLS])) {
-        log_err(ctx, "No components returned from XKB rules \"%s\"\n", path);
-        ret = false;
-        goto err_out;
+    if (darray_empty(target->kccgst[KCCGST_KEYCODES]) ||
+        darray_empty(target->kccgst[KCCGST_TYPES]) ||
+        darray_empty(target->kccgst[KCCGST_COMPAT]) ||
+        /* darray_empty(target->kccgst[KCCGST_GEOMETRY]) || */
+        darray_empty(target->kccgst[KCCGST_SYMBOLS])) {
+        log_err(m->ctx, "No components returned from XKB rules \"%s\"\n", path);
+        return false;
     }
 
-    darray_steal(matcher->kccgst[KCCGST_KEYCODES], &out->keycodes, NULL);
-    darray_steal(matcher->kccgst[KCCGST_TYPES], &out->types, NULL);
-    darray_steal(matcher->kccgst[KCCGST_COMPAT], &out->compat, NULL);
-    darray_steal(matcher->kccgst[KCCGST_SYMBOLS], &out->symbols, NULL);
-    darray_free(matcher->kccgst[KCCGST_GEOMETRY]);
+    darray_steal(target->kccgst[KCCGST_KEYCODES], &target->out->keycodes, NULL);
+    darray_steal(target->kccgst[KCCGST_TYPES], &target->out->types, NULL);
+    darray_steal(target->kccgst[KCCGST_COMPAT], &target->out->compat, NULL);
+    darray_steal(target->kccgst[KCCGST_SYMBOLS], &target->out->symbols, NULL);
 
-    mval = &matcher->rmlvo.model;
+    mval = &target->rmlvo.model;
     if (!mval->matched && mval->sval.len > 0)
-        log_err(matcher->ctx, "Unrecognized RMLVO model \"%.*s\" was ignored\n",
+        log_err(m->ctx, "Unrecognized RMLVO model \"%.*s\" was ignored\n",
                 mval->sval.len, mval->sval.start);
-    darray_foreach(mval, matcher->rmlvo.layouts)
+    darray_foreach(mval, target->rmlvo.layouts)
         if (!mval->matched && mval->sval.len > 0)
-            log_err(matcher->ctx, "Unrecognized RMLVO layout \"%.*s\" was ignored\n",
+            log_err(m->ctx, "Unrecognized RMLVO layout \"%.*s\" was ignored\n",
                     mval->sval.len, mval->sval.start);
-    darray_foreach(mval, matcher->rmlvo.variants)
+    darray_foreach(mval, target->rmlvo.variants)
         if (!mval->matched && mval->sval.len > 0)
-            log_err(matcher->ctx, "Unrecognized RMLVO variant \"%.*s\" was ignored\n",
+            log_err(m->ctx, "Unrecognized RMLVO variant \"%.*s\" was ignored\n",
                     mval->sval.len, mval->sval.start);
-    darray_foreach(mval, matcher->rmlvo.options)
+    darray_foreach(mval, target->rmlvo.options)
         if (!mval->matched && mval->sval.len > 0)
-            log_err(matcher->ctx, "Unrecognized RMLVO option \"%.*s\" was ignored\n",
+            log_err(m->ctx, "Unrecognized RMLVO option \"%.*s\" was ignored\n",
                     mval->sval.len, mval->sval.start);
 
+    return true;
+}
+
+/*
+ * Resolve all the RMLVO in @rmlvos which use the same rules as the first
+ * one, in a single pass over the rules file.
+ */
+static bool
+components_from_rules_file(struct xkb_context *ctx,
+                           const struct xkb_rule_names *rmlvos, size_t count,
+                           struct xkb_component_names *out)
+{
+    bool ret = false;
+    bool found;
+    struct include_file file;
+    char *path = NULL;
+    struct matcher *matcher = NULL;
+    struct match_target *target;
+    unsigned int offset = 0;
+
+    found = FindFileInXkbPath(ctx, rmlvos[0].rules, FILE_TYPE_RULES, &path,
+                              &offset, &file);
+    if (!found)
+        goto err_out;
+
+    matcher = matcher_new(ctx);
+    if (!matcher)
+        goto err_out;
+
+    for (size_t i = 0; i < count; i++)
+        if (streq_null(rmlvos[i].rules, rmlvos[0].rules))
+            matcher_add_target(matcher, &rmlvos[i], &out[i]);
+
+    ret = read_rules_string(matcher, 0, file.string, file.size, path);
+    if (!ret) {
+        log_err(ctx, "No components returned from XKB rules \"%s\"\n", path);
+        goto err_out;
+    }
+
+    darray_foreach(target, matcher->targets)
+        if (!matcher_target_finish(matcher, target, path))
+            ret = false;
+
 err_out:
-    if (file)
-        fclose(file);
+    if (found)
+        ReleaseIncludeFile(ctx, &file);
     matcher_free(matcher);
     free(path);
     return ret;
 }
+
+bool
+xkb_components_from_rules_batch(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvos,
+                                size_t count,
+                                struct xkb_component_names *out)
+{
+    bool ret = true;
+
+    memset(out, 0, count * sizeof(*out));
+
+    for (size_t i = 0; i < count; i++) {
+        bool done = false;
+
+        /* Already resolved with an earlier RMLVO using the same rules? */
+        for (size_t j = 0; j < i && !done; j++)
+            done = streq_null(rmlvos[j].rules, rmlvos[i].rules);
+        if (done)
+            continue;
+
+        if (!components_from_rules_file(ctx, &rmlvos[i], count - i, &out[i]))
+            ret = false;
+    }
+
+    return ret;
+}
+
+bool
+xkb_components_from_rules(struct xkb_context *ctx,
+                          const struct xkb_rule_names *rmlvo,
+                          struct xkb_component_names *out)
+{
+    if (!xkb_components_from_rules_batch(ctx, rmlvo, 1, out)) {
+        free(out->keycodes);
+        free(out->types);
+        free(out->compat);
+        free(out->symbols);
+        return false;
+    }
+
+    return true;
+}
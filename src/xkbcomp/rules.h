@@ -29,4 +29,15 @@ xkb_components_from_rules(struct xkb_context *ctx,
                           const struct xkb_rule_names *rmlvo,
                           struct xkb_component_names *out);
 
+/*
+ * Resolve several RMLVO at once. Those using the same rules are matched
+ * together, in a single pass over the rules file. The components of the
+ * ones which could not be resolved are left NULL, and false is returned.
+ */
+bool
+xkb_components_from_rules_batch(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvos,
+                                size_t count,
+                                struct xkb_component_names *out);
+
 #endif
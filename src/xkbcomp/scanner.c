@@ -62,31 +62,98 @@ number(struct scanner *s, int64_t *out, int *out_tok)
     return true;
 }
 
+/*
+ * The helpers below are the fast paths of the lexer: they work on the
+ * buffer directly, without going through scanner_peek()/scanner_next()
+ * for every byte. Comments and string literals are searched with
+ * memchr(), which the C library vectorizes.
+ */
+
+static inline bool
+is_ident_char(char ch)
+{
+    return is_alnum(ch) || ch == '_';
+}
+
+static inline void
+skip_whitespace_and_comments(struct scanner *s)
+{
+    const char *p = s->s + s->pos;
+    const char *end = s->s + s->len;
+
+    for (;;) {
+        while (p < end && is_space(*p))
+            p++;
+        if (p < end && (*p == '#' || (*p == '/' && p + 1 < end && p[1] == '/'))) {
+            p = memchr(p, '\n', end - p);
+            if (!p)
+                p = end;
+            continue;
+        }
+        break;
+    }
+
+    s->pos = p - s->s;
+}
+
+/* Returns the length of the identifier at the current position. */
+static inline size_t
+ident_length(struct scanner *s)
+{
+    const char *start = s->s + s->pos;
+    const char *end = s->s + s->len;
+    const char *p = start;
+
+    while (p < end && is_ident_char(*p))
+        p++;
+
+    return p - start;
+}
+
+/*
+ * Gets the length of the string literal body at the current position,
+ * if it can be used verbatim: terminated on the same line and without
+ * escape sequences.
+ */
+static inline bool
+simple_string_length(struct scanner *s, size_t *len_out)
+{
+    const char *start = s->s + s->pos;
+    const char *quote = memchr(start, '\"', s->len - s->pos);
+
+    if (!quote ||
+        memchr(start, '\\', quote - start) ||
+        memchr(start, '\n', quote - start))
+        return false;
+
+    *len_out = quote - start;
+    return true;
+}
+
 int
 _xkbcommon_lex(YYSTYPE *yylval, struct scanner *s)
 {
     int tok;
 
-skip_more_whitespace_and_comments:
-    /* Skip spaces. */
-    while (is_space(scanner_peek(s))) scanner_next(s);
-
-    /* Skip comments. */
-    if (scanner_lit(s, "//") || scanner_chr(s, '#')) {
-        scanner_skip_to_eol(s);
-        goto skip_more_whitespace_and_comments;
-    }
+    skip_whitespace_and_comments(s);
 
     /* See if we're done. */
     if (scanner_eof(s)) return END_OF_FILE;
 
     /* New token. */
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
     s->buf_pos = 0;
 
     /* String literal. */
     if (scanner_chr(s, '\"')) {
+        size_t len;
+        if (simple_string_length(s, &len)) {
+            yylval->sval.start = s->s + s->pos;
+            yylval->sval.len = len;
+            s->pos += len + 1;
+            return STRING;
+        }
+
         while (!scanner_eof(s) && !scanner_eol(s) && scanner_peek(s) != '\"') {
             if (scanner_chr(s, '\\')) {
                 uint8_t o;
@@ -111,22 +178,33 @@ skip_more_whitespace_and_comments:
             scanner_err(s, "unterminated string literal");
             return ERROR_TOK;
         }
-        yylval->str = strdup(s->buf);
-        if (!yylval->str)
+        /*
+         * The unescaped string is not in the source buffer, and must
+         * outlive the scanner buffer (the parser may look ahead), so
+         * keep it in the atom table.
+         */
+        xkb_atom_t atom = xkb_atom_intern(s->ctx, s->buf, strlen(s->buf));
+        if (atom == XKB_ATOM_NONE) {
+            scanner_err(s, "failed to store string literal");
             return ERROR_TOK;
+        }
+        yylval->sval.start = xkb_atom_text(s->ctx, atom);
+        yylval->sval.len = strlen(s->buf);
         return STRING;
     }
 
     /* Key name literal. */
     if (scanner_chr(s, '<')) {
+        const char *start = s->s + s->pos;
         while (is_graph(scanner_peek(s)) && scanner_peek(s) != '>')
-            scanner_buf_append(s, scanner_next(s));
-        if (!scanner_buf_append(s, '\0') || !scanner_chr(s, '>')) {
+            s->pos++;
+        if (!scanner_chr(s, '>')) {
             scanner_err(s, "unterminated key name literal");
             return ERROR_TOK;
         }
         /* Empty key name literals are allowed. */
-        yylval->atom = xkb_atom_intern(s->ctx, s->buf, s->buf_pos - 1);
+        yylval->atom = xkb_atom_intern(s->ctx, start,
+                                       s->s + s->pos - 1 - start);
         return KEYNAME;
     }
 
@@ -150,21 +228,17 @@ skip_more_whitespace_and_comments:
 
     /* Identifier. */
     if (is_alpha(scanner_peek(s)) || scanner_peek(s) == '_') {
-        s->buf_pos = 0;
-        while (is_alnum(scanner_peek(s)) || scanner_peek(s) == '_')
-            scanner_buf_append(s, scanner_next(s));
-        if (!scanner_buf_append(s, '\0')) {
-            scanner_err(s, "identifier too long");
-            return ERROR_TOK;
-        }
+        const char *start = s->s + s->pos;
+        size_t len = ident_length(s);
+
+        s->pos += len;
 
         /* Keyword. */
-        tok = keyword_to_token(s->buf, s->buf_pos - 1);
+        tok = keyword_to_token(start, len);
         if (tok != -1) return tok;
 
-        yylval->str = strdup(s->buf);
-        if (!yylval->str)
-            return ERROR_TOK;
+        yylval->sval.start = start;
+        yylval->sval.len = len;
         return IDENT;
     }
 
@@ -181,11 +255,160 @@ skip_more_whitespace_and_comments:
     return ERROR_TOK;
 }
 
+/*
+ * A file may contain many maps, of which an include statement only needs
+ * one, e.g. symbols/us(intl). To avoid parsing all the maps before it,
+ * the file is first scanned for the top-level maps, by matching braces
+ * (skipping comments, strings and key names, as the lexer does), and only
+ * the requested map is parsed. The index is kept with the file contents
+ * in the context, so a file is only scanned once.
+ */
+struct map_range {
+    size_t start, end;
+    size_t name_pos, name_len;
+    bool named;
+};
+
+struct map_index {
+    /* False if the file could not be scanned; it is then parsed whole. */
+    bool valid;
+    darray(struct map_range) maps;
+};
+
+static void
+map_index_free(void *data)
+{
+    struct map_index *index = data;
+
+    darray_free(index->maps);
+    free(index);
+}
+
+static bool
+map_index_scan(struct map_index *index, struct scanner *s)
+{
+    struct map_range map = { 0 };
+    bool in_map = false;
+    unsigned int depth = 0;
+    const char *p;
+
+    for (;;) {
+        skip_whitespace_and_comments(s);
+        if (scanner_eof(s))
+            return !in_map;
+
+        if (!in_map) {
+            map = (struct map_range) { .start = s->pos };
+            in_map = true;
+        }
+
+        switch (s->s[s->pos++]) {
+        case '"':
+            p = memchr(s->s + s->pos, '"', s->len - s->pos);
+            if (!p || memchr(s->s + s->pos, '\n', p - (s->s + s->pos)))
+                return false;
+            /* Escapes are only resolved by the lexer; leave those out. */
+            if (depth == 0 &&
+                !memchr(s->s + s->pos, '\\', p - (s->s + s->pos))) {
+                map.name_pos = s->pos;
+                map.name_len = p - (s->s + s->pos);
+                map.named = true;
+            }
+            s->pos = p - s->s + 1;
+            break;
+        case '<':
+            while (is_graph(scanner_peek(s)) && scanner_peek(s) != '>')
+                s->pos++;
+            if (!scanner_chr(s, '>'))
+                return false;
+            break;
+        case '{':
+            depth++;
+            break;
+        case '}':
+            if (depth == 0)
+                return false;
+            if (--depth > 0)
+                break;
+            skip_whitespace_and_comments(s);
+            scanner_chr(s, ';');
+            map.end = s->pos;
+            darray_append(index->maps, map);
+            in_map = false;
+            break;
+        }
+    }
+}
+
+static struct map_index *
+map_index_new(struct xkb_context *ctx, const char *string, size_t len)
+{
+    struct scanner scanner;
+    struct map_index *index = calloc(1, sizeof(*index));
+
+    if (!index)
+        return NULL;
+
+    scanner_init(&scanner, ctx, string, len, NULL, NULL);
+    index->valid = map_index_scan(index, &scanner);
+    return index;
+}
+
+static const struct map_range *
+map_index_find(struct map_index *index, const char *string, const char *map)
+{
+    const struct map_range *range;
+    size_t len = strlen(map);
+
+    darray_foreach(range, index->maps)
+        if (range->named && range->name_len == len &&
+            memcmp(string + range->name_pos, map, len) == 0)
+            return range;
+
+    return NULL;
+}
+
+static XkbFile *
+parse_indexed(struct xkb_context *ctx, const char *string, size_t len,
+              const char *file_name, const char *map)
+{
+    struct scanner scanner;
+    struct map_index *index = xkb_context_get_file_data(ctx, string);
+    bool cached = index != NULL;
+    const struct map_range *range = NULL;
+    XkbFile *xkb_file;
+
+    if (!index)
+        index = map_index_new(ctx, string, len);
+    if (index && index->valid)
+        range = map_index_find(index, string, map);
+
+    /*
+     * Only the range of the map is parsed; the scanner still covers the
+     * start of the file, so that the locations reported are right.
+     */
+    scanner_init(&scanner, ctx, string, range ? range->end : len,
+                 file_name, NULL);
+    if (range)
+        scanner.pos = range->start;
+    xkb_file = parse(ctx, &scanner, map);
+
+    if (index && !cached &&
+        !xkb_context_set_file_data(ctx, string, index, map_index_free))
+        map_index_free(index);
+
+    return xkb_file;
+}
+
 XkbFile *
 XkbParseString(struct xkb_context *ctx, const char *string, size_t len,
                const char *file_name, const char *map)
 {
     struct scanner scanner;
+
+    if (map)
+        return parse_indexed(ctx, string, len, file_name, map);
+
     scanner_init(&scanner, ctx, string, len, file_name, NULL);
     return parse(ctx, &scanner, map);
 }
@@ -199,7 +422,7 @@ XkbParseFile(struct xkb_context *ctx, FILE *file,
     char *string;
     size_t size;
 
-    ok = map_file(file, &string, &size);
+    ok = xkb_context_map_file(ctx, file, &string, &size);
     if (!ok) {
         log_err(ctx, "Couldn't read XKB file %s: %s\n",
                 file_name, strerror(errno));
@@ -207,6 +430,6 @@ XkbParseFile(struct xkb_context *ctx, FILE *file,
     }
 
     xkb_file = XkbParseString(ctx, string, size, file_name, map);
-    unmap_file(string, size);
+    xkb_context_unmap_file(ctx, string, size);
     return xkb_file;
 }
@@ -559,8 +559,7 @@ HandleIncludeSymbols(SymbolsInfo *info, IncludeStmt *include)
     SymbolsInfo included;
 
     InitSymbolsInfo(&included, info->keymap, info->actions, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         SymbolsInfo next_incl;
@@ -1244,42 +1243,102 @@ HandleSymbolsFile(SymbolsInfo *info, XkbFile *file, enum merge_mode merge)
     }
 }
 
-/**
- * Given a keysym @sym, return a key which generates it, or NULL.
- * This is used for example in a modifier map definition, such as:
+/*
+ * Reverse index from keysyms to the keys which generate them, used to
+ * resolve the keysyms of the modifier maps, such as:
  *      modifier_map Lock           { Caps_Lock };
  * where we want to add the Lock modifier to the modmap of the key
  * which matches the keysym Caps_Lock.
  * Since there can be many keys which generates the keysym, the key
  * is chosen first by lowest group in which the keysym appears, than
- * by lowest level and than by lowest key code.
+ * by lowest level and than by lowest key code. The index only keeps
+ * that key for each keysym.
  */
-static struct xkb_key *
-FindKeyForSymbol(struct xkb_keymap *keymap, xkb_keysym_t sym)
+struct keysym_key_entry {
+    xkb_keysym_t sym;
+    xkb_layout_index_t group;
+    xkb_level_index_t level;
+    xkb_keycode_t keycode;
+};
+
+typedef darray(struct keysym_key_entry) KeysymKeyIndex;
+
+static int
+cmp_keysym_key_entry(const void *a, const void *b)
+{
+    const struct keysym_key_entry *ea = a, *eb = b;
+
+    if (ea->sym != eb->sym)
+        return ea->sym < eb->sym ? -1 : 1;
+    if (ea->group != eb->group)
+        return ea->group < eb->group ? -1 : 1;
+    if (ea->level != eb->level)
+        return ea->level < eb->level ? -1 : 1;
+    return ea->keycode < eb->keycode ? -1 : (ea->keycode > eb->keycode);
+}
+
+static void
+BuildKeysymKeyIndex(struct xkb_keymap *keymap, KeysymKeyIndex *index)
 {
     struct xkb_key *key;
-    xkb_layout_index_t group;
-    bool got_one_group, got_one_level;
-
-    group = 0;
-    do {
-        xkb_level_index_t level = 0;
-        got_one_group = false;
-        do {
-            got_one_level = false;
-            xkb_keys_foreach(key, keymap) {
-                if (group < key->num_groups &&
-                    level < XkbKeyNumLevels(key, group)) {
-                    got_one_group = got_one_level = true;
-                    if (key->groups[group].levels[level].num_syms == 1 &&
-                        key->groups[group].levels[level].u.sym == sym)
-                        return key;
-                }
+    unsigned int i, n;
+
+    darray_init(*index);
+
+    xkb_keys_foreach(key, keymap) {
+        for (xkb_layout_index_t group = 0; group < key->num_groups; group++) {
+            for (xkb_level_index_t level = 0;
+                 level < XkbKeyNumLevels(key, group); level++) {
+                const struct xkb_level *leveli =
+                    &key->groups[group].levels[level];
+                struct keysym_key_entry entry = {
+                    .sym = leveli->u.sym,
+                    .group = group,
+                    .level = level,
+                    .keycode = key->keycode,
+                };
+
+                if (leveli->num_syms == 1)
+                    darray_append(*index, entry);
             }
-            level++;
-        } while (got_one_level);
-        group++;
-    } while (got_one_group);
+        }
+    }
+
+    if (darray_size(*index) < 2)
+        return;
+
+    qsort(&darray_item(*index, 0), darray_size(*index),
+          sizeof(darray_item(*index, 0)), cmp_keysym_key_entry);
+
+    /* Only keep the first, i.e. preferred, entry of each keysym. */
+    n = 1;
+    for (i = 1; i < darray_size(*index); i++)
+        if (darray_item(*index, i).sym != darray_item(*index, n - 1).sym)
+            darray_item(*index, n++) = darray_item(*index, i);
+    darray_resize(*index, n);
+}
+
+/**
+ * Given a keysym @sym, return the preferred key which generates it,
+ * or NULL.
+ */
+static struct xkb_key *
+FindKeyForSymbol(struct xkb_keymap *keymap, const KeysymKeyIndex *index,
+                 xkb_keysym_t sym)
+{
+    unsigned int lo = 0, hi = darray_size(*index);
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        const struct keysym_key_entry *entry = &darray_item(*index, mid);
+
+        if (entry->sym == sym)
+            return &keymap->keys[entry->keycode];
+        if (entry->sym < sym)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
     return NULL;
 }
@@ -1505,7 +1564,7 @@ CopySymbolsDefToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info,
 
 static bool
 CopyModMapDefToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info,
-                      ModMapEntry *entry)
+                      const KeysymKeyIndex *index, ModMapEntry *entry)
 {
     struct xkb_key *key;
 
@@ -1521,7 +1580,7 @@ CopyModMapDefToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info,
         }
     }
     else {
-        key = FindKeyForSymbol(keymap, entry->u.keySym);
+        key = FindKeyForSymbol(keymap, index, entry->u.keySym);
         if (!key) {
             log_vrb(info->ctx, 5,
                     "Key \"%s\" not found in symbol map; "
@@ -1573,9 +1632,17 @@ CopySymbolsToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info)
         }
     }
 
-    darray_foreach(mm, info->modmaps)
-        if (!CopyModMapDefToKeymap(keymap, info, mm))
-            info->errorCount++;
+    if (!darray_empty(info->modmaps)) {
+        KeysymKeyIndex index;
+
+        BuildKeysymKeyIndex(keymap, &index);
+
+        darray_foreach(mm, info->modmaps)
+            if (!CopyModMapDefToKeymap(keymap, info, &index, mm))
+                info->errorCount++;
+
+        darray_free(index);
+    }
 
     /* XXX: If we don't ignore errorCount, things break. */
     return true;
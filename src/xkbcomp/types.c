@@ -211,8 +211,7 @@ HandleIncludeKeyTypes(KeyTypesInfo *info, IncludeStmt *include)
     KeyTypesInfo included;
 
     InitKeyTypesInfo(&included, info->ctx, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         KeyTypesInfo next_incl;
@@ -30,15 +30,15 @@
 #include "keymap.h"
 #include "ast.h"
 
-struct xkb_component_names {
-    char *keycodes;
-    char *types;
-    char *compat;
-    char *symbols;
-};
-
 char *
-text_v1_keymap_get_as_string(struct xkb_keymap *keymap);
+text_v1_keymap_get_as_string(struct xkb_keymap *keymap,
+                             enum xkb_keymap_serialize_flags flags);
+
+bool
+text_v1_keymap_write(struct xkb_keymap *keymap,
+                     enum xkb_keymap_serialize_flags flags,
+                     xkb_keymap_write_fn write_fn, void *user_data,
+                     size_t *size_out);
 
 XkbFile *
 XkbParseFile(struct xkb_context *ctx, FILE *file,
@@ -76,6 +76,14 @@ bool
 CompileKeymap(XkbFile *file, struct xkb_keymap *keymap,
               enum merge_mode merge);
 
+bool
+CompileKeymapSections(XkbFile *file, struct xkb_keymap *keymap,
+                      enum merge_mode merge,
+                      enum xkb_file_type first, enum xkb_file_type last);
+
+bool
+FinalizeKeymap(struct xkb_keymap *keymap);
+
 /***====================================================================***/
 
 static inline bool
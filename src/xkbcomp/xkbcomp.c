@@ -52,22 +52,17 @@ compile_keymap_file(struct xkb_keymap *keymap, XkbFile *file)
 }
 
 static bool
-text_v1_keymap_new_from_names(struct xkb_keymap *keymap,
-                              const struct xkb_rule_names *rmlvo)
+resolve_names(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo,
+              struct xkb_component_names *kccgst)
 {
-    bool ok;
-    struct xkb_component_names kccgst;
-    XkbFile *file;
-
-    log_dbg(keymap->ctx,
+    log_dbg(ctx,
             "Compiling from RMLVO: rules '%s', model '%s', layout '%s', "
             "variant '%s', options '%s'\n",
             rmlvo->rules, rmlvo->model, rmlvo->layout, rmlvo->variant,
             rmlvo->options);
 
-    ok = xkb_components_from_rules(keymap->ctx, rmlvo, &kccgst);
-    if (!ok) {
-        log_err(keymap->ctx,
+    if (!xkb_components_from_rules(ctx, rmlvo, kccgst)) {
+        log_err(ctx,
                 "Couldn't look up rules '%s', model '%s', layout '%s', "
                 "variant '%s', options '%s'\n",
                 rmlvo->rules, rmlvo->model, rmlvo->layout, rmlvo->variant,
@@ -75,29 +70,152 @@ text_v1_keymap_new_from_names(struct xkb_keymap *keymap,
         return false;
     }
 
-    log_dbg(keymap->ctx,
+    log_dbg(ctx,
             "Compiling from KcCGST: keycodes '%s', types '%s', "
             "compat '%s', symbols '%s'\n",
-            kccgst.keycodes, kccgst.types, kccgst.compat, kccgst.symbols);
+            kccgst->keycodes, kccgst->types, kccgst->compat, kccgst->symbols);
+    return true;
+}
 
-    file = XkbFileFromComponents(keymap->ctx, &kccgst);
+static void
+free_components(struct xkb_component_names *kccgst)
+{
+    free(kccgst->keycodes);
+    free(kccgst->types);
+    free(kccgst->compat);
+    free(kccgst->symbols);
+}
 
-    free(kccgst.keycodes);
-    free(kccgst.types);
-    free(kccgst.compat);
-    free(kccgst.symbols);
+/*
+ * Compile the keymap from the components, which it takes ownership of on
+ * success. If @base is given, the keymap is built by copying the keycodes,
+ * types and compat sections of *@base and compiling only its symbols on
+ * top; *@base is compiled from the components first if it is NULL, so
+ * that later derived keymaps can share it.
+ */
+static bool
+compile_components(struct xkb_keymap *keymap,
+                   struct xkb_component_names *kccgst,
+                   struct xkb_keymap **base)
+{
+    bool ok;
+    XkbFile *file;
+    struct xkb_keymap *new_base;
 
+    file = XkbFileFromComponents(keymap->ctx, kccgst);
     if (!file) {
         log_err(keymap->ctx,
                 "Failed to generate parsed XKB file from components\n");
         return false;
     }
 
-    ok = compile_keymap_file(keymap, file);
+    if (!base) {
+        ok = CompileKeymap(file, keymap, MERGE_OVERRIDE);
+        goto out;
+    }
+
+    if (!*base) {
+        new_base = xkb_keymap_new(keymap->ctx, keymap->format,
+                                  keymap->flags);
+        ok = new_base &&
+             CompileKeymapSections(file, new_base, MERGE_OVERRIDE,
+                                   FILE_TYPE_KEYCODES, FILE_TYPE_COMPAT);
+        if (!ok) {
+            xkb_keymap_unref(new_base);
+            goto out;
+        }
+        *base = new_base;
+    }
+
+    ok = XkbCopyKeymapBase(keymap, *base) &&
+         CompileKeymapSections(file, keymap, MERGE_OVERRIDE,
+                               FILE_TYPE_SYMBOLS, FILE_TYPE_SYMBOLS) &&
+         FinalizeKeymap(keymap);
+    if (ok)
+        keymap->base = xkb_keymap_ref(*base);
+
+out:
     FreeXkbFile(file);
+    if (!ok) {
+        log_err(keymap->ctx, "Failed to compile keymap\n");
+        return false;
+    }
+
+    keymap->components = *kccgst;
+    memset(kccgst, 0, sizeof(*kccgst));
+    return true;
+}
+
+static bool
+text_v1_keymap_new_from_names(struct xkb_keymap *keymap,
+                              const struct xkb_rule_names *rmlvo)
+{
+    bool ok;
+    struct xkb_component_names kccgst;
+
+    xkb_context_revalidate_include_dirs(keymap->ctx);
+
+    if (!resolve_names(keymap->ctx, rmlvo, &kccgst))
+        return false;
+
+    ok = compile_components(keymap, &kccgst, NULL);
+    free_components(&kccgst);
     return ok;
 }
 
+static struct xkb_keymap *
+text_v1_keymap_derive_from_names(struct xkb_keymap *source,
+                                 const struct xkb_rule_names *rmlvo,
+                                 enum xkb_keymap_compile_flags flags)
+{
+    bool ok;
+    struct xkb_component_names kccgst;
+    struct xkb_keymap *keymap;
+    struct xkb_keymap **base = NULL;
+
+    xkb_context_revalidate_include_dirs(source->ctx);
+
+    if (!resolve_names(source->ctx, rmlvo, &kccgst))
+        return NULL;
+
+    /* Only keymaps compiled from names keep their components. */
+    if (source->components.keycodes && source->flags == flags &&
+        streq(kccgst.keycodes, source->components.keycodes) &&
+        streq(kccgst.types, source->components.types) &&
+        streq(kccgst.compat, source->components.compat)) {
+        if (streq(kccgst.symbols, source->components.symbols)) {
+            log_dbg(source->ctx,
+                    "Same components as the source keymap; reusing it\n");
+            free_components(&kccgst);
+            return xkb_keymap_ref(source);
+        }
+
+        /*
+         * The base of the source is only compiled when first needed, so
+         * that keymaps which are never derived from do not pay for it.
+         */
+        log_dbg(source->ctx,
+                "Only the symbols differ from the source keymap; "
+                "reusing its keycodes, types and compat\n");
+        base = &source->base;
+    }
+
+    keymap = xkb_keymap_new(source->ctx, source->format, flags);
+    if (!keymap) {
+        free_components(&kccgst);
+        return NULL;
+    }
+
+    ok = compile_components(keymap, &kccgst, base);
+    free_components(&kccgst);
+    if (!ok) {
+        xkb_keymap_unref(keymap);
+        return NULL;
+    }
+
+    return keymap;
+}
+
 static bool
 text_v1_keymap_new_from_string(struct xkb_keymap *keymap,
                                const char *string, size_t len)
@@ -105,6 +223,8 @@ text_v1_keymap_new_from_string(struct xkb_keymap *keymap,
     bool ok;
     XkbFile *xkb_file;
 
+    xkb_context_revalidate_include_dirs(keymap->ctx);
+
     xkb_file = XkbParseString(keymap->ctx, string, len, "(input string)", NULL);
     if (!xkb_file) {
         log_err(keymap->ctx, "Failed to parse input xkb string\n");
@@ -122,6 +242,8 @@ text_v1_keymap_new_from_file(struct xkb_keymap *keymap, FILE *file)
     bool ok;
     XkbFile *xkb_file;
 
+    xkb_context_revalidate_include_dirs(keymap->ctx);
+
     xkb_file = XkbParseFile(keymap->ctx, file, "(unknown file)", NULL);
     if (!xkb_file) {
         log_err(keymap->ctx, "Failed to parse input xkb file\n");
@@ -138,4 +260,6 @@ const struct xkb_keymap_format_ops text_v1_keymap_format_ops = {
     .keymap_new_from_string = text_v1_keymap_new_from_string,
     .keymap_new_from_file = text_v1_keymap_new_from_file,
     .keymap_get_as_string = text_v1_keymap_get_as_string,
+    .keymap_write = text_v1_keymap_write,
+    .keymap_derive_from_names = text_v1_keymap_derive_from_names,
 };
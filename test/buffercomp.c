@@ -78,6 +78,26 @@ main(int argc, char *argv[])
     keymap = test_compile_buffer(ctx, "", 0);
     assert(!keymap);
 
+    /* String literals with and without escape sequences. */
+    const char escapes[] =
+        "xkb_keymap {\n"
+        "  xkb_keycodes \"test\" {\n"
+        "    <A> = 9;\n"
+        "    indicator 1 = \"Caps\\\\Lock\";\n"
+        "    indicator 2 = \"Num\\tLock\";\n"
+        "    indicator 3 = \"Scroll Lock\";\n"
+        "  };\n"
+        "  xkb_types { };\n"
+        "  xkb_compat { };\n"
+        "  xkb_symbols { key <A> { [ a, A ] }; };\n"
+        "};\n";
+    keymap = test_compile_buffer(ctx, escapes, sizeof(escapes) - 1);
+    assert(keymap);
+    assert(streq(xkb_keymap_led_get_name(keymap, 0), "Caps\\Lock"));
+    assert(streq(xkb_keymap_led_get_name(keymap, 1), "Num\tLock"));
+    assert(streq(xkb_keymap_led_get_name(keymap, 2), "Scroll Lock"));
+    xkb_keymap_unref(keymap);
+
     /* Make sure we can recompile our output for a normal keymap from rules. */
     keymap = test_compile_rules(ctx, NULL, NULL,
                                 "ru,ca,de,us", ",multix,neo,intl", NULL);
@@ -27,9 +27,15 @@
 
 #include "test.h"
 #include "context.h"
+#include "bundle.h"
+#include "keymap.h"
+#include "xkbcomp/rules.h"
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
 
 /* keeps a cache of all makedir/maketmpdir directories so we can free and
  * rmdir them in one go, see unmakedirs() */
@@ -287,6 +293,342 @@ test_include_order(void)
     restore_env();
 }
 
+static void
+test_shared_keymaps(void)
+{
+    struct xkb_rule_names us = { .rules = "evdev", .layout = "us" };
+    struct xkb_rule_names de = { .rules = "evdev", .layout = "de" };
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap1, *keymap2, *keymap3, *keymaps[20];
+    char *path, *str;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                          XKB_CONTEXT_NO_ENVIRONMENT_NAMES |
+                          XKB_CONTEXT_SHARE_KEYMAPS);
+    assert(ctx);
+    path = test_get_path("");
+    assert(path);
+    assert(xkb_context_include_path_append(ctx, path));
+
+    /* Same names, same keymap. */
+    keymap1 = xkb_keymap_new_from_names(ctx, &us, 0);
+    keymap2 = xkb_keymap_new_from_names(ctx, &us, 0);
+    keymap3 = xkb_keymap_new_from_names(ctx, &de, 0);
+    assert(keymap1 && keymap1 == keymap2);
+    assert(keymap3 && keymap3 != keymap1);
+    assert(darray_size(ctx->shared_keymaps) == 2);
+    xkb_keymap_unref(keymap2);
+    xkb_keymap_unref(keymap3);
+    assert(darray_size(ctx->shared_keymaps) == 1);
+
+    /* Same string, same keymap. */
+    str = xkb_keymap_get_as_string(keymap1, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(str);
+    keymap2 = xkb_keymap_new_from_string(ctx, str, XKB_KEYMAP_FORMAT_TEXT_V1,
+                                         0);
+    keymap3 = xkb_keymap_new_from_buffer(ctx, str, strlen(str) + 1,
+                                         XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert(keymap2 && keymap2 == keymap3 && keymap2 != keymap1);
+    xkb_keymap_unref(keymap2);
+    xkb_keymap_unref(keymap3);
+    free(str);
+
+    /* Derived keymaps are shared as well. */
+    keymap2 = xkb_keymap_derive_from_names(keymap1, &de, 0);
+    keymap3 = xkb_keymap_new_from_names(ctx, &de, 0);
+    assert(keymap2 && keymap2 == keymap3);
+    xkb_keymap_unref(keymap2);
+    xkb_keymap_unref(keymap3);
+
+    /* Many keymaps, some of them released in between. */
+    for (int i = 0; i < 20; i++) {
+        char model[16];
+        struct xkb_rule_names names = {
+            .rules = "evdev", .model = model, .layout = "us",
+        };
+
+        snprintf(model, sizeof(model), "model%d", i);
+        keymaps[i] = xkb_keymap_new_from_names(ctx, &names, 0);
+        assert(keymaps[i]);
+        if (i % 3 == 0)
+            xkb_keymap_unref(keymaps[i]);
+    }
+    for (int i = 0; i < 20; i++) {
+        char model[16];
+        struct xkb_rule_names names = {
+            .rules = "evdev", .model = model, .layout = "us",
+        };
+
+        if (i % 3 == 0)
+            continue;
+        snprintf(model, sizeof(model), "model%d", i);
+        keymap2 = xkb_keymap_new_from_names(ctx, &names, 0);
+        assert(keymap2 == keymaps[i]);
+        xkb_keymap_unref(keymap2);
+        xkb_keymap_unref(keymaps[i]);
+    }
+    assert(darray_size(ctx->shared_keymaps) == 1);
+
+    /* Changing the include path stops sharing the existing keymaps. */
+    xkb_context_include_path_clear(ctx);
+    assert(darray_size(ctx->shared_keymaps) == 0);
+    assert(xkb_context_include_path_append(ctx, path));
+    keymap2 = xkb_keymap_new_from_names(ctx, &us, 0);
+    assert(keymap2 && keymap2 != keymap1);
+
+    xkb_keymap_unref(keymap1);
+    xkb_keymap_unref(keymap2);
+    assert(darray_size(ctx->shared_keymaps) == 0);
+    xkb_context_unref(ctx);
+    free(path);
+}
+
+static void
+set_mtime_in_past(const char *path)
+{
+    struct utimbuf times;
+
+    times.actime = times.modtime = time(NULL) - 10;
+    assert(utime(path, &times) == 0);
+}
+
+/* The opposite: the file looks as if it was modified in the current second. */
+static void
+set_mtime_in_future(const char *path)
+{
+    struct utimbuf times;
+
+    times.actime = times.modtime = time(NULL) + 10;
+    assert(utime(path, &times) == 0);
+}
+
+static void
+test_include_dirs(void)
+{
+    struct xkb_context *ctx;
+    const char *dir, *symbols;
+    char *file;
+    FILE *f;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    dir = maketmpdir();
+    symbols = makedir(dir, "symbols");
+    set_mtime_in_past(symbols);
+    assert(xkb_context_include_path_append(ctx, dir));
+
+    assert(!xkb_context_include_dir_may_contain(ctx, 0, "symbols", "mine"));
+    assert(!xkb_context_include_dir_may_contain(ctx, 0, "types", "mine"));
+
+    file = asprintf_safe("%s/mine", symbols);
+    assert(file);
+    f = fopen(file, "w");
+    assert(f);
+    fclose(f);
+    set_mtime_in_future(symbols);
+
+    /* The snapshot is only checked again in the next generation. */
+    assert(!xkb_context_include_dir_may_contain(ctx, 0, "symbols", "mine"));
+
+    /* Changed in the second it is read: the snapshot is not used. */
+    xkb_context_revalidate_include_dirs(ctx);
+    assert(xkb_context_include_dir_may_contain(ctx, 0, "symbols", "mine"));
+    assert(xkb_context_include_dir_may_contain(ctx, 0, "symbols", "other"));
+
+    set_mtime_in_past(symbols);
+    xkb_context_revalidate_include_dirs(ctx);
+    assert(xkb_context_include_dir_may_contain(ctx, 0, "symbols", "mine"));
+    assert(xkb_context_include_dir_may_contain(ctx, 0, "symbols", "MINE"));
+    assert(xkb_context_include_dir_may_contain(ctx, 0, "symbols", "mine/x"));
+    assert(!xkb_context_include_dir_may_contain(ctx, 0, "symbols", "min"));
+    assert(!xkb_context_include_dir_may_contain(ctx, 0, "symbols", "mine2"));
+    assert(!xkb_context_include_dir_may_contain(ctx, 0, "symbols", "other"));
+
+    /* Changing the include path drops the snapshots. */
+    xkb_context_include_path_clear(ctx);
+    assert(darray_empty(ctx->include_dirs));
+
+    xkb_context_unref(ctx);
+    unlink(file);
+    free(file);
+    unmakedirs();
+}
+
+static void
+write_file(const char *path, const char *contents)
+{
+    FILE *f = fopen(path, "w");
+
+    assert(f);
+    fputs(contents, f);
+    fclose(f);
+    set_mtime_in_past(path);
+}
+
+static void
+test_file_cache(void)
+{
+    struct xkb_rule_names us = { .rules = "evdev", .layout = "us" };
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap;
+    struct xkb_cached_file *cached;
+    char *path, *file, *string1, *string2;
+    size_t size1, size2, cached_files;
+    FILE *f;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                          XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+    assert(ctx);
+    path = test_get_path("");
+    assert(path);
+    assert(xkb_context_include_path_append(ctx, path));
+
+    /* The files read are kept, but not in use after compiling. */
+    keymap = xkb_keymap_new_from_names(ctx, &us, 0);
+    assert(keymap);
+    xkb_keymap_unref(keymap);
+    cached_files = darray_size(ctx->file_cache);
+    assert(cached_files > 0);
+    assert(ctx->file_cache_size <= xkb_context_get_file_cache_limit(ctx));
+    darray_foreach(cached, ctx->file_cache)
+        assert(cached->refcnt == 0);
+
+    keymap = xkb_keymap_new_from_names(ctx, &us, 0);
+    assert(keymap);
+    xkb_keymap_unref(keymap);
+    assert(darray_size(ctx->file_cache) == cached_files);
+
+    /* The same file gives the same contents, until it changes. */
+    file = asprintf_safe("%s/file", maketmpdir());
+    assert(file);
+    write_file(file, "abc");
+    f = fopen(file, "rb");
+    assert(f);
+    assert(xkb_context_map_file(ctx, f, &string1, &size1));
+    fclose(f);
+    f = fopen(file, "rb");
+    assert(f);
+    assert(xkb_context_map_file(ctx, f, &string2, &size2));
+    fclose(f);
+    assert(string1 == string2 && size1 == 3 && size2 == 3);
+    assert(memcmp(string1, "abc", 3) == 0);
+    xkb_context_unmap_file(ctx, string2, size2);
+
+    write_file(file, "abcd");
+    f = fopen(file, "rb");
+    assert(f);
+    assert(xkb_context_map_file(ctx, f, &string2, &size2));
+    fclose(f);
+    assert(string1 != string2 && size2 == 4);
+    assert(memcmp(string2, "abcd", 4) == 0);
+    xkb_context_unmap_file(ctx, string2, size2);
+
+    /* Files in use are kept when the limit is lowered. */
+    xkb_context_set_file_cache_limit(ctx, 0);
+    assert(darray_size(ctx->file_cache) == 1);
+    assert(memcmp(string1, "abc", 3) == 0);
+    xkb_context_unmap_file(ctx, string1, size1);
+    assert(darray_size(ctx->file_cache) == 0);
+    assert(ctx->file_cache_size == 0);
+
+    xkb_context_unref(ctx);
+    unlink(file);
+    free(file);
+    free(path);
+    unmakedirs();
+}
+
+static char *
+compile_dump(struct xkb_context *ctx, const char *layout)
+{
+    struct xkb_rule_names names = { .rules = "evdev", .layout = layout };
+    struct xkb_keymap *keymap;
+    char *dump;
+
+    keymap = xkb_keymap_new_from_names(ctx, &names, 0);
+    assert(keymap);
+    dump = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(dump);
+    xkb_keymap_unref(keymap);
+    return dump;
+}
+
+static void
+test_include_bundle(void)
+{
+    const char *layouts[] = { "us", "de", "us,ru(phonetic)" };
+    const struct xkb_rule_names rmlvo = {
+        .rules = "inc-src-nested", .model = "my_model",
+        .layout = "my_layout", .variant = "", .options = "",
+    };
+    struct xkb_component_names kccgst;
+    struct xkb_context *dir_ctx, *bundle_ctx;
+    char *path, *bundle, *garbage, *dump1, *dump2;
+    FILE *f;
+
+    dir_ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                              XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+    assert(dir_ctx);
+    path = test_get_path("");
+    assert(path);
+    assert(xkb_context_include_path_append(dir_ctx, path));
+
+    bundle = asprintf_safe("%s/bundle", maketmpdir());
+    assert(bundle);
+    f = fopen(bundle, "wb");
+    assert(f);
+    assert(xkb_bundle_write(dir_ctx, path, f));
+    assert(fclose(f) == 0);
+
+    /* A bundle alone compiles the same keymaps as its include root. */
+    bundle_ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                                 XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+    assert(bundle_ctx);
+    assert(xkb_context_include_path_append_bundle(bundle_ctx, bundle));
+    assert(xkb_context_num_include_paths(bundle_ctx) == 1);
+    for (size_t i = 0; i < ARRAY_SIZE(layouts); i++) {
+        dump1 = compile_dump(dir_ctx, layouts[i]);
+        dump2 = compile_dump(bundle_ctx, layouts[i]);
+        assert(streq(dump1, dump2));
+        free(dump1);
+        free(dump2);
+    }
+
+    /* Rules included from the system root are found in the bundle. */
+    setenv("XKB_CONFIG_ROOT", "/nonexistent", 1);
+    assert(xkb_components_from_rules(bundle_ctx, &rmlvo, &kccgst));
+    assert(streq(kccgst.keycodes, "my_keycodes"));
+    assert(streq(kccgst.symbols, "my_symbols"));
+    free(kccgst.keycodes);
+    free(kccgst.types);
+    free(kccgst.compat);
+    free(kccgst.symbols);
+    unsetenv("XKB_CONFIG_ROOT");
+    xkb_context_unref(bundle_ctx);
+
+    /* Anything else is rejected. */
+    garbage = asprintf_safe("%s/garbage", maketmpdir());
+    assert(garbage);
+    write_file(garbage, "XKBBNDL garbage");
+    bundle_ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                                 XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+    assert(bundle_ctx);
+    assert(!xkb_context_include_path_append_bundle(bundle_ctx, garbage));
+    assert(!xkb_context_include_path_append_bundle(bundle_ctx, path));
+    assert(!xkb_context_include_path_append_bundle(bundle_ctx,
+                                                   "/nonexistent"));
+    assert(xkb_context_num_include_paths(bundle_ctx) == 0);
+    xkb_context_unref(bundle_ctx);
+
+    xkb_context_unref(dir_ctx);
+    unlink(garbage);
+    unlink(bundle);
+    free(garbage);
+    free(bundle);
+    free(path);
+    unmakedirs();
+}
+
 int
 main(void)
 {
@@ -315,6 +657,10 @@ main(void)
     test_xdg_include_path();
     test_xdg_include_path_fallback();
     test_include_order();
+    test_shared_keymaps();
+    test_include_dirs();
+    test_file_cache();
+    test_include_bundle();
 
     return 0;
 }
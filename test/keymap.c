@@ -108,6 +108,10 @@ test_keymap(void)
     keyname = xkb_keymap_key_get_name(keymap, kc);
     assert(streq(keyname, "COMP"));
 
+    /* Unknown names, whether interned atoms or not. */
+    assert(xkb_keymap_key_by_name(keymap, "pc104") == XKB_KEYCODE_INVALID);
+    assert(xkb_keymap_key_by_name(keymap, "NOT A KEY") == XKB_KEYCODE_INVALID);
+
     kc = xkb_keymap_key_by_name(keymap, "AC01");
     assert(kc != XKB_KEYCODE_INVALID);
 
@@ -153,6 +157,8 @@ test_keymap(void)
 #define Mod1Mask (1 << 3)
 #define Mod2Mask (1 << 4)
 #define Mod3Mask (1 << 5)
+#define Mod4Mask (1 << 6)
+#define LockMask (1 << 1)
 
 static void
 test_numeric_keysyms(void)
@@ -198,12 +204,217 @@ test_numeric_keysyms(void)
     xkb_context_unref(context);
 }
 
+static void
+test_modmap_keysym_preference(void)
+{
+    struct xkb_context *context = test_get_context(0);
+    struct xkb_keymap *keymap;
+    const char keymap_str[] =
+        "xkb_keymap {\n"
+        "  xkb_keycodes {\n"
+        "    <K1> = 10; <K2> = 11; <K3> = 12; <K4> = 13; <K5> = 14;\n"
+        "    <K6> = 15;\n"
+        "  };\n"
+        "  xkb_types { include \"complete\" };\n"
+        "  xkb_compat { include \"complete\" };\n"
+        "  xkb_symbols {\n"
+        /* Lowest group wins over lowest level. */
+        "    key <K1> { [ x, Super_L ], [ Caps_Lock ] };\n"
+        "    key <K2> { [ y, Caps_Lock ] };\n"
+        /* Then lowest level wins over lowest keycode, then lowest keycode. */
+        "    key <K3> { [ z, Num_Lock ] };\n"
+        "    key <K4> { [ Num_Lock ] };\n"
+        "    key <K5> { [ Num_Lock ] };\n"
+        /* Levels with multiple keysyms never match. */
+        "    key <K6> { [ {Super_L, Super_R} ] };\n"
+        "    modifier_map Lock { Caps_Lock };\n"
+        "    modifier_map Mod2 { Num_Lock };\n"
+        "    modifier_map Mod4 { Super_L, Super_R };\n"
+        "  };\n"
+        "};";
+
+    assert(context);
+
+    keymap = test_compile_string(context, keymap_str);
+    assert(keymap);
+
+    assert(XkbKey(keymap, 10)->modmap == Mod4Mask);
+    assert(XkbKey(keymap, 11)->modmap == LockMask);
+    assert(XkbKey(keymap, 12)->modmap == 0);
+    assert(XkbKey(keymap, 13)->modmap == Mod2Mask);
+    assert(XkbKey(keymap, 14)->modmap == 0);
+    assert(XkbKey(keymap, 15)->modmap == 0);
+
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(context);
+}
+
+static void
+test_keysym_positions(void)
+{
+    struct xkb_context *context = test_get_context(0);
+    struct xkb_keymap *keymap;
+    struct xkb_key_position positions[64], expected[64];
+    size_t num_positions, num_expected;
+    xkb_keycode_t kc;
+
+    assert(context);
+
+    keymap = test_compile_rules(context, "evdev", "pc104", "us,de", NULL,
+                                "grp:menu_toggle");
+    assert(keymap);
+
+    /* Compare with a brute force search, in the order of preference. */
+    const xkb_keysym_t keysyms[] = {
+        XKB_KEY_a, XKB_KEY_A, XKB_KEY_at, XKB_KEY_y, XKB_KEY_Shift_L,
+        XKB_KEY_adiaeresis, XKB_KEY_ISO_Next_Group, XKB_KEY_Thai_kokai,
+    };
+    for (size_t k = 0; k < ARRAY_SIZE(keysyms); k++) {
+        num_expected = 0;
+        for (xkb_layout_index_t layout = 0;
+             layout < xkb_keymap_num_layouts(keymap); layout++) {
+            for (xkb_level_index_t level = 0; level < 8; level++) {
+                for (kc = xkb_keymap_min_keycode(keymap);
+                     kc <= xkb_keymap_max_keycode(keymap); kc++) {
+                    const xkb_keysym_t *syms;
+                    xkb_mod_mask_t masks[16];
+                    size_t num_masks;
+
+                    if (layout >= xkb_keymap_num_layouts_for_key(keymap, kc) ||
+                        level >= xkb_keymap_num_levels_for_key(keymap, kc, layout))
+                        continue;
+                    if (xkb_keymap_key_get_syms_by_level(keymap, kc, layout,
+                                                         level, &syms) != 1 ||
+                        syms[0] != keysyms[k])
+                        continue;
+
+                    num_masks = xkb_keymap_key_get_mods_for_level(
+                        keymap, kc, layout, level, masks, ARRAY_SIZE(masks));
+                    for (size_t i = 0; i < num_masks; i++) {
+                        assert(num_expected < ARRAY_SIZE(expected));
+                        expected[num_expected++] = (struct xkb_key_position) {
+                            kc, layout, level, masks[i]
+                        };
+                    }
+                }
+            }
+        }
+
+        num_positions = xkb_keymap_keysym_get_positions(keymap, keysyms[k],
+                                                        positions,
+                                                        ARRAY_SIZE(positions));
+        assert(num_positions == num_expected);
+        assert(memcmp(positions, expected,
+                      num_expected * sizeof(*expected)) == 0);
+    }
+
+    /* The total is returned even if the buffer is too small. */
+    num_positions = xkb_keymap_keysym_get_positions(keymap, XKB_KEY_A,
+                                                    positions, 1);
+    assert(num_positions > 1);
+    kc = xkb_keymap_key_by_name(keymap, "AC01");
+    assert(positions[0].keycode == kc && positions[0].layout == 0 &&
+           positions[0].level == 1);
+    assert(xkb_keymap_keysym_get_positions(keymap, XKB_KEY_A, NULL, 0) ==
+           num_positions);
+
+    /* Code points match all the keysyms which produce them. */
+    num_positions = xkb_keymap_utf32_get_positions(keymap, 'y', positions,
+                                                   ARRAY_SIZE(positions));
+    num_expected = xkb_keymap_keysym_get_positions(keymap, XKB_KEY_y, NULL, 0);
+    assert(num_positions == num_expected && num_positions > 0);
+    num_positions = xkb_keymap_utf32_get_positions(keymap, 0x00e4, positions,
+                                                   ARRAY_SIZE(positions));
+    assert(num_positions > 0);
+    assert(positions[0].layout == 1 && positions[0].level == 0);
+    assert(xkb_keymap_utf32_get_positions(keymap, 0, NULL, 0) == 0);
+    assert(xkb_keymap_keysym_get_positions(keymap, XKB_KEY_Thai_kokai, NULL, 0) == 0);
+    assert(xkb_keymap_utf32_get_positions(keymap, 0x1F600, NULL, 0) == 0);
+
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(context);
+}
+
+static void
+test_packed_levels(void)
+{
+    struct xkb_context *context = test_get_context(0);
+    struct xkb_keymap *keymap;
+    const struct xkb_group *next_group;
+    const struct xkb_level *next_level;
+    const struct xkb_key *key;
+
+    assert(context);
+
+    keymap = test_compile_rules(context, "evdev", "pc104", "us,de", NULL,
+                                NULL);
+    assert(keymap);
+
+    /* The groups and levels of all the keys are stored back to back. */
+    assert(keymap->packed_groups && keymap->packed_levels);
+    next_group = keymap->packed_groups;
+    next_level = keymap->packed_levels;
+    xkb_keys_foreach(key, keymap) {
+        if (!key->groups)
+            continue;
+        assert(key->groups == next_group);
+        next_group += key->num_groups;
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+            assert(key->groups[i].levels == next_level);
+            next_level += XkbKeyNumLevels(key, i);
+        }
+    }
+
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(context);
+}
+
+static xkb_keysym_t
+compile_multi_ae01(struct xkb_context *context, const char *variant)
+{
+    struct xkb_keymap *keymap;
+    const xkb_keysym_t *syms;
+    xkb_keysym_t sym;
+
+    keymap = test_compile_rules(context, NULL, NULL, "multi", variant, NULL);
+    if (!keymap)
+        return XKB_KEY_NoSymbol;
+
+    assert(xkb_keymap_key_get_syms_by_level(
+        keymap, xkb_keymap_key_by_name(keymap, "AE01"), 0, 0, &syms) == 1);
+    sym = syms[0];
+    xkb_keymap_unref(keymap);
+    return sym;
+}
+
+static void
+test_include_map(void)
+{
+    struct xkb_context *context = test_get_context(0);
+
+    assert(context);
+
+    /* Twice, the second time with the indexed maps of the file. */
+    for (int i = 0; i < 2; i++) {
+        assert(compile_multi_ae01(context, "first") == XKB_KEY_a);
+        assert(compile_multi_ae01(context, "second") == XKB_KEY_b);
+        assert(compile_multi_ae01(context, "error") == XKB_KEY_NoSymbol);
+        assert(compile_multi_ae01(context, "missing") == XKB_KEY_NoSymbol);
+    }
+
+    xkb_context_unref(context);
+}
+
 int
 main(void)
 {
     test_garbage_key();
     test_keymap();
     test_numeric_keysyms();
+    test_modmap_keysym_preference();
+    test_keysym_positions();
+    test_packed_levels();
+    test_include_map();
 
     return 0;
 }
@@ -128,6 +128,38 @@ test_utf32_to_keysym(uint32_t ucs, xkb_keysym_t expected)
     return expected == actual;
 }
 
+/* The properties table must agree with the case conversion functions. */
+static void
+test_keysym_properties(void)
+{
+    for (xkb_keysym_t ks = 0; ks <= 0x110ffff; ks++) {
+        xkb_keysym_t lower, upper;
+        uint8_t props;
+
+        /* Legacy keysyms, and a sample of Unicode keysyms. */
+        if (ks > 0xffff && ks < 0x1000000)
+            ks = 0x1000000;
+        if (ks >= 0x1000000 && ks % 7 != 0)
+            continue;
+
+        props = xkb_keysym_get_properties(ks);
+        lower = xkb_keysym_to_lower(ks);
+        upper = xkb_keysym_to_upper(ks);
+
+        assert(!!(props & XKB_KEYSYM_PROP_CASED) == (lower != ks || upper != ks));
+        assert(!!(props & XKB_KEYSYM_PROP_LOWER) == (lower != upper && ks == lower));
+        assert(!!(props & XKB_KEYSYM_PROP_UPPER) == (lower != upper && ks == upper));
+        assert(!!(props & XKB_KEYSYM_PROP_KEYPAD) ==
+               (ks >= XKB_KEY_KP_Space && ks <= XKB_KEY_KP_Equal));
+    }
+
+    assert(xkb_keysym_get_properties(XKB_KEY_XF86Macro23) == 0);
+    assert(xkb_keysym_get_properties(XKB_KEY_a) ==
+           (XKB_KEYSYM_PROP_LOWER | XKB_KEYSYM_PROP_CASED));
+    assert(xkb_keysym_get_properties(XKB_KEY_Control_L) ==
+           XKB_KEYSYM_PROP_MODIFIER);
+}
+
 int
 main(void)
 {
@@ -379,6 +411,14 @@ main(void)
     assert(!xkb_keysym_is_keypad(XKB_KEY_1));
     assert(!xkb_keysym_is_keypad(XKB_KEY_Return));
 
+    assert(xkb_keysym_is_modifier(XKB_KEY_Shift_L));
+    assert(xkb_keysym_is_modifier(XKB_KEY_Num_Lock));
+    assert(xkb_keysym_is_modifier(XKB_KEY_ISO_Level3_Shift));
+    assert(!xkb_keysym_is_modifier(XKB_KEY_KP_Enter));
+    assert(!xkb_keysym_is_modifier(XKB_KEY_a));
+
+    test_keysym_properties();
+
     assert(xkb_keysym_to_upper(XKB_KEY_a) == XKB_KEY_A);
     assert(xkb_keysym_to_upper(XKB_KEY_A) == XKB_KEY_A);
     assert(xkb_keysym_to_lower(XKB_KEY_a) == XKB_KEY_a);
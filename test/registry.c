@@ -31,6 +31,9 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <dirent.h>
+#include <time.h>
+#include <utime.h>
 
 #include "xkbcommon/xkbregistry.h"
 
@@ -189,6 +192,7 @@ test_create_rules(const char *ruleset,
             }
             fprintf(fp, "</layout>\n");
             l++;
+            next = l + 1;
         }
         fprintf(fp, "</layoutList>\n");
     }
@@ -772,6 +776,145 @@ test_load_invalid_languages(void)
     rxkb_context_unref(ctx);
 }
 
+static void
+test_load_invalid_structure(void)
+{
+    const char *invalid[] = {
+        /* variant outside of a layout */
+        "<layoutList><variant><configItem><name>v1</name></configItem>"
+        "</variant></layoutList>",
+        /* variants before the configItem of their layout */
+        "<layoutList><layout><variantList><variant><configItem>"
+        "<name>v1</name></configItem></variant></variantList>"
+        "<configItem><name>l1</name></configItem></layout></layoutList>",
+        /* no configItem */
+        "<optionList><group></group></optionList>",
+        /* two configItems */
+        "<modelList><model><configItem><name>m2</name></configItem>"
+        "<configItem><name>m3</name></configItem></model></modelList>",
+        /* unknown element */
+        "<modelList><model><configItem><name>m2</name><foo/></configItem>"
+        "</model></modelList>",
+        /* not well-formed */
+        "<modelList><model><configItem><name>m2</name></configItem>"
+        "</modelList>",
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(invalid); i++) {
+        struct rxkb_context *ctx;
+        char path[PATH_MAX];
+        char *dir;
+        FILE *fp;
+
+        dir = test_maketempdir("xkbtests.XXXXXX");
+        free(test_makedir(dir, "rules"));
+        assert(snprintf_safe(path, sizeof(path), "%s/rules/xkbtests.xml",
+                             dir));
+        fp = fopen(path, "w");
+        assert(fp);
+        /* The valid model comes first: it must not be loaded either */
+        fprintf(fp,
+                "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<xkbConfigRegistry version=\"1.1\">\n"
+                "<modelList><model><configItem><name>m1</name>"
+                "</configItem></model></modelList>\n"
+                "%s\n"
+                "</xkbConfigRegistry>\n", invalid[i]);
+        fclose(fp);
+
+        ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES);
+        assert(ctx);
+        assert(rxkb_context_include_path_append(ctx, dir));
+        assert(!rxkb_context_parse(ctx, "xkbtests"));
+        assert(rxkb_model_first(ctx) == NULL);
+        assert(rxkb_layout_first(ctx) == NULL);
+        assert(rxkb_option_group_first(ctx) == NULL);
+        rxkb_context_unref(ctx);
+
+        test_remove_rules(dir, "xkbtests");
+    }
+}
+
+static void
+test_find(void)
+{
+    struct test_model system_models[] =  {
+        {"m1", "vendor1", "desc1"},
+        {"m2", "vendor2", "desc2"},
+        {NULL},
+    };
+    struct test_layout system_layouts[] =  {
+        {"l1", NO_VARIANT, "lbrief1", "ldesc1", {"eng", "fra"}, {"US", "CA"}},
+        {"l1", "v1", "vbrief1", "vdesc1", {"deu"}},
+        {"l1", "v2", "vbrief2", "vdesc2"},
+        {"l2", NO_VARIANT, "lbrief2", "ldesc2", {"fra", "fra"}},
+        {"l3", NO_VARIANT, "lbrief3", "ldesc3"},
+        {NULL},
+    };
+    struct test_option_group system_groups[] = {
+        {"grp1", "gdesc1", true,
+          { {"grp1:1", "odesc11"}, {"grp1:2", "odesc12"} } },
+        {"grp2", "gdesc2", false,
+          { {"grp2:1", "odesc21"}, {"grp1:1", "odesc22"} } },
+        { NULL },
+    };
+    struct rxkb_context *ctx;
+    struct rxkb_layout *layouts[4];
+    struct rxkb_model *m;
+    struct rxkb_layout *l;
+    struct rxkb_option_group *g;
+    struct rxkb_option *o;
+
+    ctx = test_setup_context(system_models, NULL,
+                             system_layouts, NULL,
+                             system_groups, NULL);
+
+    m = rxkb_model_find(ctx, "m2");
+    assert(cmp_models(&system_models[1], m));
+    assert(!rxkb_model_find(ctx, "m3"));
+    assert(!rxkb_model_find(ctx, "l1"));
+
+    l = rxkb_layout_find(ctx, "l1", NO_VARIANT);
+    assert(cmp_layouts(&system_layouts[0], l));
+    l = rxkb_layout_find(ctx, "l1", "v2");
+    assert(streq(rxkb_layout_get_name(l), "l1"));
+    assert(streq(rxkb_layout_get_variant(l), "v2"));
+    assert(!rxkb_layout_find(ctx, "l2", "v1"));
+    assert(!rxkb_layout_find(ctx, "l1", "v3"));
+    assert(!rxkb_layout_find(ctx, "l4", NO_VARIANT));
+
+    g = rxkb_option_group_find(ctx, "grp2");
+    assert(cmp_option_groups(&system_groups[1], g, CMP_EXACT));
+    assert(!rxkb_option_group_find(ctx, "grp1:1"));
+
+    /* The first group wins */
+    o = rxkb_option_find(ctx, "grp1:1");
+    assert(streq(rxkb_option_get_description(o), "odesc11"));
+    o = rxkb_option_find(ctx, "grp2:1");
+    assert(streq(rxkb_option_get_description(o), "odesc21"));
+    assert(!rxkb_option_find(ctx, "grp2:2"));
+
+    /* Variants inherit the codes of their layout */
+    assert(rxkb_context_find_layouts_by_iso639(ctx, "fra", layouts,
+                                               ARRAY_SIZE(layouts)) == 3);
+    assert(layouts[0] == rxkb_layout_find(ctx, "l1", NO_VARIANT));
+    assert(layouts[1] == rxkb_layout_find(ctx, "l1", "v2"));
+    assert(layouts[2] == rxkb_layout_find(ctx, "l2", NO_VARIANT));
+    assert(rxkb_context_find_layouts_by_iso639(ctx, "fra", NULL, 0) == 3);
+    assert(rxkb_context_find_layouts_by_iso639(ctx, "deu", layouts, 1) == 1);
+    assert(layouts[0] == rxkb_layout_find(ctx, "l1", "v1"));
+    assert(rxkb_context_find_layouts_by_iso639(ctx, "ita", layouts,
+                                               ARRAY_SIZE(layouts)) == 0);
+
+    assert(rxkb_context_find_layouts_by_iso3166(ctx, "CA", layouts, 2) == 3);
+    assert(layouts[0] == rxkb_layout_find(ctx, "l1", NO_VARIANT));
+    assert(layouts[1] == rxkb_layout_find(ctx, "l1", "v1"));
+    assert(rxkb_context_find_layouts_by_iso3166(ctx, "DE", layouts,
+                                                ARRAY_SIZE(layouts)) == 0);
+
+    rxkb_context_unref(ctx);
+}
+
 static void
 test_popularity(void)
 {
@@ -932,7 +1075,8 @@ test_load_merge_no_overwrite(void)
         {"l2", NO_VARIANT, "lbrief2", "ldesc2"},
         {"l2", "v2", "vbrief2", "vdesc2"},
         {"l1", NO_VARIANT, "lbrief3", "ldesc3"}, /* must not overwrite */
-        {"l1", "v2", "vbrief3", "vdesc3"}, /* must not overwrite */
+        {"l1", "v1", "vbrief4", "vdesc4"}, /* must not overwrite */
+        {"l1", "v2", "vbrief3", "vdesc3"}, /* append */
         {NULL},
     };
     struct test_option_group system_groups[] = {
@@ -954,6 +1098,7 @@ test_load_merge_no_overwrite(void)
     struct rxkb_model *m;
     struct rxkb_layout *l;
     struct rxkb_option_group *g;
+    int count;
 
     ctx = test_setup_context(system_models, user_models,
                              system_layouts, user_layouts,
@@ -971,6 +1116,19 @@ test_load_merge_no_overwrite(void)
     assert(cmp_layouts(&system_layouts[1], l));
     rxkb_layout_unref(l);
 
+    /* l1(v1) must not be duplicated either */
+    count = 0;
+    for (l = rxkb_layout_first(ctx); l; l = rxkb_layout_next(l)) {
+        const char *v = rxkb_layout_get_variant(l);
+        if (streq(rxkb_layout_get_name(l), "l1") && v && streq(v, "v1"))
+            count++;
+    }
+    assert(count == 1);
+
+    l = fetch_layout(ctx, "l1", "v2");
+    assert(cmp_layouts(&user_layouts[4], l));
+    rxkb_layout_unref(l);
+
     assert(find_option(ctx, "grp1", "grp1:3"));
     g = fetch_option_group(ctx, "grp1");
     assert(cmp_option_groups(&system_groups[0], g, CMP_MATCHING_ONLY));
@@ -1004,6 +1162,237 @@ test_invalid_include(void)
     rxkb_context_unref(ctx);
 }
 
+/* What the last cached context did with the cache, from its log. */
+static bool cache_loaded;
+static bool cache_corrupted;
+
+static void
+cache_log_fn(struct rxkb_context *ctx, enum rxkb_log_level level,
+             const char *format, va_list args)
+{
+    char msg[1024];
+
+    vsnprintf(msg, sizeof(msg), format, args);
+    if (strstr(msg, "from the cache"))
+        cache_loaded = true;
+    if (strstr(msg, "corrupted cache"))
+        cache_corrupted = true;
+}
+
+static struct rxkb_context *
+test_setup_cached_context(const char *basedir, const char *cachedir)
+{
+    struct rxkb_context *ctx;
+
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    rxkb_context_set_log_fn(ctx, cache_log_fn);
+    rxkb_context_set_log_level(ctx, RXKB_LOG_LEVEL_DEBUG);
+    cache_loaded = cache_corrupted = false;
+    assert(rxkb_context_include_path_append(ctx, basedir));
+    assert(rxkb_context_set_cache_dir(ctx, cachedir));
+    assert(rxkb_context_parse(ctx, "xkbtests"));
+
+    return ctx;
+}
+
+/*
+ * Files modified in the current second are not cached, so the tests move
+ * the mtime of the rules file out of it, or into the future.
+ */
+static void
+set_mtime(const char *path, time_t mtime)
+{
+    struct utimbuf times;
+
+    times.actime = times.modtime = mtime;
+    assert(utime(path, &times) == 0);
+}
+
+/* Call @func on every file in @dir. */
+static void
+test_foreach_file(const char *dir, int (*func)(const char *path))
+{
+    char path[PATH_MAX];
+    struct dirent *entry;
+    DIR *d;
+
+    d = opendir(dir);
+    assert(d);
+    while ((entry = readdir(d))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        assert(snprintf_safe(path, sizeof(path), "%s/%s", dir,
+                             entry->d_name));
+        assert(func(path) == 0);
+    }
+    closedir(d);
+}
+
+static int
+truncate_cache_file(const char *path)
+{
+    struct stat st;
+
+    assert(stat(path, &st) == 0);
+    return truncate(path, st.st_size - 1);
+}
+
+/* Change the last byte of the record, keeping the file well-formed. */
+static int
+corrupt_cache_file(const char *path)
+{
+    FILE *fp;
+    int c;
+
+    fp = fopen(path, "r+b");
+    assert(fp);
+    assert(fseek(fp, -1, SEEK_END) == 0);
+    c = fgetc(fp);
+    assert(c != EOF);
+    assert(fseek(fp, -1, SEEK_END) == 0);
+    assert(fputc(c ^ 0x01, fp) != EOF);
+    return fclose(fp);
+}
+
+static void
+test_cache(void)
+{
+    struct test_model system_models[] =  {
+        {"m1", "vendor1", "desc1"},
+        {"m2", "vendor2", "desc2"},
+        {NULL},
+    };
+    struct test_layout system_layouts[] =  {
+        {"l1", NO_VARIANT, "lbrief1", "ldesc1", {"eng", "fra"}, {"US"}},
+        {"l1", "v1", "vbrief1", "vdesc1", {"deu"}},
+        {"l2", NO_VARIANT, "lbrief2", "ldesc2"},
+        {NULL},
+    };
+    struct test_option_group system_groups[] = {
+        {"grp1", "gdesc1", true,
+          { {"grp1:1", "odesc11"}, {"grp1:2", "odesc12"} } },
+        {"grp2", "gdesc2", false,
+          { {"grp2:1", "odesc21"}, {"grp2:2", "odesc22"} } },
+        { NULL },
+    };
+    struct test_layout inherited =
+        {"l1", "v1", "vbrief1", "vdesc1", {"deu"}, {"US"}};
+    struct rxkb_context *ctx;
+    struct rxkb_layout *l;
+    struct rxkb_option_group *g;
+    char rules[PATH_MAX];
+    char *basedir, *cachedir;
+    char buf[4096];
+    struct stat st;
+    size_t size;
+    FILE *fp;
+    char *m1;
+
+    basedir = test_create_rules("xkbtests", system_models, system_layouts,
+                                system_groups);
+    cachedir = test_maketempdir("xkbtests.cache.XXXXXX");
+    assert(snprintf_safe(rules, sizeof(rules), "%s/rules/xkbtests.xml",
+                         basedir));
+
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    assert(!rxkb_context_set_cache_dir(ctx, "/foo/bar/baz/bat"));
+    assert(!rxkb_context_set_cache_dir(ctx, rules));
+    rxkb_context_unref(ctx);
+
+    /* A file modified in the current second is not cached */
+    set_mtime(rules, time(NULL) + 60);
+    ctx = test_setup_cached_context(basedir, cachedir);
+    rxkb_context_unref(ctx);
+    ctx = test_setup_cached_context(basedir, cachedir);
+    assert(!cache_loaded);
+    rxkb_context_unref(ctx);
+
+    /* The first context writes the cache, the second one reads it */
+    set_mtime(rules, time(NULL) - 10);
+    for (int i = 0; i < 2; i++) {
+        ctx = test_setup_cached_context(basedir, cachedir);
+        assert(cache_loaded == (i == 1));
+        assert(!rxkb_context_set_cache_dir(ctx, cachedir));
+
+        assert(find_models(ctx, "m1", "m2", NULL));
+        assert(find_layouts(ctx, "l1", NO_VARIANT,
+                                 "l1", "v1",
+                                 "l2", NO_VARIANT, NULL));
+        l = fetch_layout(ctx, "l1", NO_VARIANT);
+        assert(cmp_layouts(&system_layouts[0], l));
+        rxkb_layout_unref(l);
+        l = fetch_layout(ctx, "l1", "v1");
+        assert(cmp_layouts(&inherited, l));
+        rxkb_layout_unref(l);
+        g = fetch_option_group(ctx, "grp1");
+        assert(cmp_option_groups(&system_groups[0], g, CMP_EXACT));
+        rxkb_option_group_unref(g);
+        g = fetch_option_group(ctx, "grp2");
+        assert(cmp_option_groups(&system_groups[1], g, CMP_EXACT));
+        rxkb_option_group_unref(g);
+
+        rxkb_context_unref(ctx);
+    }
+
+    /* Rename m1 to m3 without changing the size and the mtime of the file:
+     * the ctime still changes, so the cache is not used */
+    assert(stat(rules, &st) == 0);
+    fp = fopen(rules, "r+");
+    assert(fp);
+    size = fread(buf, 1, sizeof(buf) - 1, fp);
+    assert(size == (size_t) st.st_size);
+    buf[size] = '\0';
+    m1 = strstr(buf, "<name>m1</name>");
+    assert(m1);
+    m1[strlen("<name>m")] = '3';
+    rewind(fp);
+    assert(fwrite(buf, 1, size, fp) == size);
+    fclose(fp);
+    set_mtime(rules, time(NULL) - 10);
+
+    ctx = test_setup_cached_context(basedir, cachedir);
+    assert(!cache_loaded);
+    assert(find_models(ctx, "m3", "m2", NULL));
+    assert(!find_model(ctx, "m1"));
+    rxkb_context_unref(ctx);
+
+    /* Changing the size invalidates the cache */
+    fp = fopen(rules, "a");
+    assert(fp);
+    fprintf(fp, "\n");
+    fclose(fp);
+    set_mtime(rules, time(NULL) - 10);
+
+    ctx = test_setup_cached_context(basedir, cachedir);
+    assert(!cache_loaded);
+    assert(find_models(ctx, "m3", "m2", NULL));
+    assert(!find_model(ctx, "m1"));
+    rxkb_context_unref(ctx);
+
+    /* A truncated or corrupted cache is ignored and rebuilt */
+    for (int j = 0; j < 2; j++) {
+        test_foreach_file(cachedir, j == 0 ? truncate_cache_file
+                                           : corrupt_cache_file);
+        for (int i = 0; i < 2; i++) {
+            ctx = test_setup_cached_context(basedir, cachedir);
+            assert(cache_corrupted == (i == 0));
+            assert(cache_loaded == (i == 1));
+            assert(find_models(ctx, "m3", "m2", NULL));
+            assert(find_layouts(ctx, "l1", NO_VARIANT,
+                                     "l1", "v1",
+                                     "l2", NO_VARIANT, NULL));
+            rxkb_context_unref(ctx);
+        }
+    }
+
+    test_foreach_file(cachedir, unlink);
+    rmdir(cachedir);
+    free(cachedir);
+    test_remove_rules(basedir, "xkbtests");
+}
+
 int
 main(void)
 {
@@ -1015,7 +1404,10 @@ main(void)
     test_load_merge_no_overwrite();
     test_load_languages();
     test_load_invalid_languages();
+    test_load_invalid_structure();
     test_popularity();
+    test_find();
+    test_cache();
 
     return 0;
 }
@@ -86,6 +86,43 @@ test_rules(struct xkb_context *ctx, struct test_data *data)
     return passed;
 }
 
+/* All at once: the results are the same as one at a time. */
+static bool
+test_rules_batch(struct xkb_context *ctx, struct test_data **data,
+                 size_t count)
+{
+    struct xkb_rule_names rmlvos[16];
+    struct xkb_component_names kccgst[16];
+    bool passed = true;
+
+    assert(count <= ARRAY_SIZE(rmlvos));
+    for (size_t i = 0; i < count; i++)
+        rmlvos[i] = (struct xkb_rule_names) {
+            data[i]->rules, data[i]->model, data[i]->layout,
+            data[i]->variant, data[i]->options
+        };
+
+    xkb_components_from_rules_batch(ctx, rmlvos, count, kccgst);
+
+    for (size_t i = 0; i < count; i++) {
+        if (data[i]->should_fail)
+            passed = passed && !kccgst[i].keycodes && !kccgst[i].symbols;
+        else
+            passed = passed && kccgst[i].keycodes &&
+                     streq(kccgst[i].keycodes, data[i]->keycodes) &&
+                     streq(kccgst[i].types, data[i]->types) &&
+                     streq(kccgst[i].compat, data[i]->compat) &&
+                     streq(kccgst[i].symbols, data[i]->symbols);
+
+        free(kccgst[i].keycodes);
+        free(kccgst[i].types);
+        free(kccgst[i].compat);
+        free(kccgst[i].symbols);
+    }
+
+    return passed;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -136,6 +173,27 @@ main(int argc, char *argv[])
     };
     assert(test_rules(ctx, &test4));
 
+    struct test_data test4b = {
+        .rules = "groups",
+
+        .model = "m17", .layout = "foo", .variant = "", .options = "",
+
+        .keycodes = "big(m17)", .types = "default_types",
+        .compat = "default_compat", .symbols = "default_symbols",
+    };
+    assert(test_rules(ctx, &test4b));
+
+    /* Only the first definition of a group counts. */
+    struct test_data test4c = {
+        .rules = "groups",
+
+        .model = "other", .layout = "foo", .variant = "", .options = "",
+
+        .keycodes = "default_keycodes", .types = "default_types",
+        .compat = "default_compat", .symbols = "default_symbols",
+    };
+    assert(test_rules(ctx, &test4c));
+
     struct test_data test5 = {
         .rules = "simple",
 
@@ -170,6 +228,12 @@ main(int argc, char *argv[])
     };
     assert(test_rules(ctx, &test7));
 
+    struct test_data *all[] = {
+        &test1, &test2, &test3, &test4, &test4b, &test4c, &test5, &test6,
+        &test7, &test1,
+    };
+    assert(test_rules_batch(ctx, all, ARRAY_SIZE(all)));
+
     xkb_context_unref(ctx);
     return 0;
 }
@@ -25,6 +25,7 @@
 
 #include "evdev-scancodes.h"
 #include "test.h"
+#include "keymap.h"
 
 static int
 test_rmlvo_va(struct xkb_context *context, const char *rules,
@@ -107,6 +108,73 @@ test_rmlvo_env(struct xkb_context *ctx, const char *rules, const char *model,
     return ret;
 }
 
+/* A derived keymap must be the same as one compiled from scratch. */
+static bool
+test_derived_keymap(struct xkb_context *ctx, struct xkb_keymap *source,
+                    const struct xkb_rule_names *names)
+{
+    struct xkb_keymap *derived, *expected;
+    char *derived_str, *expected_str;
+    bool ok;
+
+    derived = xkb_keymap_derive_from_names(source, names, 0);
+    expected = xkb_keymap_new_from_names(ctx, names, 0);
+    assert(derived && expected);
+
+    derived_str = xkb_keymap_get_as_string(derived, XKB_KEYMAP_FORMAT_TEXT_V1);
+    expected_str = xkb_keymap_get_as_string(expected,
+                                            XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(derived_str && expected_str);
+    ok = streq(derived_str, expected_str);
+
+    free(derived_str);
+    free(expected_str);
+    xkb_keymap_unref(derived);
+    xkb_keymap_unref(expected);
+    return ok;
+}
+
+static void
+test_derive_from_names(struct xkb_context *ctx)
+{
+    struct xkb_rule_names names = {
+        .rules = "evdev", .model = "pc105", .layout = "us",
+    };
+    struct xkb_keymap *keymap, *derived;
+    char *str;
+
+    keymap = xkb_keymap_new_from_names(ctx, &names, 0);
+    assert(keymap);
+
+    /* Same names: the keymap is reused as is. */
+    derived = xkb_keymap_derive_from_names(keymap, &names, 0);
+    assert(derived == keymap);
+    xkb_keymap_unref(derived);
+
+    /* Only the symbols change: the base is compiled on first use only. */
+    assert(!keymap->base);
+    names.layout = "us,de";
+    names.options = "grp:alts_toggle,ctrl:nocaps";
+    assert(test_derived_keymap(ctx, keymap, &names));
+    assert(keymap->base);
+
+    /* The compat section changes too. */
+    names.options = "grp:alts_toggle,grp_led:scroll";
+    assert(test_derived_keymap(ctx, keymap, &names));
+
+    /* Keymaps not compiled from names can be derived from as well. */
+    str = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(str);
+    derived = xkb_keymap_new_from_string(ctx, str, XKB_KEYMAP_FORMAT_TEXT_V1,
+                                         0);
+    assert(derived);
+    assert(test_derived_keymap(ctx, derived, &names));
+
+    free(str);
+    xkb_keymap_unref(derived);
+    xkb_keymap_unref(keymap);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -114,6 +182,8 @@ main(int argc, char *argv[])
 
     assert(ctx);
 
+    test_derive_from_names(ctx);
+
 #define KS(name) xkb_keysym_from_name(name, 0)
 
     assert(test_rmlvo(ctx, "evdev", "pc105", "us,il,ru,ca", ",,,multix", "grp:alts_toggle,ctrl:nocaps,compose:rwin",
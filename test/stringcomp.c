@@ -26,11 +26,160 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "test.h"
 
 #define DATA_PATH "keymaps/stringcomp.data"
 
+struct chunks {
+    char *data;
+    size_t size;
+    unsigned int num_chunks;
+    unsigned int max_chunks;
+};
+
+static int
+append_chunk(void *user_data, const char *data, size_t size)
+{
+    struct chunks *chunks = user_data;
+
+    if (chunks->num_chunks >= chunks->max_chunks)
+        return 0;
+
+    chunks->data = realloc(chunks->data, chunks->size + size + 1);
+    assert(chunks->data);
+    memcpy(chunks->data + chunks->size, data, size);
+    chunks->size += size;
+    chunks->data[chunks->size] = '\0';
+    chunks->num_chunks++;
+    return 1;
+}
+
+static void
+test_write(struct xkb_keymap *keymap, const char *dump)
+{
+    struct chunks chunks = { .max_chunks = UINT_MAX };
+    size_t size;
+
+    /* Counting only. */
+    size = xkb_keymap_write(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT, 0, NULL,
+                            NULL);
+    assert(size == strlen(dump));
+
+    /* In several chunks. */
+    size = xkb_keymap_write(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT, 0,
+                            append_chunk, &chunks);
+    assert(size == strlen(dump));
+    assert(chunks.num_chunks > 1);
+    assert(streq(chunks.data, dump));
+    free(chunks.data);
+
+    /* Stopped by the callback. */
+    chunks = (struct chunks) { .max_chunks = 1 };
+    size = xkb_keymap_write(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT, 0,
+                            append_chunk, &chunks);
+    assert(size == 0);
+    assert(chunks.num_chunks == 1);
+    free(chunks.data);
+
+    assert(xkb_keymap_write(keymap, 4893, 0, NULL, NULL) == 0);
+
+#ifdef HAVE_MEMFD_CREATE
+    {
+        int fd;
+        char *contents;
+        ssize_t count;
+
+        fd = xkb_keymap_get_as_fd(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT, 0,
+                                  &size);
+        assert(fd >= 0);
+        assert(size == strlen(dump) + 1);
+        contents = malloc(size);
+        assert(contents);
+        count = read(fd, contents, size);
+        assert(count == (ssize_t) size);
+        assert(contents[size - 1] == '\0');
+        assert(streq(contents, dump));
+        /* The file is sealed. */
+        assert(write(fd, "x", 1) < 0);
+        free(contents);
+        close(fd);
+    }
+#endif
+}
+
+static void
+test_compact(struct xkb_context *ctx, struct xkb_keymap *keymap,
+             const char *dump)
+{
+    struct xkb_keymap *keymap2;
+    char *compact, *compact2;
+    xkb_keycode_t kc;
+
+    compact = xkb_keymap_get_as_string2(keymap,
+                                        XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                                        XKB_KEYMAP_SERIALIZE_COMPACT);
+    assert(compact);
+    assert(strlen(compact) < strlen(dump));
+    assert(xkb_keymap_write(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                            XKB_KEYMAP_SERIALIZE_COMPACT, NULL, NULL) ==
+           strlen(compact));
+
+    /* The compact string gives a keymap which behaves the same. */
+    keymap2 = test_compile_string(ctx, compact);
+    assert(keymap2);
+    assert(xkb_keymap_min_keycode(keymap2) == xkb_keymap_min_keycode(keymap));
+    assert(xkb_keymap_max_keycode(keymap2) == xkb_keymap_max_keycode(keymap));
+    for (kc = xkb_keymap_min_keycode(keymap);
+         kc <= xkb_keymap_max_keycode(keymap); kc++) {
+        xkb_layout_index_t num_layouts;
+
+        num_layouts = xkb_keymap_num_layouts_for_key(keymap, kc);
+        assert(xkb_keymap_num_layouts_for_key(keymap2, kc) == num_layouts);
+        assert(xkb_keymap_key_repeats(keymap2, kc) ==
+               xkb_keymap_key_repeats(keymap, kc));
+        for (xkb_layout_index_t layout = 0; layout < num_layouts; layout++) {
+            xkb_level_index_t num_levels;
+
+            num_levels = xkb_keymap_num_levels_for_key(keymap, kc, layout);
+            assert(xkb_keymap_num_levels_for_key(keymap2, kc, layout) ==
+                   num_levels);
+            for (xkb_level_index_t level = 0; level < num_levels; level++) {
+                const xkb_keysym_t *syms, *syms2;
+                int count;
+
+                count = xkb_keymap_key_get_syms_by_level(keymap, kc, layout,
+                                                         level, &syms);
+                assert(xkb_keymap_key_get_syms_by_level(keymap2, kc, layout,
+                                                        level, &syms2) ==
+                       count);
+                assert(count == 0 ||
+                       memcmp(syms, syms2, count * sizeof(*syms)) == 0);
+            }
+        }
+    }
+    assert(xkb_keymap_mod_get_index(keymap2, "NumLock") != XKB_MOD_INVALID);
+    assert(xkb_keymap_num_leds(keymap2) == xkb_keymap_num_leds(keymap));
+
+    /* Compacting is stable. */
+    compact2 = xkb_keymap_get_as_string2(keymap2,
+                                         XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                                         XKB_KEYMAP_SERIALIZE_COMPACT);
+    assert(compact2);
+    assert(streq(compact, compact2));
+
+    assert(!xkb_keymap_get_as_string2(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                                      0x80));
+
+    free(compact);
+    free(compact2);
+    xkb_keymap_unref(keymap2);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -88,6 +237,29 @@ main(int argc, char *argv[])
     assert(dump2);
     assert(streq(dump, dump2));
 
+    test_write(keymap, dump);
+    test_compact(ctx, keymap, dump);
+
+    /* The cached string is the same, and shared. */
+    {
+        const char *cached, *cached2;
+        size_t size;
+
+        cached = xkb_keymap_get_as_cached_string(keymap,
+                                                 XKB_KEYMAP_FORMAT_TEXT_V1,
+                                                 &size);
+        assert(cached && size == strlen(dump) && streq(cached, dump));
+        cached2 = xkb_keymap_get_as_cached_string(
+            keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT, NULL);
+        assert(cached2 == cached);
+        assert(!xkb_keymap_get_as_cached_string(keymap, 4893, NULL));
+        free(dump2);
+        dump2 = xkb_keymap_get_as_string(keymap,
+                                         XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+        assert(dump2 && dump2 != cached && streq(dump2, dump));
+        test_write(keymap, dump);
+    }
+
     /* Test response to invalid formats and flags. */
     assert(!xkb_keymap_new_from_string(ctx, dump, 0, 0));
     assert(!xkb_keymap_new_from_string(ctx, dump, -1, 0));
@@ -0,0 +1,145 @@
+/*
+ * Copyright © 2023 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xkbcommon/xkbcommon.h"
+#include "bundle.h"
+
+static void
+usage(const char *argv0, FILE *fp)
+{
+    fprintf(fp, "Usage: %s [OPTIONS] <output file>\n"
+                "\n"
+                "Write an include bundle of the files of an XKB include root,\n"
+                "to be used with XKB_CONFIG_BUNDLE or\n"
+                "xkb_context_include_path_append_bundle()\n"
+                "\n"
+                "Options:\n"
+                " --help\n"
+                "    Print this help and exit\n"
+                " --verbose\n"
+                "    Enable verbose debugging output\n"
+                " --root <path>\n"
+                "    The include root to bundle (default: %s)\n",
+                argv0, DFLT_XKB_CONFIG_ROOT);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *root = DFLT_XKB_CONFIG_ROOT;
+    const char *output;
+    struct xkb_context *ctx;
+    char *tmp;
+    size_t tmp_size;
+    FILE *file;
+    bool verbose = false;
+    bool ok;
+    enum options {
+        OPT_VERBOSE,
+        OPT_ROOT,
+    };
+    static struct option opts[] = {
+        {"help",    no_argument,        0, 'h'},
+        {"verbose", no_argument,        0, OPT_VERBOSE},
+        {"root",    required_argument,  0, OPT_ROOT},
+        {0, 0, 0, 0},
+    };
+
+    while (1) {
+        int opt;
+        int option_index = 0;
+
+        opt = getopt_long(argc, argv, "h", opts, &option_index);
+        if (opt == -1)
+            break;
+
+        switch (opt) {
+        case OPT_VERBOSE:
+            verbose = true;
+            break;
+        case OPT_ROOT:
+            root = optarg;
+            break;
+        case 'h':
+            usage(argv[0], stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0], stderr);
+            return EXIT_INVALID_USAGE;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0], stderr);
+        return EXIT_INVALID_USAGE;
+    }
+    output = argv[optind];
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    if (!ctx) {
+        fprintf(stderr, "Couldn't create xkb context\n");
+        return EXIT_FAILURE;
+    }
+    if (verbose) {
+        xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_DEBUG);
+        xkb_context_set_log_verbosity(ctx, 10);
+    }
+
+    /* Write next to the output and rename, so it is never seen half
+     * written. */
+    tmp_size = strlen(output) + sizeof(".tmp");
+    tmp = malloc(tmp_size);
+    if (tmp)
+        snprintf(tmp, tmp_size, "%s.tmp", output);
+    file = tmp ? fopen(tmp, "wb") : NULL;
+    if (!file) {
+        fprintf(stderr, "Couldn't create %s: %s\n",
+                tmp ? tmp : output, strerror(errno));
+        free(tmp);
+        xkb_context_unref(ctx);
+        return EXIT_FAILURE;
+    }
+
+    ok = xkb_bundle_write(ctx, root, file);
+    ok = (fclose(file) == 0) && ok;
+    if (ok && rename(tmp, output) != 0) {
+        fprintf(stderr, "Couldn't write %s: %s\n", output, strerror(errno));
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Couldn't write the bundle of %s\n", root);
+        remove(tmp);
+    }
+
+    free(tmp);
+    xkb_context_unref(ctx);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -47,6 +47,7 @@ static enum output_format {
     FORMAT_KCCGST,
     FORMAT_KEYMAP_FROM_XKB,
 } output_format = FORMAT_KEYMAP;
+static bool batch = false;
 static const char *includes[64];
 static size_t num_includes = 0;
 
@@ -63,6 +64,12 @@ usage(char **argv)
 #if ENABLE_PRIVATE_APIS
            " --kccgst\n"
            "    Print a keymap which only includes the KcCGST component names instead of the full keymap\n"
+           " --batch\n"
+           "    With --kccgst, read one RMLVO per line from stdin and print the KcCGST\n"
+           "    of each, resolving them all in a single pass over the rules.\n"
+           "    The line holds the model, layout, variant and options, separated\n"
+           "    by tabs; missing or empty fields are taken from the options below.\n"
+           "    A line which cannot be resolved gives a keymap with an error comment.\n"
 #endif
            " --rmlvo\n"
            "    Print the full RMLVO with the defaults filled in for missing elements\n"
@@ -106,6 +113,7 @@ parse_options(int argc, char **argv, struct xkb_rule_names *names)
     enum options {
         OPT_VERBOSE,
         OPT_KCCGST,
+        OPT_BATCH,
         OPT_RMLVO,
         OPT_FROM_XKB,
         OPT_INCLUDE,
@@ -121,6 +129,7 @@ parse_options(int argc, char **argv, struct xkb_rule_names *names)
         {"verbose",          no_argument,            0, OPT_VERBOSE},
 #if ENABLE_PRIVATE_APIS
         {"kccgst",           no_argument,            0, OPT_KCCGST},
+        {"batch",            no_argument,            0, OPT_BATCH},
 #endif
         {"rmlvo",            no_argument,            0, OPT_RMLVO},
         {"from-xkb",         no_argument,            0, OPT_FROM_XKB},
@@ -151,6 +160,9 @@ parse_options(int argc, char **argv, struct xkb_rule_names *names)
         case OPT_KCCGST:
             output_format = FORMAT_KCCGST;
             break;
+        case OPT_BATCH:
+            batch = true;
+            break;
         case OPT_RMLVO:
             output_format = FORMAT_RMLVO;
             break;
@@ -193,6 +205,12 @@ parse_options(int argc, char **argv, struct xkb_rule_names *names)
 
     }
 
+    if (batch && output_format != FORMAT_KCCGST) {
+        fprintf(stderr, "error: --batch requires --kccgst\n");
+        usage(argv);
+        exit(EXIT_INVALID_USAGE);
+    }
+
     return true;
 }
 
@@ -233,6 +251,136 @@ print_kccgst(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo)
 #endif
 }
 
+#if ENABLE_PRIVATE_APIS
+/*
+ * Split off the next tab-separated field of @line. Missing and empty
+ * fields get the fallback, like unset names outside of batch mode.
+ */
+static const char *
+next_field(char **line, const char *fallback)
+{
+    char *field = *line;
+
+    if (!field)
+        return fallback;
+
+    *line = strchr(field, '\t');
+    if (*line)
+        *(*line)++ = '\0';
+    return field[0] != '\0' ? field : fallback;
+}
+#endif
+
+static bool
+print_kccgst_batch(struct xkb_context *ctx,
+                   const struct xkb_rule_names *defaults)
+{
+#if ENABLE_PRIVATE_APIS
+    struct xkb_rule_names *rmlvos = NULL;
+    struct xkb_component_names *kccgst = NULL;
+    char **lines = NULL;
+    size_t *line_nos = NULL;
+    size_t count = 0, alloc = 0, line_no = 0;
+    char *buf = NULL;
+    size_t buf_size = 0;
+    bool success = false;
+
+    /* Each line gets its own buffer, kept until the end. */
+    while (getline(&buf, &buf_size, stdin) != -1) {
+        char *line;
+
+        line_no++;
+        buf[strcspn(buf, "\r\n")] = '\0';
+        if (buf[0] == '\0')
+            continue;
+
+        if (count >= alloc) {
+            size_t new_alloc = alloc ? 2 * alloc : 64;
+            void *p;
+
+            p = realloc(rmlvos, new_alloc * sizeof(*rmlvos));
+            if (!p)
+                goto err_alloc;
+            rmlvos = p;
+            p = realloc(lines, new_alloc * sizeof(*lines));
+            if (!p)
+                goto err_alloc;
+            lines = p;
+            p = realloc(line_nos, new_alloc * sizeof(*line_nos));
+            if (!p)
+                goto err_alloc;
+            line_nos = p;
+            alloc = new_alloc;
+        }
+
+        line = lines[count] = buf;
+        buf = NULL;
+        buf_size = 0;
+        line_nos[count] = line_no;
+        rmlvos[count].rules = defaults->rules;
+        rmlvos[count].model = next_field(&line, defaults->model);
+        rmlvos[count].layout = next_field(&line, defaults->layout);
+        rmlvos[count].variant = next_field(&line, defaults->variant);
+        rmlvos[count].options = next_field(&line, defaults->options);
+        count++;
+    }
+
+    if (ferror(stdin)) {
+        fprintf(stderr, "Failed to read the batch input: %s\n",
+                strerror(errno));
+        goto out;
+    }
+
+    kccgst = calloc(count ? count : 1, sizeof(*kccgst));
+    if (!kccgst)
+        goto err_alloc;
+    xkb_components_from_rules_batch(ctx, rmlvos, count, kccgst);
+
+    success = true;
+    for (size_t i = 0; i < count; i++) {
+        /* Keep one keymap per input line, so outputs match inputs. */
+        if (!kccgst[i].keycodes) {
+            fprintf(stderr, "Failed to resolve line %zu\n", line_nos[i]);
+            printf("xkb_keymap {\n"
+                   "  // error: failed to resolve line %zu\n"
+                   "};\n", line_nos[i]);
+            success = false;
+            continue;
+        }
+
+        printf("xkb_keymap {\n"
+               "  xkb_keycodes { include \"%s\" };\n"
+               "  xkb_types { include \"%s\" };\n"
+               "  xkb_compat { include \"%s\" };\n"
+               "  xkb_symbols { include \"%s\" };\n"
+               "};\n",
+               kccgst[i].keycodes, kccgst[i].types, kccgst[i].compat,
+               kccgst[i].symbols);
+        free(kccgst[i].keycodes);
+        free(kccgst[i].types);
+        free(kccgst[i].compat);
+        free(kccgst[i].symbols);
+    }
+
+    goto out;
+
+err_alloc:
+    fprintf(stderr, "Failed to allocate the batch input\n");
+out:
+    free(buf);
+    for (size_t i = 0; i < count; i++)
+        free(lines[i]);
+    free(lines);
+    free(line_nos);
+    free(rmlvos);
+    free(kccgst);
+
+    return success;
+#else
+    return false;
+#endif
+}
+
 static bool
 print_keymap(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo)
 {
@@ -363,6 +511,8 @@ main(int argc, char **argv)
         rc = print_rmlvo(ctx, &names) ? EXIT_SUCCESS : EXIT_FAILURE;
     } else if (output_format == FORMAT_KEYMAP) {
         rc = print_keymap(ctx, &names) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (output_format == FORMAT_KCCGST && batch) {
+        rc = print_kccgst_batch(ctx, &names) ? EXIT_SUCCESS : EXIT_FAILURE;
     } else if (output_format == FORMAT_KCCGST) {
         rc = print_kccgst(ctx, &names) ? EXIT_SUCCESS : EXIT_FAILURE;
     } else if (output_format == FORMAT_KEYMAP_FROM_XKB) {
@@ -31,8 +31,6 @@
 
 #include "xkbcommon/xkbcommon.h"
 
-#define ARRAY_SIZE(arr) ((sizeof(arr) / sizeof(*(arr))))
-
 static void
 usage(const char *argv0, FILE *fp)
 {
@@ -59,7 +57,8 @@ main(int argc, char *argv[])
     int ret;
     char name[200];
     struct xkb_keymap *keymap = NULL;
-    xkb_keycode_t min_keycode, max_keycode;
+    struct xkb_key_position *positions = NULL;
+    size_t num_positions;
     xkb_mod_index_t num_mods;
     enum options {
         OPT_KEYSYM,
@@ -172,67 +171,48 @@ main(int argc, char *argv[])
     printf("%-8s %-9s %-8s %-20s %-7s %-s\n",
            "KEYCODE", "KEY NAME", "LAYOUT", "LAYOUT NAME", "LEVEL#", "MODIFIERS");
 
-    min_keycode = xkb_keymap_min_keycode(keymap);
-    max_keycode = xkb_keymap_max_keycode(keymap);
+    num_positions = xkb_keymap_keysym_get_positions(keymap, keysym, NULL, 0);
+    if (num_positions > 0) {
+        positions = calloc(num_positions, sizeof(*positions));
+        if (!positions) {
+            fprintf(stderr, "Failed to allocate positions\n");
+            goto err;
+        }
+        xkb_keymap_keysym_get_positions(keymap, keysym,
+                                        positions, num_positions);
+    }
+
     num_mods = xkb_keymap_num_mods(keymap);
-    for (xkb_keycode_t keycode = min_keycode; keycode <= max_keycode; keycode++) {
+    for (size_t i = 0; i < num_positions; i++) {
+        const struct xkb_key_position *pos = &positions[i];
         const char *key_name;
-        xkb_layout_index_t num_layouts;
+        const char *layout_name;
 
-        key_name = xkb_keymap_key_get_name(keymap, keycode);
+        key_name = xkb_keymap_key_get_name(keymap, pos->keycode);
         if (!key_name) {
             continue;
         }
 
-        num_layouts = xkb_keymap_num_layouts_for_key(keymap, keycode);
-        for (xkb_layout_index_t layout = 0; layout < num_layouts; layout++) {
-            const char *layout_name;
-            xkb_level_index_t num_levels;
-
-            layout_name = xkb_keymap_layout_get_name(keymap, layout);
-            if (!layout_name) {
-                layout_name = "?";
-            }
+        layout_name = xkb_keymap_layout_get_name(keymap, pos->layout);
+        if (!layout_name) {
+            layout_name = "?";
+        }
 
-            num_levels = xkb_keymap_num_levels_for_key(keymap, keycode, layout);
-            for (xkb_level_index_t level = 0; level < num_levels; level++) {
-                int num_syms;
-                const xkb_keysym_t *syms;
-                size_t num_masks;
-                xkb_mod_mask_t masks[100];
-
-                num_syms = xkb_keymap_key_get_syms_by_level(
-                    keymap, keycode, layout, level, &syms
-                );
-                if (num_syms != 1) {
-                    continue;
-                }
-                if (syms[0] != keysym) {
-                    continue;
-                }
-
-                num_masks = xkb_keymap_key_get_mods_for_level(
-                    keymap, keycode, layout, level, masks, ARRAY_SIZE(masks)
-                );
-                for (size_t i = 0; i < num_masks; i++) {
-                    xkb_mod_mask_t mask = masks[i];
-
-                    printf("%-8u %-9s %-8u %-20s %-7u [ ",
-                           keycode, key_name, layout + 1, layout_name, level + 1);
-                    for (xkb_mod_index_t mod = 0; mod < num_mods; mod++) {
-                        if ((mask & (1 << mod)) == 0) {
-                            continue;
-                        }
-                        printf("%s ", xkb_keymap_mod_get_name(keymap, mod));
-                    }
-                    printf("]\n");
-                }
+        printf("%-8u %-9s %-8u %-20s %-7u [ ",
+               pos->keycode, key_name, pos->layout + 1, layout_name,
+               pos->level + 1);
+        for (xkb_mod_index_t mod = 0; mod < num_mods; mod++) {
+            if ((pos->mods & (1 << mod)) == 0) {
+                continue;
             }
+            printf("%s ", xkb_keymap_mod_get_name(keymap, mod));
         }
+        printf("]\n");
     }
 
     err = EXIT_SUCCESS;
 err:
+    free(positions);
     xkb_keymap_unref(keymap);
     xkb_context_unref(ctx);
     return err;
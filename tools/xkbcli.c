@@ -63,6 +63,11 @@ usage(void)
            "    Compile an XKB keymap\n"
            "\n"
 #endif
+#if HAVE_XKBCLI_COMPILE_DATABASE
+           "  compile-database\n"
+           "    Write an include bundle of an XKB include root\n"
+           "\n"
+#endif
 #if HAVE_XKBCLI_HOW_TO_TYPE
            "  how-to-type\n"
            "    Print key sequences to type a Unicode codepoint\n"